@@ -1,8 +1,13 @@
 #include <ctype.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "hdr/action.h"
+#include "hdr/autosave.h"
 #include "hdr/commandline.h"
+#include "hdr/export.h"
+#include "hdr/history.h"
 #include "hdr/interface.h"
 #include "hdr/tile.h"
 #include "hdr/file.h"
@@ -18,39 +23,103 @@ void action_message(enum STATUS s, const char *str)
 
 void action_write(const char *filename)
 {
-    FILE *file = NULL;
+    const char *target = (filename) ? filename : state_filename();
 
-    if (filename) {
-        file = fopen(filename, "w");
-    } else {
-        if (!state_filename()) {
-            action_message(STATUS_ERROR_WRITE, "<unnamed>");
-            return;
-        }
-        file = fopen(state_filename(), "w");
+    if (!target) {
+        action_message(STATUS_ERROR_WRITE, "<unnamed>");
+        return;
     }
 
-    if (!file) {
-        action_message(STATUS_ERROR_WRITE, filename);
+    if (!file_write(target, state_atlas())) {
+        action_message(STATUS_ERROR_WRITE, target);
         return;
     }
+    action_message(STATUS_SUCCESS_WRITE, target);
+}
 
-    write_state(file);
-    fclose(file);
-    action_message(STATUS_SUCCESS_WRITE, filename);
+
+void action_autosave(void)
+{
+    if (!autosave_update(state_atlas(), state_filename()) && (STATUS_OK == state_status())) {
+        action_message(STATUS_ERROR_AUTOSAVE, autosave_filename() ? autosave_filename() : "<unnamed>");
+    }
 }
 
 
 void action_edit(const char *filename)
 {
-    FILE *file = fopen(filename, "r");
-    if (file) {
-        read_state(file);
-        fclose(file);
-        action_message(STATUS_SUCCESS_EDIT_OLD, filename);
-    } else {
+    if (!filename || (access(filename, F_OK) != 0)) {
         action_message(STATUS_SUCCESS_EDIT_NEW, "<unnamed>");
+        return;
+    }
+
+    struct Atlas *atlas = file_load(filename);
+    if (!atlas) {
+        action_message(STATUS_ERROR_EDIT, filename);
+        if (file_error()) {
+            state_message_concat(": ");
+            state_message_concat(file_error());
+        }
+        return;
+    }
+
+    state_clear_atlas();
+    state_set_atlas(atlas);
+    atlas_prefetch(atlas);
+    action_message(STATUS_SUCCESS_EDIT_OLD, filename);
+}
+
+
+void action_export(const char *filename)
+{
+    if (!filename || !export_file(filename, state_atlas())) {
+        action_message(STATUS_ERROR_EXPORT, (filename) ? filename : "<unnamed>");
+        return;
     }
+    action_message(STATUS_SUCCESS_EXPORT, filename);
+}
+
+
+/* "<file> [p,q] [ours|theirs]": another save's map shifted by (p, q) tiles, merged in */
+void action_merge(const char *args)
+{
+    char filename[256] = { 0 }, offset[64] = { 0 }, policy[16] = { 0 };
+    int n = (args) ? sscanf(args, "%255s %63s %15s", filename, offset, policy) : 0;
+
+    /* the offset can be left out before a policy */
+    if ((n == 2) && isalpha((unsigned char)offset[0])) {
+        memcpy(policy, offset, sizeof(policy) - 1);
+        offset[0] = '\0';
+    }
+
+    int32_t dp = 0, dq = 0;
+    char end = '\0';
+    bool ok = (n >= 1) && (!offset[0] || (sscanf(offset, "%d,%d%c", &dp, &dq, &end) == 2));
+
+    enum MERGE m = MERGE_OURS;
+    if (ok && policy[0]) {
+        while ((m < NUM_MERGE_TABLE) && strcmp(policy, merge_str(m))) m++;
+        ok = (m < NUM_MERGE_TABLE);
+    }
+    if (!ok) {
+        action_message(STATUS_ERROR_MERGE, (args) ? args : "<unnamed>");
+        return;
+    }
+
+    /* the merge is undone by going back to the map as it was, which a paged one cannot keep */
+    struct Atlas *before = atlas_snapshot(state_atlas());
+    struct Atlas *other = file_read(filename);
+    if (!other || !atlas_import(state_atlas(), other, dp, dq, m)) {
+        atlas_destroy(before);
+        action_message(STATUS_ERROR_MERGE, filename);
+        if (!other && file_error()) {
+            state_message_concat(": ");
+            state_message_concat(file_error());
+        }
+        return;
+    }
+    history_checkpoint(before);
+    action_message(STATUS_SUCCESS_MERGE, filename);
 }
 
 
@@ -61,6 +130,14 @@ void action_hint(void)
 }
 
 
+/* nothing left to undo or redo is not worth a message */
+void action_history(key k)
+{
+    if (KEY_HISTORY_UNDO == k) history_undo(state_atlas());
+    else history_redo(state_atlas());
+}
+
+
 void action_mode(enum MODE m)
 {
     if (state_await()) {
@@ -95,40 +172,57 @@ void action_move(enum DIRECTION d, int steps)
 }
 
 
-void action_paint_terrain(enum TERRAIN t)
+/* impassable terrain keeps no roads, rivers or locations, and no neighbour's lead into it */
+void action_clear_tile(struct Atlas *atlas, struct Coordinate c)
 {
-    struct Atlas *atlas = state_atlas();
+    struct Tile *tile = chart_tile(atlas_find(atlas, c));
+    bool located = tile && tile_location(tile) && (location_type(tile_location(tile)) != LOCATION_NONE);
+    if (!tile || (!tile_roads(tile) && !tile_rivers(tile) && !located)) return;
 
-    if (atlas_terrain(atlas) == TERRAIN_UNKNOWN) atlas_create_neighbours(atlas);
-    atlas_set_terrain(atlas, t);
+    tile = atlas_touch(atlas, c);
+    struct Tile *neighbour = NULL;
 
-    if (terrain_impassable(t)) {
-        struct Tile *tile = atlas_tile(atlas);
-        struct Tile *neighbour = NULL;
+    for (int i = 0; i < NUM_DIRECTIONS; i++) {
+        if (!tile_road(tile, i) && !tile_river(tile, i)) continue;
 
-        for (int i = 0; i < NUM_DIRECTIONS; i++) {
-            neighbour = chart_tile(atlas_neighbour(atlas, i));
-            if (tile_road(tile, i)) {
-                tile_set_road(neighbour, direction_opposite(i), false);
-            }
-            if (tile_river(tile, i)) {
-                tile_set_river(neighbour, direction_opposite(i), false);
-            }
+        neighbour = atlas_touch(atlas, coordinate_shift(c, i));
+        if (tile_road(tile, i)) {
+            tile_set_road(neighbour, direction_opposite(i), false);
+        }
+        if (tile_river(tile, i)) {
+            tile_set_river(neighbour, direction_opposite(i), false);
         }
+    }
 
-        tile_clear_roads(tile);
-        tile_clear_rivers(tile);
+    tile_clear_roads(tile);
+    tile_clear_rivers(tile);
 
-        if (tile_location(tile)) {
-            location_set_type(tile_location(tile), LOCATION_NONE);
-        }
+    if (tile_location(tile)) {
+        location_set_type(tile_location(tile), LOCATION_NONE);
     }
 }
 
 
+void action_paint_terrain(enum TERRAIN t)
+{
+    struct Atlas *atlas = state_atlas();
+    struct Coordinate c = atlas_coordinate(atlas);
+
+    atlas_paint(atlas, c, state_brush(), t);
+    if (!terrain_impassable(t)) return;
+
+    size_t len = coordinate_disk(c, state_brush(), NULL);
+    struct Coordinate *disk = malloc(len * sizeof(struct Coordinate));
+    coordinate_disk(c, state_brush(), disk);
+    for (size_t i = 0; i < len; i++) action_clear_tile(atlas, disk[i]);
+    free(disk);
+}
+
+
 void action_paint_road(enum DIRECTION d)
 {
     struct Atlas *atlas = state_atlas();
+    struct Coordinate c = atlas_coordinate(atlas);
     struct Tile *tile = atlas_tile(atlas);
     struct Tile *neighbour = chart_tile(atlas_neighbour(atlas, d));
 
@@ -139,14 +233,15 @@ void action_paint_road(enum DIRECTION d)
         return;
     }
 
-    tile_toggle_road(tile, d);
-    tile_toggle_road(neighbour, direction_opposite(d));
+    tile_toggle_road(atlas_touch(atlas, c), d);
+    tile_toggle_road(atlas_touch(atlas, coordinate_shift(c, d)), direction_opposite(d));
 }
 
 
 void action_paint_river(enum DIRECTION d)
 {
     struct Atlas *atlas = state_atlas();
+    struct Coordinate c = atlas_coordinate(atlas);
     struct Tile *tile = atlas_tile(atlas);
     struct Tile *neighbour = chart_tile(atlas_neighbour(atlas, d));
 
@@ -155,8 +250,8 @@ void action_paint_river(enum DIRECTION d)
         return;
     }
 
-    tile_toggle_river(tile, d);
-    tile_toggle_river(neighbour, direction_opposite(d));
+    tile_toggle_river(atlas_touch(atlas, c), d);
+    tile_toggle_river(atlas_touch(atlas, coordinate_shift(c, d)), direction_opposite(d));
 }
 
 
@@ -202,15 +297,20 @@ void action_drag_river(enum DIRECTION d)
 
 void action_paint_location(enum LOCATION t)
 {
-    struct Tile *tile = atlas_tile(state_atlas());
+    struct Atlas *atlas = state_atlas();
+    struct Tile *tile = atlas_tile(atlas);
 
     if (terrain_impassable(tile_terrain(tile))) {
         return;
     }
 
     if (!tile_location(tile)) {
-        atlas_create_location(state_atlas(), t);
-    } else if (location_type(tile_location(tile)) == t) {
+        atlas_create_location(atlas, t);
+        return;
+    }
+
+    tile = atlas_touch(atlas, atlas_coordinate(atlas));
+    if (location_type(tile_location(tile)) == t) {
         location_set_type(tile_location(tile), LOCATION_NONE);
     } else {
         location_set_type(tile_location(tile), t);
@@ -243,6 +343,9 @@ void action_navigate(key k)
         case KEY_TOGGLE_DETAIL:
             ui_toggle_show(PANEL_DETAIL);
             return;
+        case KEY_TOGGLE_MINIMAP:
+            ui_toggle_show(PANEL_MINIMAP);
+            return;
         default:
             break;
     }
@@ -255,6 +358,9 @@ void action_terrain(key k)
         action_paint_terrain(key_terrain(k));
     }
 
+    if ((KEY_BRUSH_SMALLER == k) && (state_brush() > 0)) state_set_brush(state_brush() - 1);
+    if (KEY_BRUSH_LARGER == k) state_set_brush(state_brush() + 1);
+
     if (key_is_direction(k)) {
         enum TERRAIN t = atlas_terrain(state_atlas());
         action_move(key_direction(k), 1);
@@ -290,6 +396,13 @@ void action_command(key k)
                     break;
                 case COMMAND_EDIT:
                     action_edit(commandline_data());
+                    break;
+                case COMMAND_EXPORT:
+                    action_export(commandline_data());
+                    break;
+                case COMMAND_MERGE:
+                    action_merge(commandline_data());
+                    break;
                 default:
                     break;
             }
@@ -1,4 +1,5 @@
 #include <math.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
@@ -8,7 +9,25 @@
 #include "hdr/tile.h"
 
 
+#define ATLAS_ENV_BUDGET "HEX_MEMORY"
+#define ATLAS_HASH_SEED 0x9E3779B97F4A7C15ULL
+
 typedef struct Chart *ChartChildren[NUM_CHILDREN];
+typedef uint32_t ChartCensus[CENSUS_SIZE];
+
+
+/* the children of a chart, a running count of the terrain of every tile below and a hash
+ * of the whole subtree, kept until something below changes */
+struct Branch
+{
+    ChartChildren children;
+    ChartCensus census;
+    uint64_t hash;
+    bool hashed;
+    uint32_t stub;      /* 1 + the block still holding the children, 0 once they are here */
+    uint32_t page;      /* 1 + the page of a block read in at this chart, 0 otherwise */
+    uint32_t shares;    /* parents or atlases holding the chart besides the first */
+};
 
 
 struct Chart
@@ -16,7 +35,7 @@ struct Chart
     struct Coordinate coordinate;
     union {
         struct Tile *tile;
-        ChartChildren *children;
+        struct Branch *branch;
     } data;
 };
 
@@ -30,16 +49,39 @@ struct Chart *chart_create(struct Coordinate c)
     if (coordinate_m(c) == 0) {
         chart->data.tile = tile_create();
     } else {
-        chart->data.children = malloc(sizeof(ChartChildren));
+        chart->data.branch = malloc(sizeof(struct Branch));
         for (int i = 0; i < NUM_CHILDREN; i++) {
-            (*chart->data.children)[i] = NULL;
+            chart->data.branch->children[i] = NULL;
         }
+        memset(chart->data.branch->census, 0, sizeof(ChartCensus));
+        chart->data.branch->hash = 0;
+        chart->data.branch->hashed = false;
+        chart->data.branch->stub = 0;
+        chart->data.branch->page = 0;
+        chart->data.branch->shares = 0;
     }
 
     return chart;
 }
 
 
+/* a branch standing in for a subtree not yet read, knowing only its census and perhaps
+ * its hash (NULL if not known, when it is read in to be hashed) */
+struct Chart *chart_create_stub(struct Coordinate c, const uint32_t *census, const uint64_t *hash, uint32_t block)
+{
+    if (coordinate_m(c) == 0) return NULL;
+
+    struct Chart *chart = chart_create(c);
+    memcpy(chart->data.branch->census, census, sizeof(ChartCensus));
+    if (hash) {
+        chart->data.branch->hash = *hash;
+        chart->data.branch->hashed = true;
+    }
+    chart->data.branch->stub = block + 1;
+    return chart;
+}
+
+
 bool chart_has_children(const struct Chart *chart)
 {
     return chart->coordinate.m != 0;
@@ -52,6 +94,12 @@ bool chart_has_tile(const struct Chart *chart)
 }
 
 
+bool chart_is_stub(const struct Chart *chart)
+{
+    return chart && chart_has_children(chart) && chart->data.branch->stub;
+}
+
+
 struct Chart *chart_create_ancestor(struct Chart *chart1, struct Chart *chart2)
 {
     struct Coordinate a = coordinate_common_ancestor(
@@ -66,21 +114,77 @@ struct Chart *chart_create_ancestor(struct Chart *chart1, struct Chart *chart2)
 struct Chart *chart_child(const struct Chart *chart, enum CHILDREN c)
 {
     if (!chart || !chart_has_children(chart)) return NULL;
-    return (*chart->data.children)[c];
+    return chart->data.branch->children[c];
 }
 
 
 void chart_set_child(const struct Chart *chart, enum CHILDREN c, struct Chart *child)
 {
     if (!chart || !chart_has_children(chart)) return;
-    (*chart->data.children)[c] = child;
+    chart->data.branch->children[c] = child;
+}
+
+
+/* a chart held by more than one tree, which each has to copy before changing it */
+bool chart_shared(const struct Chart *chart)
+{
+    if (chart_has_children(chart)) return chart->data.branch->shares;
+    return chart->data.tile && tile_shares(chart->data.tile);
+}
+
+
+/* the chart to link into another tree; one with no tile has no count to keep and is
+ * simply made again */
+struct Chart *chart_share(struct Chart *chart)
+{
+    if (!chart) return NULL;
+
+    if (chart_has_children(chart)) {
+        chart->data.branch->shares++;
+    } else if (chart->data.tile) {
+        tile_set_shares(chart->data.tile, tile_shares(chart->data.tile) + 1);
+    } else {
+        struct Chart *copy = chart_create(chart->coordinate);
+        chart_clear_tile(copy);
+        return copy;
+    }
+    return chart;
+}
+
+
+/* a chart of one's own in place of a shared one, sharing in turn everything below */
+struct Chart *chart_copy(const struct Chart *chart)
+{
+    struct Chart *copy = malloc(sizeof(struct Chart));
+    copy->coordinate = chart->coordinate;
+
+    if (chart_has_tile(chart)) {
+        copy->data.tile = (chart->data.tile) ? tile_copy(chart->data.tile) : NULL;
+        return copy;
+    }
+
+    copy->data.branch = malloc(sizeof(struct Branch));
+    *copy->data.branch = *chart->data.branch;
+    copy->data.branch->shares = 0;
+    copy->data.branch->page = 0;
+    for (int i = 0; i < NUM_CHILDREN; i++) {
+        copy->data.branch->children[i] = chart_share(chart->data.branch->children[i]);
+    }
+    return copy;
 }
 
 
+/* a shared chart is only let go of, and freed by the last tree to hold it */
 void chart_destroy(struct Chart *chart)
 {
     if (!chart) return;
 
+    if (chart_shared(chart)) {
+        if (chart_has_children(chart)) chart->data.branch->shares--;
+        else tile_set_shares(chart->data.tile, tile_shares(chart->data.tile) - 1);
+        return;
+    }
+
     if (chart_has_tile(chart)) {
         tile_destroy(chart->data.tile);
         chart->data.tile = NULL;
@@ -89,10 +193,10 @@ void chart_destroy(struct Chart *chart)
     if (chart_has_children(chart)) {
         for (int i = 0; i < NUM_CHILDREN; i++) {
             chart_destroy(chart_child(chart, i));
-            (*chart->data.children)[i] = NULL;
+            chart->data.branch->children[i] = NULL;
         }
-        free(chart->data.children);
-        chart->data.children = NULL;
+        free(chart->data.branch);
+        chart->data.branch = NULL;
     }
 
     free(chart);
@@ -127,11 +231,79 @@ void chart_set_tile(struct Chart *chart, struct Tile *tile)
 }
 
 
+/* number of tiles of terrain t at or below this chart */
+uint32_t chart_census(const struct Chart *chart, enum TERRAIN t)
+{
+    if (!chart || (t >= CENSUS_SIZE)) return 0;
+    if (chart_has_children(chart)) return chart->data.branch->census[t];
+    return (chart_tile(chart) && (tile_terrain(chart_tile(chart)) == t)) ? 1 : 0;
+}
+
+
+/* most common known terrain below this chart, or unknown if there is none */
+enum TERRAIN chart_dominant(const struct Chart *chart)
+{
+    enum TERRAIN dominant = TERRAIN_UNKNOWN;
+    uint32_t n = 0;
+
+    for (enum TERRAIN t = TERRAIN_WATER; t < CENSUS_SIZE; t++) {
+        if (chart_census(chart, t) <= n) continue;
+        n = chart_census(chart, t);
+        dominant = t;
+    }
+
+    return dominant;
+}
+
+
+/* a block read in from the loader, which can be dropped back to a stub */
+struct Page
+{
+    struct Chart *chart;
+    uint32_t block;
+    uint64_t used;
+    size_t bytes;
+    bool modified;
+};
+
+
+/* a location filed under the block it falls in, for attaching as that block is read in */
+struct Filed
+{
+    struct Coordinate block;
+    size_t order;
+    struct Location *location;
+};
+
+
+/* the blocks in memory, oldest use first out once they outgrow the budget */
+struct Pager
+{
+    struct Page *pages;
+    size_t len, cap;
+    size_t bytes, budget;
+    uint64_t clock;
+    struct Paging stats;
+    struct Filed *filed;
+    size_t nfiled, filed_seen;
+    const struct Directory *filed_head;
+    uint32_t filed_level;
+};
+
+
 struct Atlas
 {
     struct Directory *directory;
     struct Chart *root;
     struct Chart *curr;
+    unsigned long revision;
+    struct Coordinate *dirty;
+    size_t ndirty, capdirty;
+    struct Loader loader;
+    struct Watcher watcher;
+    struct Pager *pager;
+    struct Prefetch *prefetch;
+    bool shared;        /* some of the tree may be a snapshot's too */
 };
 
 
@@ -142,6 +314,15 @@ struct Atlas *atlas_create(void)
     atlas->root = NULL;
     atlas->curr = NULL;
     atlas->directory = NULL;
+    atlas->revision = 0;
+    atlas->dirty = NULL;
+    atlas->ndirty = 0;
+    atlas->capdirty = 0;
+    atlas->loader = (struct Loader) { NULL, NULL, NULL, NULL };
+    atlas->watcher = (struct Watcher) { NULL, NULL };
+    atlas->pager = calloc(1, sizeof(struct Pager));
+    atlas->prefetch = NULL;
+    atlas->shared = false;
     return atlas;
 }
 
@@ -161,6 +342,12 @@ void atlas_destroy(struct Atlas *atlas)
 
     chart_destroy(atlas->root);
     directory_destroy(atlas->directory);
+    free(atlas->dirty);
+    atlas_stop_prefetch(atlas);
+    if (atlas->loader.release) atlas->loader.release(atlas->loader.data);
+    free(atlas->pager->pages);
+    free(atlas->pager->filed);
+    free(atlas->pager);
 
     atlas->root = NULL;
     atlas->curr = NULL;
@@ -169,6 +356,30 @@ void atlas_destroy(struct Atlas *atlas)
 }
 
 
+/*
+ *  An atlas holding the tree and directory as they are now, for reading while this one
+ *  is edited, in time that does not depend on the size of the map. Both share every
+ *  chart and location until one side changes it: the side that changes a tile copies it
+ *  and the charts on the path down to it, so each snapshot costs only what has been
+ *  edited since. NULL for an atlas read block by block, whose pages are dropped and read
+ *  back in place.
+ */
+struct Atlas *atlas_snapshot(struct Atlas *atlas)
+{
+    if (!atlas || atlas_paged(atlas)) return NULL;
+
+    struct Atlas *snapshot = atlas_create();
+    snapshot->root = chart_share(atlas->root);
+    snapshot->directory = directory_share(atlas->directory);
+    snapshot->revision = atlas->revision;
+    snapshot->curr = (atlas->curr) ? atlas_find(snapshot, chart_coordinate(atlas->curr)) : NULL;
+    if (!snapshot->curr) snapshot->curr = snapshot->root;
+
+    atlas->shared = snapshot->shared = true;
+    return snapshot;
+}
+
+
 struct Directory *atlas_directory(const struct Atlas *atlas)
 {
     return atlas->directory;
@@ -177,6 +388,363 @@ struct Directory *atlas_directory(const struct Atlas *atlas)
 
 struct Chart *atlas_root(const struct Atlas *atlas) { return atlas->root; }
 struct Chart *atlas_curr(const struct Atlas *atlas) { return atlas->curr; }
+unsigned long atlas_revision(const struct Atlas *atlas) { return atlas->revision; }
+
+
+void atlas_set_watcher(struct Atlas *atlas, struct Watcher watcher)
+{
+    atlas->watcher = watcher;
+}
+
+
+/* stubs are read back through the loader, which the atlas releases when destroyed */
+void atlas_set_loader(struct Atlas *atlas, struct Loader loader)
+{
+    if (atlas->loader.release) atlas->loader.release(atlas->loader.data);
+    atlas->loader = loader;
+
+    /* HEX_MEMORY caps the megabytes of blocks kept in memory */
+    const char *env = getenv(ATLAS_ENV_BUDGET);
+    if (env) atlas_set_budget(atlas, (size_t)strtoul(env, NULL, 10) << 20);
+}
+
+
+bool atlas_paged(const struct Atlas *atlas) { return atlas->loader.load != NULL; }
+struct Paging atlas_paging(const struct Atlas *atlas) { return atlas->pager->stats; }
+
+
+/* bytes of memory held by blocks before the least recently used are dropped, 0 for no limit */
+void atlas_set_budget(struct Atlas *atlas, size_t bytes)
+{
+    atlas->pager->budget = bytes;
+}
+
+
+/* what one chart at level m takes in memory, for estimates made without building one */
+size_t atlas_chart_bytes(uint32_t m, bool tile)
+{
+    if (m == 0) return sizeof(struct Chart) + ((tile) ? tile_size() : 0);
+    return sizeof(struct Chart) + sizeof(struct Branch);
+}
+
+
+size_t chart_bytes(const struct Chart *chart)
+{
+    if (!chart) return 0;
+    if (chart_has_tile(chart)) return sizeof(struct Chart) + ((chart_tile(chart)) ? tile_size() : 0);
+
+    size_t bytes = sizeof(struct Chart) + sizeof(struct Branch);
+    for (int i = 0; i < NUM_CHILDREN; i++) bytes += chart_bytes(chart_child(chart, i));
+    return bytes;
+}
+
+
+void pager_add(struct Pager *pager, struct Chart *chart, uint32_t block)
+{
+    if (pager->len == pager->cap) {
+        pager->cap = (pager->cap) ? 2*pager->cap : 64;
+        pager->pages = realloc(pager->pages, pager->cap * sizeof(struct Page));
+    }
+
+    struct Page *page = &pager->pages[pager->len++];
+    page->chart = chart;
+    page->block = block;
+    page->used = ++pager->clock;
+    page->bytes = chart_bytes(chart);
+    page->modified = false;
+
+    chart->data.branch->page = (uint32_t)pager->len;
+    pager->bytes += page->bytes;
+    pager->stats.misses++;
+    pager->stats.resident = pager->bytes;
+}
+
+
+/* the page holding a chart, or NULL if it is not inside a block read from the loader */
+struct Page *pager_find(const struct Atlas *atlas, struct Coordinate c)
+{
+    struct Chart *chart = atlas_root(atlas);
+
+    while (chart && chart_has_children(chart) && !chart_is_stub(chart)) {
+        if (chart->data.branch->page) return &atlas->pager->pages[chart->data.branch->page - 1];
+        if (coordinate_m(chart_coordinate(chart)) <= coordinate_m(c)) return NULL;
+
+        struct Coordinate next = coordinate_lift_to(c, coordinate_m(chart_coordinate(chart)) - 1);
+        chart = chart_child(chart, coordinate_index(next));
+    }
+    return NULL;
+}
+
+
+/* charts added below a block after it was read in count towards it too */
+void pager_grow(const struct Atlas *atlas, struct Page *page, size_t bytes)
+{
+    page->bytes += bytes;
+    atlas->pager->bytes += bytes;
+    atlas->pager->stats.resident = atlas->pager->bytes;
+}
+
+
+/* drop a page's subtree back to a stub, storing it first if it has changed */
+bool pager_evict(const struct Atlas *atlas, size_t i)
+{
+    struct Pager *pager = atlas->pager;
+    struct Page *page = &pager->pages[i];
+    struct Chart *chart = page->chart;
+
+    if (page->modified) {
+        if (!atlas->loader.store) return false;
+
+        uint32_t block = atlas->loader.store(atlas->loader.data, chart);
+        if (!block) return false;
+        page->block = block - 1;
+        pager->stats.writes++;
+    }
+
+    /* the stub keeps the subtree's hash, so comparisons need not read it back */
+    atlas_chart_hash(atlas, chart);
+    for (int k = 0; k < NUM_CHILDREN; k++) {
+        chart_destroy(chart->data.branch->children[k]);
+        chart->data.branch->children[k] = NULL;
+    }
+    chart->data.branch->stub = page->block + 1;
+    chart->data.branch->page = 0;
+
+    pager->bytes -= page->bytes;
+    pager->stats.evictions++;
+    pager->stats.resident = pager->bytes;
+
+    /* fill the hole from the end */
+    *page = pager->pages[--pager->len];
+    if (i < pager->len) page->chart->data.branch->page = (uint32_t)(i + 1);
+    return true;
+}
+
+
+/*
+ *  Drop the least recently used blocks until the rest fit the budget. Charts inside
+ *  dropped blocks are freed, so this is only called between edits and frames, never
+ *  while something is walking the tree; the block holding the cursor always stays, as
+ *  do changed blocks once one of them could not be stored.
+ */
+void atlas_trim(const struct Atlas *atlas)
+{
+    if (!atlas) return;
+
+    struct Pager *pager = atlas->pager;
+    struct Page *pin = pager_find(atlas, atlas_coordinate(atlas));
+    bool stuck = false;
+
+    while (pager->budget && (pager->bytes > pager->budget)) {
+        size_t oldest = pager->len;
+        for (size_t i = 0; i < pager->len; i++) {
+            if ((&pager->pages[i] == pin) || (stuck && pager->pages[i].modified)) continue;
+            if ((oldest == pager->len) || (pager->pages[i].used < pager->pages[oldest].used)) oldest = i;
+        }
+        if (oldest == pager->len) return;
+
+        struct Chart *kept = (pin) ? pin->chart : NULL;
+        if (!pager_evict(atlas, oldest)) {
+            if (!pager->pages[oldest].modified) return;
+            stuck = true;
+            continue;
+        }
+        pin = (kept) ? &pager->pages[kept->data.branch->page - 1] : NULL;
+    }
+}
+
+
+/* the chart at c below chart, without reading anything in; NULL at a stub */
+struct Chart *chart_find(struct Chart *chart, struct Coordinate c)
+{
+    uint32_t m = coordinate_m(c);
+
+    while (chart && (coordinate_m(chart_coordinate(chart)) > m)) {
+        if (chart_is_stub(chart)) return NULL;
+        struct Coordinate next = coordinate_lift_to(c, coordinate_m(chart_coordinate(chart)) - 1);
+        chart = chart_child(chart, coordinate_index(next));
+    }
+
+    return (chart && coordinate_equals(chart_coordinate(chart), c)) ? chart : NULL;
+}
+
+
+/* level 0 extent of a chart about its scaled centre, (3^m - 1)/2 */
+int64_t chart_span(const struct Chart *chart)
+{
+    int64_t span = 0;
+    for (uint32_t m = 0; m < coordinate_m(chart_coordinate(chart)); m++) span = 3*span + 1;
+    return span;
+}
+
+
+int filed_compare(const void *a, const void *b)
+{
+    const struct Filed *fa = a, *fb = b;
+    int32_t pa = coordinate_p(fa->block), pb = coordinate_p(fb->block);
+    int32_t qa = coordinate_q(fa->block), qb = coordinate_q(fb->block);
+    if (pa != pb) return (pa > pb) - (pa < pb);
+    if (qa != qb) return (qa > qb) - (qa < qb);
+    return (fa->order < fb->order) - (fa->order > fb->order);
+}
+
+
+/*
+ *  The directory's locations sorted by the block at level m they fall in, newest first
+ *  within a block as in the directory. An atlas read block by block is never shared, so
+ *  locations are only ever added at the front: those ahead of the head last seen are
+ *  sorted and merged in, and the whole directory is filed again only if that head is
+ *  gone.
+ */
+void pager_file_locations(const struct Atlas *atlas, uint32_t m)
+{
+    struct Pager *pager = atlas->pager;
+    if (pager->filed_level != m) {
+        pager->filed_head = NULL;
+        pager->nfiled = pager->filed_seen = 0;
+        pager->filed_level = m;
+    }
+    if (pager->filed && (pager->filed_head == atlas->directory)) return;
+
+    size_t len = 0;
+    struct Directory *d = atlas->directory;
+    for (; d && (d != pager->filed_head); d = directory_next(d)) len++;
+    if (d != pager->filed_head) pager->nfiled = pager->filed_seen = 0;
+
+    /* order counts up from the oldest, so later additions sort ahead within a block */
+    struct Filed *added = malloc((len ? len : 1) * sizeof(struct Filed));
+    size_t k = 0;
+    d = atlas->directory;
+    for (size_t e = 0; e < len; e++, d = directory_next(d)) {
+        struct Location *location = directory_location(d);
+        struct Coordinate l = location_coordinate(location);
+        if (coordinate_m(l) > m) continue;
+
+        added[k++] = (struct Filed) { coordinate_lift_to(l, m), pager->filed_seen + len - e, location };
+    }
+    pager->filed_seen += len;
+    qsort(added, k, sizeof(struct Filed), filed_compare);
+
+    struct Filed *filed = malloc((pager->nfiled + k + 1) * sizeof(struct Filed));
+    size_t i = 0, j = 0, n = 0;
+    while ((i < pager->nfiled) || (j < k)) {
+        bool old = (j == k) || ((i < pager->nfiled) && (filed_compare(&pager->filed[i], &added[j]) < 0));
+        filed[n++] = (old) ? pager->filed[i++] : added[j++];
+    }
+    free(added);
+    free(pager->filed);
+
+    pager->filed = filed;
+    pager->nfiled = n;
+    pager->filed_head = atlas->directory;
+}
+
+
+/* give a stub the children of the block read for it, which is then destroyed */
+bool atlas_graft(const struct Atlas *atlas, struct Chart *chart, uint32_t id, struct Atlas *block)
+{
+    struct Chart *root = (block) ? atlas_root(block) : NULL;
+    if (!root || !coordinate_equals(chart_coordinate(root), chart_coordinate(chart))) {
+        atlas_destroy(block);
+        return false;
+    }
+
+    memcpy(chart->data.branch->children, root->data.branch->children, sizeof(ChartChildren));
+    memset(root->data.branch->children, 0, sizeof(ChartChildren));
+    chart->data.branch->stub = 0;
+    atlas_destroy(block);
+    pager_add(atlas->pager, chart, id);
+
+    /* locations wait in the directory until their tiles turn up, filed by block */
+    struct Coordinate c = chart_coordinate(chart);
+    pager_file_locations(atlas, coordinate_m(c));
+
+    struct Pager *pager = atlas->pager;
+    struct Filed key = { c, SIZE_MAX, NULL };
+    size_t lo = 0, hi = pager->nfiled;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo)/2;
+        if (filed_compare(&pager->filed[mid], &key) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+
+    for (size_t i = lo; (i < pager->nfiled) && coordinate_equals(pager->filed[i].block, c); i++) {
+        struct Location *location = pager->filed[i].location;
+        struct Tile *tile = chart_tile(chart_find(chart, location_coordinate(location)));
+        if (tile) tile_set_location(tile, location);
+    }
+
+    return true;
+}
+
+
+/* replace a stub's missing children with the subtree its block holds; false if unreadable */
+bool atlas_fault(const struct Atlas *atlas, struct Chart *chart)
+{
+    if (!chart_is_stub(chart)) {
+        if (chart && chart_has_children(chart) && chart->data.branch->page) {
+            atlas->pager->pages[chart->data.branch->page - 1].used = ++atlas->pager->clock;
+            atlas->pager->stats.hits++;
+        }
+        return true;
+    }
+    if (!atlas->loader.load) return false;
+
+    uint32_t id = chart->data.branch->stub - 1;
+    return atlas_graft(atlas, chart, id, atlas->loader.load(atlas->loader.data, id));
+}
+
+
+bool chart_load_all(const struct Atlas *atlas, struct Chart *chart)
+{
+    if (!chart || !chart_has_children(chart)) return true;
+    if (!atlas_fault(atlas, chart)) return false;
+
+    for (int i = 0; i < NUM_CHILDREN; i++) {
+        if (!chart_load_all(atlas, chart_child(chart, i))) return false;
+    }
+    return true;
+}
+
+
+/* read in every stub, as a walk over the whole tree needs; false if any block is unreadable */
+bool atlas_load_all(const struct Atlas *atlas)
+{
+    return !atlas || chart_load_all(atlas, atlas_root(atlas));
+}
+
+
+/* the child slot taken at each level on the way down to c, path[k] being the slot of c's
+ * ancestor at level k, worked out bottom up in one pass */
+void chart_path(struct Coordinate c, uint32_t top, uint8_t *path)
+{
+    for (uint32_t k = coordinate_m(c); k < top; k++) {
+        path[k] = (uint8_t)coordinate_index(c);
+        c = coordinate_lift_by(c, 1);
+    }
+}
+
+
+/* add (or remove) a chart's census to every chart above it, whose hashes are now stale */
+void atlas_census_add(struct Atlas *atlas, const struct Chart *chart, int sign)
+{
+    struct Coordinate c = chart_coordinate(chart);
+    struct Chart *curr = atlas_root(atlas);
+
+    ChartCensus census = { 0 };
+    for (int t = 0; t < CENSUS_SIZE; t++) census[t] = chart_census(chart, t);
+
+    uint8_t path[ATLAS_MAX_LEVEL];
+    chart_path(c, (curr) ? coordinate_m(chart_coordinate(curr)) : 0, path);
+
+    while (curr && chart_has_children(curr) && (coordinate_m(chart_coordinate(curr)) > coordinate_m(c))) {
+        for (int t = 0; t < CENSUS_SIZE; t++) curr->data.branch->census[t] += sign * census[t];
+        curr->data.branch->hashed = false;
+        curr = chart_child(curr, path[coordinate_m(chart_coordinate(curr)) - 1]);
+    }
+
+    atlas->revision++;
+}
 
 
 struct Coordinate atlas_coordinate(const struct Atlas *atlas)
@@ -197,9 +765,87 @@ enum TERRAIN atlas_terrain(const struct Atlas *atlas)
 }
 
 
+/* the charts above c have to be hashed again once it changes */
+void chart_stale(struct Chart *chart, struct Coordinate c)
+{
+    while (chart && chart_has_children(chart) && (coordinate_m(chart_coordinate(chart)) > coordinate_m(c))) {
+        chart->data.branch->hashed = false;
+        struct Coordinate next = coordinate_lift_to(c, coordinate_m(chart_coordinate(chart)) - 1);
+        chart = chart_child(chart, coordinate_index(next));
+    }
+}
+
+
+void atlas_dirty_add(struct Atlas *atlas, struct Coordinate c)
+{
+    if (atlas->ndirty == atlas->capdirty) {
+        atlas->capdirty = (atlas->capdirty) ? 2*atlas->capdirty : 64;
+        atlas->dirty = realloc(atlas->dirty, atlas->capdirty * sizeof(struct Coordinate));
+    }
+    atlas->dirty[atlas->ndirty++] = c;
+}
+
+
+/* the tile of a chart about to be changed, remembered until the next save */
+struct Tile *atlas_touch_chart(struct Atlas *atlas, struct Chart *chart)
+{
+    if (atlas->shared && chart) chart = atlas_own(atlas, chart_coordinate(chart));
+
+    struct Tile *tile = chart_tile(chart);
+    if (!tile) return NULL;
+    if (atlas->watcher.touch) atlas->watcher.touch(atlas->watcher.data, chart);
+
+    atlas->revision++;
+    chart_stale(atlas_root(atlas), chart_coordinate(chart));
+    if (tile_dirty(tile)) return tile;
+
+    /* a block that changes has to be stored before it can be dropped */
+    struct Page *page = pager_find(atlas, chart_coordinate(chart));
+    if (page) page->modified = true;
+
+    atlas_dirty_add(atlas, chart_coordinate(chart));
+    tile_set_dirty(tile, true);
+
+    return tile;
+}
+
+
+/* every edit goes through here to get a writable tile, NULL if there is none at c */
+struct Tile *atlas_touch(struct Atlas *atlas, struct Coordinate c)
+{
+    return atlas_touch_chart(atlas, atlas_find(atlas, c));
+}
+
+
+size_t atlas_dirty_count(const struct Atlas *atlas) { return atlas->ndirty; }
+struct Coordinate atlas_dirty(const struct Atlas *atlas, size_t i) { return atlas->dirty[i]; }
+
+
+void atlas_clear_dirty(struct Atlas *atlas)
+{
+    /* tiles paged out come back clean */
+    for (size_t i = 0; i < atlas->ndirty; i++) {
+        struct Tile *tile = chart_tile(chart_find(atlas_root(atlas), atlas->dirty[i]));
+        if (tile) tile_set_dirty(tile, false);
+    }
+    atlas->ndirty = 0;
+}
+
+
+void atlas_set_chart_terrain(struct Atlas *atlas, struct Chart *chart, enum TERRAIN t)
+{
+    if (!chart_tile(chart) || (tile_terrain(chart_tile(chart)) == t)) return;
+    if (atlas->shared) chart = atlas_own(atlas, chart_coordinate(chart));
+
+    atlas_census_add(atlas, chart, -1);
+    tile_set_terrain(atlas_touch_chart(atlas, chart), t);
+    atlas_census_add(atlas, chart, 1);
+}
+
+
 void atlas_set_terrain(struct Atlas *atlas, enum TERRAIN t)
 {
-    tile_set_terrain(atlas_tile(atlas), t);
+    atlas_set_chart_terrain(atlas, atlas_curr(atlas), t);
 }
 
 
@@ -230,58 +876,965 @@ struct Chart *atlas_find(const struct Atlas *atlas, struct Coordinate c)
     if (!atlas) return NULL;
     struct Coordinate r = chart_coordinate(atlas_root(atlas));
     if (!coordinate_related(r, c) || (coordinate_m(c) > coordinate_m(r))) return NULL;
-    if (coordinate_equals(r, c)) return atlas_root(atlas);
 
-    struct Coordinate p = coordinate_lift_by(c, 1);
-    struct Chart *parent = atlas_find(atlas, p);
-    if (!parent) return NULL;
-    return chart_child(parent, coordinate_index(c));
+    uint8_t path[ATLAS_MAX_LEVEL];
+    chart_path(c, coordinate_m(r), path);
+
+    struct Chart *chart = atlas_root(atlas);
+    for (uint32_t m = coordinate_m(r); chart && (m > coordinate_m(c)); m--) {
+        if (!atlas_fault(atlas, chart)) return NULL;
+        chart = chart_child(chart, path[m - 1]);
+    }
+    return chart;
 }
 
 
-void atlas_insert(struct Atlas *atlas, struct Chart *chart)
+/* true if nothing is at c yet and a chart could be put there, with no block that cannot
+ * be read in on the way down */
+bool atlas_vacant(const struct Atlas *atlas, struct Coordinate c)
 {
-    if (!atlas || !chart) return;
+    struct Coordinate r = chart_coordinate(atlas_root(atlas));
+    if (!coordinate_related(r, c) || (coordinate_m(c) > coordinate_m(r))) return true;
 
-    if (!atlas_root(atlas)) {
-        atlas->root = chart;
-        return;
+    uint8_t path[ATLAS_MAX_LEVEL];
+    chart_path(c, coordinate_m(r), path);
+
+    struct Chart *chart = atlas_root(atlas);
+    for (uint32_t m = coordinate_m(r); m > coordinate_m(c); m--) {
+        if (!atlas_fault(atlas, chart)) return false;
+        chart = chart_child(chart, path[m - 1]);
+        if (!chart) return true;
     }
+    return false;
+}
 
-    struct Chart *root = atlas_root(atlas);
-    struct Coordinate r = chart_coordinate(root);
-    struct Coordinate c = chart_coordinate(chart);
 
-    if (!coordinate_related(r, c)) {
-        atlas->root = chart_create_ancestor(root, chart);
-        atlas_insert(atlas, root);
-        atlas_insert(atlas, chart);
-        return;
-    }
+/* a copy in place of the shared chart in slot, leaving the snapshot the original; a tile
+ * copied this way takes its own copy of its location as well */
+void atlas_unshare(struct Atlas *atlas, struct Chart **slot)
+{
+    struct Chart *copy = chart_copy(*slot);
+    if (atlas->curr == *slot) atlas->curr = copy;
+    chart_destroy(*slot);
+    *slot = copy;
+    atlas->revision++;
+
+    struct Tile *tile = chart_tile(copy);
+    if (tile && tile_location(tile)) tile_set_location(tile, directory_own(&atlas->directory, tile_location(tile)));
+}
 
-    struct Coordinate p = coordinate_lift_by(c, 1);
-    struct Chart *parent = atlas_find(atlas, p);
+
+/* the chart at c, made this atlas's own to change by unsharing every chart on the way down */
+struct Chart *atlas_own(struct Atlas *atlas, struct Coordinate c)
+{
+    if (!atlas || !atlas->shared) return atlas_find(atlas, c);
+
+    struct Coordinate r = chart_coordinate(atlas_root(atlas));
+    if (!coordinate_related(r, c) || (coordinate_m(c) > coordinate_m(r))) return NULL;
+
+    uint8_t path[ATLAS_MAX_LEVEL];
+    chart_path(c, coordinate_m(r), path);
+
+    struct Chart **slot = &atlas->root;
+    for (uint32_t m = coordinate_m(r); *slot; m--) {
+        if (chart_shared(*slot)) atlas_unshare(atlas, slot);
+        if (m == coordinate_m(c)) break;
+        slot = &(*slot)->data.branch->children[path[m - 1]];
+    }
+    return *slot;
+}
+
+
+/* a location in the directory, made this atlas's own to change, for one no tile holds */
+struct Location *atlas_own_location(struct Atlas *atlas, struct Location *location)
+{
+    if (!atlas || !atlas->shared || !location) return location;
+    return directory_own(&atlas->directory, location);
+}
+
+
+/* the chart at c if it is already in memory, never reading a block */
+struct Chart *atlas_peek(const struct Atlas *atlas, struct Coordinate c)
+{
+    return (atlas) ? chart_find(atlas_root(atlas), c) : NULL;
+}
+
+
+/* false, leaving the atlas as it was and the chart the caller's, if something is already
+ * in its place or a block that cannot be read in is in the way */
+bool atlas_insert(struct Atlas *atlas, struct Chart *chart)
+{
+    if (!atlas || !chart) return false;
+
+    if (!atlas_root(atlas)) {
+        atlas->root = chart;
+        return true;
+    }
+
+    struct Chart *root = atlas_root(atlas);
+    struct Coordinate r = chart_coordinate(root);
+    struct Coordinate c = chart_coordinate(chart);
+
+    if (!coordinate_related(r, c)) {
+        atlas->root = chart_create_ancestor(root, chart);
+        atlas_insert(atlas, root);
+        return atlas_insert(atlas, chart);
+    }
+
+    struct Coordinate p = coordinate_lift_by(c, 1);
+    struct Chart *parent = atlas_own(atlas, p);
     if (!parent) {
         parent = chart_create(p);
-        atlas_insert(atlas, parent);
+        if (!atlas_insert(atlas, parent)) {
+            chart_destroy(parent);
+            return false;
+        }
     }
+    if ((chart_is_stub(parent) && !atlas_fault(atlas, parent)) || chart_child(parent, coordinate_index(c))) return false;
+
     chart_set_child(parent, coordinate_index(c), chart);
+    atlas_census_add(atlas, chart, 1);
+
+    struct Page *page = (atlas->pager->len) ? pager_find(atlas, c) : NULL;
+    if (page) pager_grow(atlas, page, chart_bytes(chart));
+    return true;
+}
+
+
+/* recompute the census of a chart and everything below it from its tiles */
+void chart_recount(struct Chart *chart)
+{
+    if (!chart || !chart_has_children(chart) || chart_is_stub(chart)) return;
+
+    memset(chart->data.branch->census, 0, sizeof(ChartCensus));
+    for (int i = 0; i < NUM_CHILDREN; i++) {
+        struct Chart *child = chart_child(chart, i);
+        if (!child) continue;
+
+        chart_recount(child);
+        for (int t = 0; t < CENSUS_SIZE; t++) chart->data.branch->census[t] += chart_census(child, t);
+    }
+}
+
+
+/* assembles an atlas from charts arriving in depth-first pre-order, as they are saved */
+struct Builder
+{
+    struct Atlas *atlas;
+    struct Chart *path[ATLAS_MAX_LEVEL];
+};
+
+
+struct Builder *builder_create(void)
+{
+    struct Builder *builder = malloc(sizeof(struct Builder));
+
+    builder->atlas = atlas_create();
+    for (int m = 0; m < ATLAS_MAX_LEVEL; m++) builder->path[m] = NULL;
+    return builder;
+}
+
+
+void builder_destroy(struct Builder *builder)
+{
+    if (!builder) return;
+
+    atlas_destroy(builder->atlas);
+    free(builder);
+}
+
+
+/* link a chart under the last chart seen one level up; false (chart not taken) if out of order */
+bool builder_add(struct Builder *builder, struct Chart *chart)
+{
+    if (!builder || !chart) return false;
+
+    struct Coordinate c = chart_coordinate(chart);
+    uint32_t m = coordinate_m(c);
+    if (m + 1 >= ATLAS_MAX_LEVEL) return false;
+
+    if (!atlas_root(builder->atlas)) {
+        builder->atlas->root = chart;
+    } else {
+        struct Chart *parent = builder->path[m + 1];
+        if (!parent || !coordinate_equals(coordinate_lift_by(c, 1), chart_coordinate(parent))) return false;
+        if (chart_child(parent, coordinate_index(c))) return false;
+        chart_set_child(parent, coordinate_index(c), chart);
+    }
+
+    builder->path[m] = chart;
+    for (uint32_t k = 0; k < m; k++) builder->path[k] = NULL;
+    return true;
+}
+
+
+/* hand over the finished atlas with its census filled in; the builder is freed */
+struct Atlas *builder_finish(struct Builder *builder)
+{
+    if (!builder) return NULL;
+
+    struct Atlas *atlas = builder->atlas;
+    chart_recount(atlas_root(atlas));
+    atlas->curr = atlas_root(atlas);
+    atlas->revision++;
+
+    free(builder);
+    return atlas;
+}
+
+
+bool chart_overlaps(const struct Chart *chart, struct Coordinate lo, struct Coordinate hi)
+{
+    struct Coordinate c = chart_coordinate(chart);
+    int64_t span = chart_span(chart), scale = 2*span + 1;
+    int64_t p = scale * coordinate_p(c), q = scale * coordinate_q(c);
+
+    return (p + span >= coordinate_p(lo)) && (p - span <= coordinate_p(hi))
+        && (q + span >= coordinate_q(lo)) && (q - span <= coordinate_q(hi));
+}
+
+
+bool chart_region(
+    const struct Atlas *atlas,
+    struct Chart *chart,
+    struct Coordinate lo,
+    struct Coordinate hi,
+    bool fault,
+    void (*visit)(struct Chart *, void *),
+    void *data
+)
+{
+    if (!chart || !chart_overlaps(chart, lo, hi)) return true;
+
+    if (chart_has_tile(chart)) {
+        if (chart_tile(chart)) visit(chart, data);
+        return true;
+    }
+    if (fault && !atlas_fault(atlas, chart)) return false;
+    if (!fault && chart_is_stub(chart)) return false;
+
+    bool ok = true;
+    for (int i = 0; i < NUM_CHILDREN; i++) {
+        ok = chart_region(atlas, chart_child(chart, i), lo, hi, fault, visit, data) && ok;
+    }
+    return ok;
+}
+
+
+/* visit every tile with lo.p <= p <= hi.p and lo.q <= q <= hi.q; false if some block
+ * among them could not be read in */
+bool atlas_region(
+    const struct Atlas *atlas,
+    struct Coordinate lo,
+    struct Coordinate hi,
+    void (*visit)(struct Chart *, void *),
+    void *data
+)
+{
+    if (!atlas || !visit) return false;
+    return chart_region(atlas, atlas_root(atlas), lo, hi, true, visit, data);
+}
+
+
+/* the same, skipping blocks not in memory and leaving the pager alone, so that several
+ * threads can walk at once while nothing edits, reads in or trims the atlas; false if
+ * it skipped any */
+bool atlas_peek_region(
+    const struct Atlas *atlas,
+    struct Coordinate lo,
+    struct Coordinate hi,
+    void (*visit)(struct Chart *, void *),
+    void *data
+)
+{
+    if (!atlas || !visit) return false;
+    return chart_region(atlas, atlas_root(atlas), lo, hi, false, visit, data);
+}
+
+
+/* every bit of h reaching every bit of the result, so that hashes combine in order */
+static inline uint64_t atlas_mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+
+/*
+ *  A branch's hash is made from its children's in order, 0 standing for a missing one,
+ *  so that subtrees with the same hash can be taken to be the same without looking
+ *  inside. Edits mark the hashes above them stale and they are worked out again only
+ *  when next asked for, down the paths that changed. A stub knows its hash if the index
+ *  gave it one; otherwise it has to be read in first, which is done only if fault.
+ */
+bool chart_hash(const struct Atlas *atlas, struct Chart *chart, bool fault, uint64_t *hash)
+{
+    *hash = 0;
+    if (!chart) return true;
+    if (chart_has_tile(chart)) {
+        if (chart_tile(chart)) *hash = tile_hash(chart_tile(chart));
+        return true;
+    }
+
+    struct Branch *branch = chart->data.branch;
+    if (!branch->hashed) {
+        if (branch->stub && (!fault || !atlas_fault(atlas, chart))) return false;
+
+        uint64_t h = ATLAS_HASH_SEED, child = 0;
+        for (int i = 0; i < NUM_CHILDREN; i++) {
+            if (!chart_hash(atlas, branch->children[i], fault, &child)) return false;
+            h = atlas_mix(h ^ child);
+        }
+        branch->hash = h;
+        branch->hashed = true;
+    }
+
+    *hash = branch->hash;
+    return true;
+}
+
+
+/* the hash of everything at or below a chart, 0 if part of it cannot be read */
+uint64_t atlas_chart_hash(const struct Atlas *atlas, struct Chart *chart)
+{
+    uint64_t hash = 0;
+    chart_hash(atlas, chart, true, &hash);
+    return hash;
+}
+
+
+struct Diff
+{
+    const struct Atlas *a, *b;
+    void (*visit)(struct Chart *, struct Chart *, void *);
+    void *data;
+    bool ok;
+};
+
+
+bool chart_paged(const struct Chart *chart)
+{
+    return chart && chart_has_children(chart) && chart->data.branch->page;
+}
+
+
+/*
+ *  Compare the charts at one coordinate in each atlas (either NULL where there is none),
+ *  skipping them whole if their hashes match. Blocks read in on the way are dropped again
+ *  from above the pages, as saving does, so both atlases stay within their budgets.
+ */
+void diff_charts(struct Diff *diff, struct Chart *ca, struct Chart *cb, bool inside)
+{
+    if ((ca == cb) || !diff->ok) return;
+
+    uint64_t ha = 0, hb = 0;
+    if (ca && cb && chart_hash(diff->a, ca, false, &ha) && chart_hash(diff->b, cb, false, &hb) && (ha == hb)) return;
+
+    if (chart_has_tile((ca) ? ca : cb)) {
+        ca = (chart_tile(ca)) ? ca : NULL;
+        cb = (chart_tile(cb)) ? cb : NULL;
+        if (ca || cb) diff->visit(ca, cb, diff->data);
+        return;
+    }
+
+    if (!atlas_fault(diff->a, ca) || !atlas_fault(diff->b, cb)) {
+        diff->ok = false;
+        return;
+    }
+
+    inside = inside || chart_paged(ca) || chart_paged(cb);
+    for (int i = 0; i < NUM_CHILDREN; i++) {
+        diff_charts(diff, chart_child(ca, i), chart_child(cb, i), inside);
+        if (inside) continue;
+        atlas_trim(diff->a);
+        atlas_trim(diff->b);
+    }
+}
+
+
+/*
+ *  Visit every tile that differs between two atlases with its chart in each, NULL on the
+ *  side that has no tile there; false if a block could not be read. Subtrees whose hashes
+ *  match are passed over, so the time taken follows how much has changed.
+ */
+bool atlas_diff(
+    const struct Atlas *a,
+    const struct Atlas *b,
+    void (*visit)(struct Chart *, struct Chart *, void *),
+    void *data
+)
+{
+    if (!a || !b || !visit) return false;
+
+    struct Diff diff = { a, b, visit, data, true };
+    struct Chart *ra = atlas_root(a), *rb = atlas_root(b);
+    if (!ra || !rb) return false;
+
+    /* the higher root is followed down to the lower one, its other children all differ */
+    bool high = coordinate_m(chart_coordinate(ra)) >= coordinate_m(chart_coordinate(rb));
+    struct Chart *upper = (high) ? ra : rb, *lower = (high) ? rb : ra;
+    const struct Atlas *atlas = (high) ? a : b;
+    struct Coordinate l = chart_coordinate(lower);
+    uint32_t m = coordinate_m(l);
+
+    if (!coordinate_equals(coordinate_lift_to(l, coordinate_m(chart_coordinate(upper))), chart_coordinate(upper))) {
+        diff_charts(&diff, ra, NULL, false);
+        diff_charts(&diff, NULL, rb, false);
+        return diff.ok;
+    }
+
+    bool inside = false;
+    while (upper && (coordinate_m(chart_coordinate(upper)) > m) && diff.ok) {
+        if (!atlas_fault(atlas, upper)) return false;
+        inside = inside || chart_paged(upper);
+
+        enum CHILDREN next = coordinate_index(coordinate_lift_to(l, coordinate_m(chart_coordinate(upper)) - 1));
+        for (int i = 0; i < NUM_CHILDREN; i++) {
+            if (i == (int)next) continue;
+            diff_charts(&diff, (high) ? chart_child(upper, i) : NULL, (high) ? NULL : chart_child(upper, i), inside);
+        }
+        upper = chart_child(upper, next);
+    }
+
+    diff_charts(&diff, (high) ? upper : lower, (high) ? lower : upper, inside);
+    return diff.ok;
+}
+
+
+/*
+ *  Another atlas's tiles and locations brought into this one, shifted by a level 0
+ *  offset. Where this atlas has nothing, the other's subtrees are moved across whole;
+ *  where both have a tile, the policy picks one, though a tile of unknown terrain always
+ *  gives way to a known one. A chart moves onto a chart here only at levels whose size
+ *  divides the offset, so charts above that are walked down instead.
+ */
+struct Import
+{
+    struct Atlas *atlas;
+    int32_t dp, dq;
+    uint32_t aligned;           /* highest level whose charts the offset maps onto charts */
+    enum MERGE policy;
+    struct Location **locations;
+    size_t len, cap;
+    bool lost;                  /* some of it fell under a block that could not be read in */
+};
+
+
+struct Coordinate import_shift(const struct Import *import, struct Coordinate c)
+{
+    int64_t scale = 1;
+    for (uint32_t m = 0; m < coordinate_m(c); m++) scale *= 3;
+
+    int32_t p = coordinate_p(c) + (int32_t)(import->dp / scale);
+    int32_t q = coordinate_q(c) + (int32_t)(import->dq / scale);
+    return coordinate(p, q, -(p + q), coordinate_m(c));
+}
+
+
+bool import_known(const struct Tile *tile)
+{
+    return tile && (tile_terrain(tile) != TERRAIN_NONE) && (tile_terrain(tile) != TERRAIN_UNKNOWN);
+}
+
+
+/* the other atlas's locations go with it, so each one taken is copied for this atlas */
+void import_location(struct Import *import, struct Coordinate c, const struct Location *location)
+{
+    if (!location) return;
+
+    if (import->len == import->cap) {
+        import->cap = (import->cap) ? 2*import->cap : 64;
+        import->locations = realloc(import->locations, import->cap * sizeof(struct Location *));
+    }
+    import->locations[import->len++] = location_create(c, location_type(location));
 }
 
 
-void atlas_create_neighbours(struct Atlas *atlas)
+/*
+ *  Give a chart and everything below it their new coordinates, marking every tile as
+ *  changed. A shift can change which slot of its parent a chart sits in, and with it
+ *  the parent's hash.
+ */
+void import_move(struct Import *import, struct Chart *chart, struct Coordinate c)
 {
-    struct Coordinate n = coordinate_origin();
-    struct Chart *neighbour = NULL;
+    chart->coordinate = c;
+
+    if (chart_has_tile(chart)) {
+        struct Tile *tile = chart_tile(chart);
+        if (!tile) return;
+
+        import_location(import, c, tile_location(tile));
+        tile_set_location(tile, NULL);
+        tile_set_dirty(tile, true);
+        atlas_dirty_add(import->atlas, c);
+        return;
+    }
+
+    struct Branch *branch = chart->data.branch;
+    ChartChildren children;
+    memcpy(children, branch->children, sizeof(ChartChildren));
+    memset(branch->children, 0, sizeof(ChartChildren));
+    branch->page = 0;
+    if (import->dp || import->dq) branch->hashed = false;
+
+    for (int i = 0; i < NUM_CHILDREN; i++) {
+        if (!children[i]) continue;
+
+        struct Coordinate d = import_shift(import, chart_coordinate(children[i]));
+        import_move(import, children[i], d);
+        branch->children[coordinate_index(d)] = children[i];
+    }
+}
+
+
+/* the other atlas's tile wins if the policy says so, or if this one's terrain is unknown */
+void import_tile(struct Import *import, struct Chart *here, struct Chart *chart)
+{
+    struct Atlas *atlas = import->atlas;
+    if (atlas->shared) here = atlas_own(atlas, chart_coordinate(here));
+
+    struct Tile *theirs = chart_tile(chart), *ours = chart_tile(here);
+    if (!theirs) return;
+
+    if (!ours) {
+        chart_set_tile(here, theirs);
+        chart->data.tile = NULL;
+        import_location(import, chart_coordinate(here), tile_location(theirs));
+        tile_set_location(theirs, NULL);
+        atlas_census_add(atlas, here, 1);
+        atlas_touch_chart(atlas, here);
+        return;
+    }
+
+    bool take = import_known(theirs) && (!import_known(ours) || (import->policy == MERGE_THEIRS));
+    if (!take) return;
+
+    /* tiles that are already the same are left alone, so they need not be saved again */
+    if (tile_hash(ours) != tile_hash(theirs)) {
+        atlas_set_chart_terrain(atlas, here, tile_terrain(theirs));
+        struct Tile *tile = atlas_touch_chart(atlas, here);
+        tile_set_seed(tile, tile_seed(theirs));
+        tile_set_roads(tile, tile_roads(theirs));
+        tile_set_rivers(tile, tile_rivers(theirs));
+    }
+
+    struct Location *location = tile_location(theirs), *mine = tile_location(ours);
+    enum LOCATION t = (location) ? location_type(location) : LOCATION_NONE;
+    if (mine && (location_type(mine) != t)) {
+        atlas_touch_chart(atlas, here);
+        location_set_type(mine, t);
+    } else if (!mine && location) {
+        atlas_touch_chart(atlas, here);
+        import_location(import, chart_coordinate(here), location);
+    }
+}
+
+
+/* true if the chart was moved across whole, so that it now belongs to this atlas */
+bool import_chart(struct Import *import, struct Chart *chart)
+{
+    if (!chart) return false;
+
+    struct Atlas *atlas = import->atlas;
+    uint32_t m = coordinate_m(chart_coordinate(chart));
+
+    if (m <= import->aligned) {
+        struct Coordinate c = import_shift(import, chart_coordinate(chart));
+        struct Coordinate r = chart_coordinate(atlas_root(atlas));
+        struct Chart *here = atlas_find(atlas, c);
+        bool below = (coordinate_m(r) < m) && coordinate_equals(coordinate_lift_to(r, m), c);
+
+        if (!here && !below) {
+            if (!atlas_vacant(atlas, c)) {
+                import->lost = true;
+                return false;
+            }
+            import_move(import, chart, c);
+            atlas_insert(atlas, chart);
+
+            struct Page *page = pager_find(atlas, c);
+            if (page) page->modified = true;
+            return true;
+        }
+
+        if (m == 0) {
+            import_tile(import, here, chart);
+            return false;
+        }
+
+        /* below the aligned level every chart keeps its slot, so equal hashes mean equal
+         * subtrees, and this atlas's win whole */
+        uint64_t ours = 0, theirs = 0;
+        if ((m < import->aligned) && (import->policy == MERGE_OURS) && chart_hash(atlas, here, false, &ours)
+            && chart_hash(atlas, chart, false, &theirs) && (ours == theirs)) return false;
+    }
+
+    for (int i = 0; i < NUM_CHILDREN; i++) {
+        if (import_chart(import, chart->data.branch->children[i])) chart->data.branch->children[i] = NULL;
+    }
+    return false;
+}
+
+
+/* merge other into the atlas, shifted by (dp, dq) tiles; other is destroyed either way,
+ * and false if it could not be read or some of it was kept out by a block that could not */
+bool atlas_import(struct Atlas *atlas, struct Atlas *other, int32_t dp, int32_t dq, enum MERGE policy)
+{
+    if (!atlas || !other || !atlas_load_all(other)) {
+        atlas_destroy(other);
+        return false;
+    }
+    atlas_initialise(atlas);
+
+    struct Import import = { atlas, dp, dq, 0, policy, NULL, 0, 0, false };
+    for (int64_t scale = 3; (import.aligned + 1 < ATLAS_MAX_LEVEL) && !(dp % scale) && !(dq % scale); scale *= 3) {
+        import.aligned++;
+    }
+    if (!dp && !dq) import.aligned = ATLAS_MAX_LEVEL;
+
+    if (import_chart(&import, atlas_root(other))) other->root = NULL;
+    atlas_add_locations(atlas, import.locations, import.len);
+
+    free(import.locations);
+    atlas_destroy(other);
+    return !import.lost;
+}
+
+
+/*
+ *  Blocks read ahead on a thread of their own, nearest the cursor first. The thread only
+ *  calls the loader, working from its own list of coordinates and block numbers; the
+ *  results are grafted in by atlas_merge on the main thread, so the tree is never shared.
+ */
+struct Prefetch
+{
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    struct Loader loader;
+    struct Coordinate *coordinates;
+    uint32_t *blocks;
+    struct Atlas **ready;
+    size_t len, fetched, merged;
+    bool quit, done;
+};
+
+
+void *prefetch_worker(void *arg)
+{
+    struct Prefetch *prefetch = arg;
+
+    for (size_t i = 0; i < prefetch->len; i++) {
+        pthread_mutex_lock(&prefetch->mutex);
+        bool quit = prefetch->quit;
+        pthread_mutex_unlock(&prefetch->mutex);
+        if (quit) break;
+
+        struct Atlas *block = prefetch->loader.load(prefetch->loader.data, prefetch->blocks[i]);
+
+        pthread_mutex_lock(&prefetch->mutex);
+        prefetch->ready[i] = block;
+        prefetch->fetched = i + 1;
+        pthread_mutex_unlock(&prefetch->mutex);
+    }
+
+    pthread_mutex_lock(&prefetch->mutex);
+    prefetch->done = true;
+    pthread_mutex_unlock(&prefetch->mutex);
+    return NULL;
+}
+
+
+/* hex distance from a level 0 coordinate to the centre of a chart */
+int64_t chart_distance(const struct Chart *chart, struct Coordinate o)
+{
+    struct Coordinate c = chart_coordinate(chart);
+    int64_t scale = 2*chart_span(chart) + 1;
+    int64_t dp = scale * coordinate_p(c) - coordinate_p(o), dq = scale * coordinate_q(c) - coordinate_q(o);
+    int64_t dr = dp + dq;
+
+    dp = (dp < 0) ? -dp : dp;
+    dq = (dq < 0) ? -dq : dq;
+    dr = (dr < 0) ? -dr : dr;
+    return (dp > dq) ? ((dp > dr) ? dp : dr) : ((dq > dr) ? dq : dr);
+}
+
+
+void prefetch_collect(struct Chart *chart, struct Chart ***stubs, size_t *len, size_t *cap)
+{
+    if (!chart || !chart_has_children(chart)) return;
+
+    if (chart_is_stub(chart)) {
+        if (*len == *cap) {
+            *cap = (*cap) ? 2*(*cap) : 64;
+            *stubs = realloc(*stubs, (*cap) * sizeof(struct Chart *));
+        }
+        (*stubs)[(*len)++] = chart;
+        return;
+    }
+
+    for (int i = 0; i < NUM_CHILDREN; i++) prefetch_collect(chart_child(chart, i), stubs, len, cap);
+}
+
+
+struct Coordinate prefetch_origin;
+
+int prefetch_compare(const void *a, const void *b)
+{
+    int64_t da = chart_distance(*(struct Chart *const *)a, prefetch_origin);
+    int64_t db = chart_distance(*(struct Chart *const *)b, prefetch_origin);
+    return (da > db) - (da < db);
+}
+
+
+/*
+ *  Start reading every stub's block in the background; false if there is nothing to read.
+ *  Only blocks still in the file they were opened from are read ahead: once a page has
+ *  been written out the loader's page list is no longer safe to read from another thread.
+ */
+bool atlas_prefetch(struct Atlas *atlas)
+{
+    if (!atlas || !atlas->loader.load || atlas->prefetch) return false;
+    if (atlas->pager && atlas->pager->stats.writes) return false;
+
+    struct Chart **stubs = NULL;
+    size_t len = 0, cap = 0;
+    prefetch_collect(atlas_root(atlas), &stubs, &len, &cap);
+    if (len == 0) return false;
+
+    prefetch_origin = atlas_coordinate(atlas);
+    qsort(stubs, len, sizeof(struct Chart *), prefetch_compare);
+
+    struct Prefetch *prefetch = calloc(1, sizeof(struct Prefetch));
+    prefetch->loader = atlas->loader;
+    prefetch->len = len;
+    prefetch->coordinates = malloc(len * sizeof(struct Coordinate));
+    prefetch->blocks = malloc(len * sizeof(uint32_t));
+    prefetch->ready = calloc(len, sizeof(struct Atlas *));
+    for (size_t i = 0; i < len; i++) {
+        prefetch->coordinates[i] = chart_coordinate(stubs[i]);
+        prefetch->blocks[i] = stubs[i]->data.branch->stub - 1;
+    }
+    free(stubs);
+
+    pthread_mutex_init(&prefetch->mutex, NULL);
+    if (pthread_create(&prefetch->thread, NULL, prefetch_worker, prefetch)) {
+        pthread_mutex_destroy(&prefetch->mutex);
+        free(prefetch->coordinates);
+        free(prefetch->blocks);
+        free(prefetch->ready);
+        free(prefetch);
+        return false;
+    }
+
+    atlas->prefetch = prefetch;
+    return true;
+}
 
-    for (int i = 0; i < NUM_DIRECTIONS; i++) {
-        n = coordinate_shift(chart_coordinate(atlas_curr(atlas)), i); 
-        neighbour = atlas_find(atlas, n);
-        if (!neighbour) {
-            neighbour = chart_create(n);
-            atlas_insert(atlas, neighbour);
+
+bool atlas_prefetching(const struct Atlas *atlas)
+{
+    return atlas && atlas->prefetch;
+}
+
+
+/* stop reading ahead, dropping whatever has not been merged */
+void atlas_stop_prefetch(struct Atlas *atlas)
+{
+    struct Prefetch *prefetch = atlas->prefetch;
+    if (!prefetch) return;
+
+    pthread_mutex_lock(&prefetch->mutex);
+    prefetch->quit = true;
+    pthread_mutex_unlock(&prefetch->mutex);
+    pthread_join(prefetch->thread, NULL);
+
+    for (size_t i = prefetch->merged; i < prefetch->fetched; i++) atlas_destroy(prefetch->ready[i]);
+    pthread_mutex_destroy(&prefetch->mutex);
+    free(prefetch->coordinates);
+    free(prefetch->blocks);
+    free(prefetch->ready);
+    free(prefetch);
+    atlas->prefetch = NULL;
+}
+
+
+/*
+ *  Graft in whatever the prefetch thread has read so far, skipping blocks that were
+ *  faulted in meanwhile. Reading ahead stops once the blocks fill the memory budget.
+ *  Returns true if anything arrived.
+ */
+bool atlas_merge(struct Atlas *atlas)
+{
+    struct Prefetch *prefetch = (atlas) ? atlas->prefetch : NULL;
+    if (!prefetch) return false;
+
+    pthread_mutex_lock(&prefetch->mutex);
+    size_t fetched = prefetch->fetched;
+    bool done = prefetch->done;
+    pthread_mutex_unlock(&prefetch->mutex);
+
+    bool merged = false;
+    bool full = false;
+    for (size_t i = prefetch->merged; i < fetched; i++) {
+        struct Chart *chart = atlas_peek(atlas, prefetch->coordinates[i]);
+        struct Atlas *block = prefetch->ready[i];
+        prefetch->ready[i] = NULL;
+
+        if (full || !chart_is_stub(chart) || (chart->data.branch->stub - 1 != prefetch->blocks[i])) {
+            atlas_destroy(block);
+            continue;
         }
+        merged = atlas_graft(atlas, chart, prefetch->blocks[i], block) || merged;
+        full = atlas->pager->budget && (atlas->pager->bytes >= atlas->pager->budget);
     }
+    prefetch->merged = fetched;
+
+    if (done || full) atlas_stop_prefetch(atlas);
+    return merged;
+}
+
+
+/* raise the root until c falls below it */
+void atlas_cover(struct Atlas *atlas, struct Coordinate c)
+{
+    struct Chart *root = atlas_root(atlas);
+    if (coordinate_related(chart_coordinate(root), c)) return;
+
+    atlas->root = chart_create(coordinate_common_ancestor(chart_coordinate(root), c));
+    atlas_insert(atlas, root);
+}
+
+
+/*
+ *  A brush stroke: every tile within the radius painted, and the tiles missing there or
+ *  in the ring around it made as unknown ones, so there is always somewhere to paint
+ *  next. The tiles are sorted into tree order and the tree walked once, down only the
+ *  charts that hold them, so each chart's census is put right and its hash marked stale
+ *  once for the whole stroke.
+ */
+struct Stroke
+{
+    struct Coordinate c;
+    bool paint;                     /* inside the radius rather than in the ring */
+    uint8_t path[ATLAS_MAX_LEVEL];  /* the child to take at each level from the root down */
+};
+
+
+struct Paint
+{
+    struct Atlas *atlas;
+    enum TERRAIN terrain;
+    struct Stroke *strokes;
+    uint32_t depth;
+};
+
+
+uint32_t stroke_depth;
+
+int stroke_compare(const void *a, const void *b)
+{
+    return memcmp(((const struct Stroke *)a)->path, ((const struct Stroke *)b)->path, stroke_depth);
+}
+
+
+void paint_tile(struct Paint *paint, struct Chart *chart, const struct Stroke *stroke, bool created, uint32_t page, int32_t *census)
+{
+    struct Atlas *atlas = paint->atlas;
+    struct Tile *tile = chart_tile(chart);
+    if (!tile) return;
+
+    if (created) census[tile_terrain(tile)]++;
+    bool painted = stroke->paint && (tile_terrain(tile) != paint->terrain);
+    if (!created && !painted) return;
+
+    if (painted) {
+        if (atlas->watcher.touch) atlas->watcher.touch(atlas->watcher.data, chart);
+        census[tile_terrain(tile)]--;
+        census[paint->terrain]++;
+        tile_set_terrain(tile, paint->terrain);
+    }
+
+    if (tile_dirty(tile)) return;
+    if (page) atlas->pager->pages[page - 1].modified = true;
+    atlas_dirty_add(atlas, stroke->c);
+    tile_set_dirty(tile, true);
+}
+
+
+/* the strokes [lo, hi), all below the chart in slot at level m, which is made first if it
+ * is missing; census gathers the changes to the terrain below */
+void paint_chart(struct Paint *paint, struct Chart **slot, uint32_t m, size_t lo, size_t hi, uint32_t page, int32_t *census)
+{
+    struct Atlas *atlas = paint->atlas;
+    bool created = !*slot;
+
+    if (created) {
+        *slot = chart_create(coordinate_lift_to(paint->strokes[lo].c, m));
+        if (page) pager_grow(atlas, &atlas->pager->pages[page - 1], atlas_chart_bytes(m, true));
+    } else if (chart_shared(*slot)) atlas_unshare(atlas, slot);
+    struct Chart *chart = *slot;
+
+    if (m == 0) {
+        paint_tile(paint, chart, &paint->strokes[lo], created, page, census);
+        return;
+    }
+    if (!atlas_fault(atlas, chart)) return;
+    if (chart->data.branch->page) page = chart->data.branch->page;
+
+    int32_t below[CENSUS_SIZE] = { 0 };
+    uint32_t k = paint->depth - m;
+    for (size_t i = lo, j = lo; i < hi; i = j) {
+        uint8_t child = paint->strokes[i].path[k];
+        while ((j < hi) && (paint->strokes[j].path[k] == child)) j++;
+        paint_chart(paint, &chart->data.branch->children[child], m - 1, i, j, page, below);
+    }
+
+    for (int t = 0; t < CENSUS_SIZE; t++) {
+        if (!below[t]) continue;
+        chart->data.branch->census[t] += below[t];
+        chart->data.branch->hashed = false;
+        census[t] += below[t];
+    }
+}
+
+
+void atlas_paint(struct Atlas *atlas, struct Coordinate c, uint32_t radius, enum TERRAIN t)
+{
+    if (!atlas || !atlas_root(atlas) || (coordinate_m(c) != 0)) return;
+
+    /* the ring one further out than the radius is only filled in */
+    size_t len = coordinate_disk(c, radius + 1, NULL);
+    struct Coordinate *disk = malloc(len * sizeof(struct Coordinate));
+    struct Stroke *strokes = malloc(len * sizeof(struct Stroke));
+    coordinate_disk(c, radius + 1, disk);
+    for (size_t i = 0; i < len; i++) atlas_cover(atlas, disk[i]);
+
+    uint32_t depth = coordinate_m(chart_coordinate(atlas_root(atlas)));
+    for (size_t i = 0; i < len; i++) {
+        strokes[i].c = disk[i];
+        strokes[i].paint = coordinate_distance(disk[i], c) <= radius;
+
+        struct Coordinate d = disk[i];
+        for (uint32_t k = depth; k > 0; k--) {
+            strokes[i].path[k - 1] = (uint8_t)coordinate_index(d);
+            d = coordinate_lift_by(d, 1);
+        }
+    }
+
+    stroke_depth = depth;
+    qsort(strokes, len, sizeof(struct Stroke), stroke_compare);
+
+    struct Paint paint = { atlas, t, strokes, depth };
+    int32_t census[CENSUS_SIZE] = { 0 };
+    paint_chart(&paint, &atlas->root, depth, 0, len, 0, census);
+    atlas->revision++;
+
+    free(strokes);
+    free(disk);
 }
 
 
@@ -289,18 +1842,100 @@ void atlas_create_location(struct Atlas *atlas, enum LOCATION t)
 {
     struct Location *new = location_create(atlas_coordinate(atlas), t);
     directory_insert(&(atlas->directory), new);
-    tile_set_location(atlas_tile(atlas), new);
+    tile_set_location(atlas_touch_chart(atlas, atlas_curr(atlas)), new);
 }
 
 
+/* a location under a stub is attached when its block is read in */
 void atlas_add_location(struct Atlas *atlas, struct Location *location)
 {
     directory_insert(&(atlas->directory), location);
-    struct Coordinate c = atlas_coordinate(atlas);
 
-    atlas_goto(atlas, location_coordinate(location));
-    if (coordinate_equals(location_coordinate(location), atlas_coordinate(atlas))) {
-        tile_set_location(atlas_tile(atlas), location);
+    struct Tile *tile = chart_tile(chart_find(atlas_root(atlas), location_coordinate(location)));
+    if (tile) tile_set_location(tile, location);
+}
+
+
+/* a location with the child to take at each level from the root down to its tile */
+struct Placement
+{
+    struct Location *location;
+    size_t order;
+    uint8_t *path;
+};
+
+
+uint32_t placement_depth;
+
+int placement_compare(const void *a, const void *b)
+{
+    const struct Placement *pa = a, *pb = b;
+    int cmp = memcmp(pa->path, pb->path, placement_depth);
+    if (cmp) return cmp;
+    return (pa->order > pb->order) - (pa->order < pb->order);
+}
+
+
+/*
+ *  Attach many locations at once: each one's path is worked out bottom up, the paths are
+ *  sorted into tree order and the tree is walked once, keeping the charts along the last
+ *  path so that each location descends only from where it parts from the one before.
+ *  Locations at the same tile are attached in order, so the last one given wins.
+ */
+void atlas_add_locations(struct Atlas *atlas, struct Location **locations, size_t len)
+{
+    if (!atlas || !len) return;
+    for (size_t i = 0; i < len; i++) directory_insert(&(atlas->directory), locations[i]);
+
+    struct Chart *root = atlas_root(atlas);
+    uint32_t depth = coordinate_m(chart_coordinate(root));
+
+    struct Placement *placements = malloc(len * sizeof(struct Placement));
+    uint8_t *paths = malloc(len * (depth ? depth : 1));
+    size_t n = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        struct Coordinate c = location_coordinate(locations[i]);
+        if (coordinate_m(c) != 0) continue;
+
+        uint8_t *path = paths + n * depth;
+        for (uint32_t k = depth; k > 0; k--) {
+            path[k - 1] = (uint8_t)coordinate_index(c);
+            c = coordinate_lift_by(c, 1);
+        }
+        if (!coordinate_equals(c, chart_coordinate(root))) continue;
+
+        placements[n].location = locations[i];
+        placements[n].order = i;
+        placements[n].path = path;
+        n++;
+    }
+
+    placement_depth = depth;
+    qsort(placements, n, sizeof(struct Placement), placement_compare);
+
+    struct Chart **stack = malloc((depth + 1) * sizeof(struct Chart *));
+    uint32_t top = 0;
+    stack[0] = root;
+
+    for (size_t i = 0; i < n; i++) {
+        uint32_t d = 0;
+        if (i > 0) {
+            while ((d < top) && (placements[i].path[d] == placements[i - 1].path[d])) d++;
+        }
+
+        struct Chart *chart = stack[d];
+        while ((d < depth) && chart && !chart_is_stub(chart)) {
+            chart = chart_child(chart, placements[i].path[d]);
+            stack[++d] = chart;
+        }
+        top = d;
+
+        struct Tile *tile = (d == depth) ? chart_tile(chart) : NULL;
+        if (tile) tile_set_location(tile, placements[i].location);
     }
-    atlas_goto(atlas, c);
+
+    free(stack);
+    free(paths);
+    free(placements);
 }
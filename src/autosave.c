@@ -0,0 +1,124 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hdr/atlas.h"
+#include "hdr/autosave.h"
+#include "hdr/file.h"
+
+/*
+ *  Periodic crash copies written by a forked child, whose copy-on-write view of the
+ *  atlas holds still while the editor carries on. The child only serialises and renames,
+ *  and since the thread pool does not survive the fork, its parallel_for runs in place.
+ */
+
+#define AUTOSAVE_ENV_INTERVAL "HEX_AUTOSAVE"
+#define AUTOSAVE_INTERVAL 60
+#define AUTOSAVE_EXT ".autosave.hexb"
+#define AUTOSAVE_EXT_TILED ".autosave.hext"  /* written a block at a time, within the budget */
+#define AUTOSAVE_UNNAMED "unnamed"
+
+
+struct Autosave
+{
+    pid_t child;
+    char *path;
+    time_t last;
+    unsigned int interval;
+    const struct Atlas *atlas;
+    unsigned long revision;
+};
+
+
+struct Autosave autosave = {
+    .child = 0,
+    .path = NULL,
+    .last = 0,
+    .interval = AUTOSAVE_INTERVAL,
+    .atlas = NULL,
+    .revision = 0,
+};
+
+
+const char *autosave_filename(void) { return autosave.path; }
+
+
+void autosave_initialise(void)
+{
+    /* HEX_AUTOSAVE sets the interval in seconds, 0 turns autosaving off */
+    const char *env = getenv(AUTOSAVE_ENV_INTERVAL);
+    autosave.interval = (env) ? (unsigned int)strtoul(env, NULL, 10) : AUTOSAVE_INTERVAL;
+    autosave.last = time(NULL);
+}
+
+
+void autosave_set_path(const char *filename, bool tiled)
+{
+    const char *base = (filename) ? filename : AUTOSAVE_UNNAMED;
+    const char *ext = (tiled) ? AUTOSAVE_EXT_TILED : AUTOSAVE_EXT;
+
+    free(autosave.path);
+    autosave.path = malloc(strlen(base) + strlen(ext) + 1);
+    strcpy(autosave.path, base);
+    strcat(autosave.path, ext);
+}
+
+
+/* collect a finished child, false if it failed to write its copy */
+bool autosave_reap(bool block)
+{
+    if (autosave.child <= 0) return true;
+
+    int status = 0;
+    pid_t pid = waitpid(autosave.child, &status, (block) ? 0 : WNOHANG);
+    if (pid == 0) return true;
+
+    autosave.child = 0;
+    return (pid > 0) && WIFEXITED(status) && (WEXITSTATUS(status) == 0);
+}
+
+
+/* start an autosave if the interval has passed with unsaved edits, false if one failed */
+bool autosave_update(const struct Atlas *atlas, const char *filename)
+{
+    bool ok = autosave_reap(false);
+
+    time_t now = time(NULL);
+    if (!atlas || (autosave.interval == 0) || (autosave.child > 0)) return ok;
+    if (now - autosave.last < (time_t)autosave.interval) return ok;
+
+    /* nothing to protect until there are edits newer than the file and the last copy */
+    autosave.last = now;
+    if (atlas_dirty_count(atlas) == 0) return ok;
+    if ((atlas == autosave.atlas) && (atlas_revision(atlas) == autosave.revision)) return ok;
+
+    /* a paged atlas would have to be read in whole for any other format */
+    autosave_set_path(filename, atlas_paged(atlas));
+
+    pid_t pid = fork();
+    if (pid == 0) _exit(file_save_atomic(autosave.path, atlas) ? 0 : 1);
+    if (pid < 0) return false;
+
+    autosave.child = pid;
+    autosave.atlas = atlas;
+    autosave.revision = atlas_revision(atlas);
+    return ok;
+}
+
+
+/* finish any autosave in flight, and drop the copy once every edit has been saved */
+void autosave_deinitialise(const struct Atlas *atlas)
+{
+    autosave_reap(true);
+
+    if (autosave.path && atlas && (atlas_dirty_count(atlas) == 0)) unlink(autosave.path);
+
+    free(autosave.path);
+    autosave.path = NULL;
+    autosave.atlas = NULL;
+    autosave.revision = 0;
+}
@@ -0,0 +1,146 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#include "hdr/checksum.h"
+
+/*
+ *  CRC32C (Castagnoli), as the SSE4.2 crc32 instruction computes it, with a table driven
+ *  fallback for processors without one. Checksums run on like zlib's crc32: start from
+ *  0 and pass each result back in with the next piece of data.
+ */
+
+#define CHECKSUM_POLY 0x82F63B78    /* reflected */
+#define CHECKSUM_SLICES 8
+#define CHECKSUM_STREAM 4096        /* shortest run worth splitting three ways */
+
+
+uint32_t checksum_table[CHECKSUM_SLICES][256];
+uint32_t (*checksum_run)(uint32_t crc, const unsigned char *data, size_t len) = NULL;
+pthread_once_t checksum_once = PTHREAD_ONCE_INIT;
+
+
+/* eight bytes a step, each through its own table */
+uint32_t checksum_software(uint32_t crc, const unsigned char *data, size_t len)
+{
+    while (len >= CHECKSUM_SLICES) {
+        uint32_t lo, hi;
+        memcpy(&lo, data, 4);
+        memcpy(&hi, data + 4, 4);
+        lo ^= crc;
+
+        crc = checksum_table[7][lo & 0xFF] ^ checksum_table[6][(lo >> 8) & 0xFF]
+            ^ checksum_table[5][(lo >> 16) & 0xFF] ^ checksum_table[4][lo >> 24]
+            ^ checksum_table[3][hi & 0xFF] ^ checksum_table[2][(hi >> 8) & 0xFF]
+            ^ checksum_table[1][(hi >> 16) & 0xFF] ^ checksum_table[0][hi >> 24];
+        data += CHECKSUM_SLICES;
+        len -= CHECKSUM_SLICES;
+    }
+
+    while (len--) crc = (crc >> 8) ^ checksum_table[0][(crc ^ *data++) & 0xFF];
+    return crc;
+}
+
+
+#if defined(__x86_64__)
+/* the instruction takes three cycles but can start one a cycle, so long runs are summed
+ * as three interleaved streams and joined up after */
+__attribute__((target("sse4.2")))
+uint32_t checksum_hardware(uint32_t crc, const unsigned char *data, size_t len)
+{
+    uint64_t c = crc;
+
+    if (len >= 3*CHECKSUM_STREAM) {
+        size_t third = (len / 3) & ~(size_t)7;
+        uint64_t c1 = 0xFFFFFFFF, c2 = 0xFFFFFFFF;
+
+        for (size_t i = 0; i < third; i += 8) {
+            uint64_t v0, v1, v2;
+            memcpy(&v0, data + i, 8);
+            memcpy(&v1, data + third + i, 8);
+            memcpy(&v2, data + 2*third + i, 8);
+            c = _mm_crc32_u64(c, v0);
+            c1 = _mm_crc32_u64(c1, v1);
+            c2 = _mm_crc32_u64(c2, v2);
+        }
+
+        uint32_t joined = checksum_combine(~(uint32_t)c, ~(uint32_t)c1, third);
+        c = ~checksum_combine(joined, ~(uint32_t)c2, third);
+        data += 3*third;
+        len -= 3*third;
+    }
+
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, data, 8);
+        c = _mm_crc32_u64(c, v);
+        data += 8;
+        len -= 8;
+    }
+
+    while (len--) c = _mm_crc32_u8((uint32_t)c, *data++);
+    return (uint32_t)c;
+}
+#endif
+
+
+void checksum_initialise(void)
+{
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int k = 0; k < 8; k++) crc = (crc >> 1) ^ ((crc & 1) ? CHECKSUM_POLY : 0);
+        checksum_table[0][i] = crc;
+    }
+    for (int s = 1; s < CHECKSUM_SLICES; s++) {
+        for (int i = 0; i < 256; i++) {
+            uint32_t prev = checksum_table[s - 1][i];
+            checksum_table[s][i] = (prev >> 8) ^ checksum_table[0][prev & 0xFF];
+        }
+    }
+
+    checksum_run = checksum_software;
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2")) checksum_run = checksum_hardware;
+#endif
+}
+
+
+/* the checksum of everything before, given as crc, followed by data */
+uint32_t checksum_update(uint32_t crc, const void *data, size_t len)
+{
+    pthread_once(&checksum_once, checksum_initialise);
+    return ~checksum_run(~crc, data, len);
+}
+
+
+/* a * b modulo the polynomial, both reflected */
+uint32_t checksum_multiply(uint32_t a, uint32_t b)
+{
+    uint32_t p = 0;
+
+    for (uint32_t m = (uint32_t)1 << 31; m; m >>= 1) {
+        if (a & m) p ^= b;
+        b = (b & 1) ? (b >> 1) ^ CHECKSUM_POLY : b >> 1;
+    }
+    return p;
+}
+
+
+/* the checksum of two pieces end to end from each one's own, so pieces can be summed
+ * on separate threads */
+uint32_t checksum_combine(uint32_t crc1, uint32_t crc2, uint64_t len2)
+{
+    /* x^(8 len2), built up from x^8 by squaring, is what crc1 is shifted along by */
+    uint32_t shift = (uint32_t)1 << 31, square = (uint32_t)1 << 23;
+
+    for (; len2; len2 >>= 1) {
+        if (len2 & 1) shift = checksum_multiply(square, shift);
+        square = checksum_multiply(square, square);
+    }
+    return checksum_multiply(shift, crc1) ^ crc2;
+}
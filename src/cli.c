@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hdr/atlas.h"
+#include "hdr/cli.h"
+#include "hdr/export.h"
+#include "hdr/file.h"
+#include "hdr/parallel.h"
+#include "hdr/tile.h"
+
+/*
+ *  Non-interactive subcommands, run in place of the editor and never touching ncurses.
+ */
+
+#define CLI_FLAG_EXPORT "--export"
+#define CLI_FLAG_CONVERT "--convert"
+#define CLI_FLAG_STATS "--stats"
+#define CLI_FLAG_VERIFY "--verify"
+#define CLI_FLAG_DIFF "--diff"
+
+
+int cli_usage(void)
+{
+    fprintf(stderr, "\nUsage:\n");
+    fprintf(stderr, "    hex [file]\n");
+    fprintf(stderr, "    hex " CLI_FLAG_EXPORT " <file> <image.ppm|image.svg>\n");
+    fprintf(stderr, "    hex " CLI_FLAG_CONVERT " <file> <file>\n");
+    fprintf(stderr, "    hex " CLI_FLAG_STATS " <file>\n");
+    fprintf(stderr, "    hex " CLI_FLAG_VERIFY " <file>...\n");
+    fprintf(stderr, "    hex " CLI_FLAG_DIFF " <file> <file>\n");
+    return 1;
+}
+
+
+int cli_export(int argc, char *argv[])
+{
+    if (argc != 4) return cli_usage();
+
+    struct Atlas *atlas = file_read(argv[2]);
+    if (!atlas) {
+        fprintf(stderr, "\nFailed to read file %s: %s\n", argv[2], file_error() ? file_error() : "unknown error");
+        return 1;
+    }
+
+    int status = 0;
+    if (!export_file(argv[3], atlas)) {
+        fprintf(stderr, "\nFailed to export file %s\n", argv[3]);
+        status = 1;
+    }
+
+    atlas_destroy(atlas);
+    return status;
+}
+
+
+int cli_convert(int argc, char *argv[])
+{
+    if (argc != 4) return cli_usage();
+
+    if (!file_convert(argv[2], argv[3])) {
+        fprintf(stderr, "\nFailed to convert %s to %s: %s\n", argv[2], argv[3], file_error() ? file_error() : "unknown error");
+        return 1;
+    }
+    return 0;
+}
+
+
+int cli_stats(int argc, char *argv[])
+{
+    if (argc != 3) return cli_usage();
+
+    struct Stats stats;
+    if (!file_stats(argv[2], &stats)) {
+        fprintf(stderr, "\nFailed to read file %s: %s\n", argv[2], file_error() ? file_error() : "unknown error");
+        return 1;
+    }
+
+    size_t charts = 0, locations = 0;
+    for (uint32_t m = 0; m <= stats.depth; m++) charts += stats.charts[m];
+    for (int t = 0; t < NUM_LOCATION_TABLE; t++) locations += stats.locations[t];
+
+    printf("%s\n", argv[2]);
+    printf("  depth       %u\n", stats.depth);
+    printf("  charts      %zu\n", charts);
+    for (uint32_t m = stats.depth + 1; m-- > 0; ) printf("    level %-5u %zu\n", m, stats.charts[m]);
+
+    /* tiles with no terrain are shown as unknown, as they are drawn */
+    printf("  tiles       %zu\n", stats.tiles);
+    for (int t = TERRAIN_UNKNOWN; t < CENSUS_SIZE; t++) {
+        size_t n = stats.terrain[t] + ((t == TERRAIN_UNKNOWN) ? stats.terrain[TERRAIN_NONE] : 0);
+        if (n) printf("    %-11s %zu\n", terrain_name(t), n);
+    }
+
+    printf("  locations   %zu\n", locations);
+    for (int t = 0; t < NUM_LOCATION_TABLE; t++) {
+        if (stats.locations[t]) printf("    %-11s %zu\n", location_name(t), stats.locations[t]);
+    }
+
+    printf("  memory      %.1f MB\n", (double)stats.bytes / (1 << 20));
+    return 0;
+}
+
+
+/* one line per file, so a whole backup directory can be checked in one go */
+int cli_verify(int argc, char *argv[])
+{
+    if (argc < 3) return cli_usage();
+
+    int status = 0;
+    for (int i = 2; i < argc; i++) {
+        if (file_verify(argv[i])) {
+            printf("%s: ok\n", argv[i]);
+        } else {
+            printf("%s: %s\n", argv[i], file_error() ? file_error() : "unknown error");
+            status = 1;
+        }
+    }
+    return status;
+}
+
+
+void cli_print_tile(char side, const struct Chart *chart)
+{
+    struct Coordinate c = chart_coordinate(chart);
+    struct Tile *tile = chart_tile(chart);
+
+    printf("%c%d,%d,%d,%u,:%u;%d;%u;%u;\n", side, coordinate_p(c), coordinate_q(c), coordinate_r(c), coordinate_m(c),
+        tile_seed(tile), tile_terrain(tile), tile_roads(tile), tile_rivers(tile));
+}
+
+
+void cli_diff_tile(struct Chart *a, struct Chart *b, void *data)
+{
+    size_t *changed = data;
+
+    if (a) cli_print_tile('-', a);
+    if (b) cli_print_tile('+', b);
+    (*changed)++;
+}
+
+
+/* locations in order of coordinate then type, to be walked side by side */
+int cli_location_compare(const void *a, const void *b)
+{
+    const struct Location *la = *(struct Location *const *)a, *lb = *(struct Location *const *)b;
+    struct Coordinate ca = location_coordinate(la), cb = location_coordinate(lb);
+    int64_t keys[2][5] = {
+        { coordinate_m(ca), coordinate_p(ca), coordinate_q(ca), coordinate_r(ca), location_type(la) },
+        { coordinate_m(cb), coordinate_p(cb), coordinate_q(cb), coordinate_r(cb), location_type(lb) },
+    };
+
+    for (int k = 0; k < 5; k++) {
+        if (keys[0][k] != keys[1][k]) return (keys[0][k] > keys[1][k]) - (keys[0][k] < keys[1][k]);
+    }
+    return 0;
+}
+
+
+struct Location **cli_locations(const struct Atlas *atlas, size_t *len)
+{
+    *len = 0;
+    for (struct Directory *d = atlas_directory(atlas); d; d = directory_next(d)) (*len)++;
+
+    struct Location **locations = malloc((*len ? *len : 1) * sizeof(struct Location *));
+    size_t i = 0;
+    for (struct Directory *d = atlas_directory(atlas); d; d = directory_next(d)) locations[i++] = directory_location(d);
+
+    qsort(locations, *len, sizeof(struct Location *), cli_location_compare);
+    return locations;
+}
+
+
+void cli_print_location(char side, const struct Location *location)
+{
+    struct Coordinate c = location_coordinate(location);
+    printf("%c%d,%d,%d,%u,:%d\n", side, coordinate_p(c), coordinate_q(c), coordinate_r(c), coordinate_m(c), location_type(location));
+}
+
+
+size_t cli_diff_locations(const struct Atlas *a, const struct Atlas *b)
+{
+    size_t na = 0, nb = 0, changed = 0;
+    struct Location **la = cli_locations(a, &na), **lb = cli_locations(b, &nb);
+
+    for (size_t i = 0, j = 0; (i < na) || (j < nb); ) {
+        int cmp = (i == na) ? 1 : (j == nb) ? -1 : cli_location_compare(&la[i], &lb[j]);
+        if (cmp < 0) cli_print_location('-', la[i++]);
+        else if (cmp > 0) cli_print_location('+', lb[j++]);
+        else {
+            i++;
+            j++;
+            continue;
+        }
+        changed++;
+    }
+
+    free(la);
+    free(lb);
+    return changed;
+}
+
+
+/*
+ *  The tiles and locations that differ, as the text save's lines prefixed with - for the
+ *  first file and + for the second. Exits with 0 if the maps are the same, 1 if they
+ *  differ and 2 if either cannot be read, as diff does.
+ */
+int cli_diff(int argc, char *argv[])
+{
+    if (argc != 4) {
+        cli_usage();
+        return 2;
+    }
+
+    struct Atlas *a = file_read(argv[2]);
+    if (!a) {
+        fprintf(stderr, "\nFailed to read file %s: %s\n", argv[2], file_error() ? file_error() : "unknown error");
+        return 2;
+    }
+    struct Atlas *b = file_read(argv[3]);
+    if (!b) {
+        fprintf(stderr, "\nFailed to read file %s: %s\n", argv[3], file_error() ? file_error() : "unknown error");
+        atlas_destroy(a);
+        return 2;
+    }
+
+    size_t changed = 0;
+    int status = 0;
+    if (!atlas_diff(a, b, cli_diff_tile, &changed)) {
+        fprintf(stderr, "\nFailed to read a block of %s or %s\n", argv[2], argv[3]);
+        status = 2;
+    } else {
+        changed += cli_diff_locations(a, b);
+        status = (changed) ? 1 : 0;
+    }
+
+    atlas_destroy(a);
+    atlas_destroy(b);
+    return status;
+}
+
+
+bool cli_is_command(const char *arg)
+{
+    return arg && (0 == strncmp(arg, "--", 2));
+}
+
+
+int cli_run(int argc, char *argv[])
+{
+    int status = 0;
+
+    if (0 == strcmp(argv[1], CLI_FLAG_EXPORT)) status = cli_export(argc, argv);
+    else if (0 == strcmp(argv[1], CLI_FLAG_CONVERT)) status = cli_convert(argc, argv);
+    else if (0 == strcmp(argv[1], CLI_FLAG_STATS)) status = cli_stats(argc, argv);
+    else if (0 == strcmp(argv[1], CLI_FLAG_VERIFY)) status = cli_verify(argc, argv);
+    else if (0 == strcmp(argv[1], CLI_FLAG_DIFF)) status = cli_diff(argc, argv);
+    else status = cli_usage();
+
+    parallel_deinitialise();
+    return status;
+}
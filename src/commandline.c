@@ -204,6 +204,10 @@ void commandline_parse(void)
         command = COMMAND_WRITE;
     } else if (commandline_match(cmd_fst, command_str(COMMAND_EDIT), len_cmd))  {
         command = COMMAND_EDIT;
+    } else if (commandline_match(cmd_fst, command_str(COMMAND_EXPORT), len_cmd))  {
+        command = COMMAND_EXPORT;
+    } else if (commandline_match(cmd_fst, command_str(COMMAND_MERGE), len_cmd))  {
+        command = COMMAND_MERGE;
     } else {
         command = COMMAND_ERROR;
     }
@@ -263,7 +267,8 @@ void commandline_complete(const char *str_basename)
         return;
     }
 
-    if (data && ((COMMAND_WRITE == command) || (COMMAND_EDIT == command))) {
+    if (data && ((COMMAND_WRITE == command) || (COMMAND_EDIT == command)
+                 || (COMMAND_EXPORT == command) || (COMMAND_MERGE == command))) {
         commandline_complete_path(str_basename);
     }
 }
@@ -0,0 +1,405 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "hdr/compress.h"
+
+/*
+ *  gzip streams with the slow half of the work on a pipeline thread: deflating and
+ *  writing while the caller serialises the next block, or reading the file while the
+ *  caller inflates the last block.
+ */
+
+#define COMPRESS_BLOCK_SIZE (1 << 20)
+#define COMPRESS_LEVEL 1    /* past this, deflate is slower than most disks */
+#define COMPRESS_GZIP_WINDOW (15 + 16)
+
+
+/* one block handed between the caller and the pipeline thread */
+struct Slot
+{
+    unsigned char *data;
+    size_t len;
+    bool full;
+};
+
+
+struct Compressor
+{
+    FILE *file;
+    z_stream stream;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    struct Slot slot;
+    unsigned char *work;
+    unsigned char *out;
+    bool finish;
+    bool ok;
+};
+
+
+bool compressor_deflate(struct Compressor *compressor, unsigned char *data, size_t len, int flush)
+{
+    z_stream *stream = &compressor->stream;
+    stream->next_in = data;
+    stream->avail_in = (uInt)len;
+
+    do {
+        stream->next_out = compressor->out;
+        stream->avail_out = COMPRESS_BLOCK_SIZE;
+        if (deflate(stream, flush) == Z_STREAM_ERROR) return false;
+
+        size_t n = COMPRESS_BLOCK_SIZE - stream->avail_out;
+        if (n && (fwrite(compressor->out, 1, n, compressor->file) != n)) return false;
+    } while (stream->avail_out == 0);
+
+    return true;
+}
+
+
+void *compressor_worker(void *arg)
+{
+    struct Compressor *compressor = arg;
+    bool ok = true;
+
+    while (1) {
+        pthread_mutex_lock(&compressor->mutex);
+        while (!compressor->slot.full && !compressor->finish) {
+            pthread_cond_wait(&compressor->cond, &compressor->mutex);
+        }
+
+        if (!compressor->slot.full) {
+            pthread_mutex_unlock(&compressor->mutex);
+            break;
+        }
+
+        /* take the block and give the caller our spare one to fill */
+        unsigned char *data = compressor->slot.data;
+        size_t len = compressor->slot.len;
+        compressor->slot.data = compressor->work;
+        compressor->slot.full = false;
+        compressor->work = data;
+        pthread_cond_broadcast(&compressor->cond);
+        pthread_mutex_unlock(&compressor->mutex);
+
+        if (ok) ok = compressor_deflate(compressor, data, len, Z_NO_FLUSH);
+    }
+
+    if (ok) ok = compressor_deflate(compressor, NULL, 0, Z_FINISH);
+    compressor->ok = ok;
+    return NULL;
+}
+
+
+struct Compressor *compressor_create(FILE *file)
+{
+    if (!file) return NULL;
+
+    struct Compressor *compressor = calloc(1, sizeof(struct Compressor));
+
+    compressor->file = file;
+    compressor->ok = true;
+    if (deflateInit2(&compressor->stream, COMPRESS_LEVEL, Z_DEFLATED, COMPRESS_GZIP_WINDOW, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        free(compressor);
+        return NULL;
+    }
+
+    compressor->slot.data = malloc(COMPRESS_BLOCK_SIZE);
+    compressor->work = malloc(COMPRESS_BLOCK_SIZE);
+    compressor->out = malloc(COMPRESS_BLOCK_SIZE);
+    pthread_mutex_init(&compressor->mutex, NULL);
+    pthread_cond_init(&compressor->cond, NULL);
+
+    if (pthread_create(&compressor->thread, NULL, compressor_worker, compressor)) {
+        deflateEnd(&compressor->stream);
+        pthread_mutex_destroy(&compressor->mutex);
+        pthread_cond_destroy(&compressor->cond);
+        free(compressor->slot.data);
+        free(compressor->work);
+        free(compressor->out);
+        free(compressor);
+        return NULL;
+    }
+
+    return compressor;
+}
+
+
+/* queue up to COMPRESS_BLOCK_SIZE bytes, waiting only while the last block is still queued */
+void compressor_write(struct Compressor *compressor, const void *data, size_t len)
+{
+    if (!compressor || !len) return;
+
+    if (len > COMPRESS_BLOCK_SIZE) {
+        compressor_write(compressor, data, COMPRESS_BLOCK_SIZE);
+        compressor_write(compressor, (const unsigned char *)data + COMPRESS_BLOCK_SIZE, len - COMPRESS_BLOCK_SIZE);
+        return;
+    }
+
+    pthread_mutex_lock(&compressor->mutex);
+    while (compressor->slot.full) pthread_cond_wait(&compressor->cond, &compressor->mutex);
+
+    memcpy(compressor->slot.data, data, len);
+    compressor->slot.len = len;
+    compressor->slot.full = true;
+    pthread_cond_broadcast(&compressor->cond);
+    pthread_mutex_unlock(&compressor->mutex);
+}
+
+
+/* end the stream, free the compressor and report whether everything was written */
+bool compressor_finish(struct Compressor *compressor)
+{
+    if (!compressor) return false;
+
+    pthread_mutex_lock(&compressor->mutex);
+    compressor->finish = true;
+    pthread_cond_broadcast(&compressor->cond);
+    pthread_mutex_unlock(&compressor->mutex);
+
+    pthread_join(compressor->thread, NULL);
+
+    bool ok = compressor->ok;
+    deflateEnd(&compressor->stream);
+    pthread_mutex_destroy(&compressor->mutex);
+    pthread_cond_destroy(&compressor->cond);
+    free(compressor->slot.data);
+    free(compressor->work);
+    free(compressor->out);
+    free(compressor);
+    return ok;
+}
+
+
+/* a gzip stream inflated a piece at a time, for files read in bounded memory */
+struct Inflater
+{
+    FILE *file;
+    z_stream stream;
+    unsigned char *in;
+    int status;
+    bool ok;
+};
+
+
+struct Inflater *inflater_create(FILE *file)
+{
+    if (!file) return NULL;
+
+    struct Inflater *inflater = calloc(1, sizeof(struct Inflater));
+
+    inflater->file = file;
+    inflater->status = Z_OK;
+    inflater->ok = true;
+    if (inflateInit2(&inflater->stream, COMPRESS_GZIP_WINDOW) != Z_OK) {
+        free(inflater);
+        return NULL;
+    }
+
+    inflater->in = malloc(COMPRESS_BLOCK_SIZE);
+    return inflater;
+}
+
+
+/* up to len bytes inflated into data, fewer only at the end of the stream or on an error */
+size_t inflater_read(struct Inflater *inflater, void *data, size_t len)
+{
+    if (!inflater || !len) return 0;
+
+    z_stream *stream = &inflater->stream;
+    stream->next_out = data;
+    stream->avail_out = (uInt)len;
+
+    while (inflater->ok && stream->avail_out) {
+        if (stream->avail_in == 0) {
+            stream->next_in = inflater->in;
+            stream->avail_in = (uInt)fread(inflater->in, 1, COMPRESS_BLOCK_SIZE, inflater->file);
+            if (stream->avail_in == 0) break;
+        }
+
+        /* concatenated gzip members are read as one stream */
+        if (inflater->status == Z_STREAM_END) inflateReset(stream);
+
+        inflater->status = inflate(stream, Z_NO_FLUSH);
+        if ((inflater->status != Z_OK) && (inflater->status != Z_STREAM_END) && (inflater->status != Z_BUF_ERROR)) {
+            inflater->ok = false;
+        }
+    }
+
+    return len - stream->avail_out;
+}
+
+
+/* free the inflater and report whether the whole stream was read and valid */
+bool inflater_finish(struct Inflater *inflater)
+{
+    if (!inflater) return false;
+
+    bool ok = inflater->ok && (inflater->status == Z_STREAM_END) && !ferror(inflater->file);
+    inflateEnd(&inflater->stream);
+    free(inflater->in);
+    free(inflater);
+    return ok;
+}
+
+
+struct Feeder
+{
+    FILE *file;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    struct Slot slots[2];
+    bool quit;
+};
+
+
+/* read the compressed file into alternate slots as fast as they are emptied */
+void *feeder_worker(void *arg)
+{
+    struct Feeder *feeder = arg;
+
+    for (int i = 0; ; i ^= 1) {
+        struct Slot *slot = &feeder->slots[i];
+
+        pthread_mutex_lock(&feeder->mutex);
+        while (slot->full && !feeder->quit) pthread_cond_wait(&feeder->cond, &feeder->mutex);
+        bool quit = feeder->quit;
+        pthread_mutex_unlock(&feeder->mutex);
+        if (quit) break;
+
+        size_t n = fread(slot->data, 1, COMPRESS_BLOCK_SIZE, feeder->file);
+
+        pthread_mutex_lock(&feeder->mutex);
+        slot->len = n;
+        slot->full = true;
+        pthread_cond_broadcast(&feeder->cond);
+        pthread_mutex_unlock(&feeder->mutex);
+
+        if (n == 0) break;
+    }
+
+    return NULL;
+}
+
+
+/* gzip keeps the uncompressed size modulo 2^32 in its last four bytes */
+size_t decompress_size_hint(FILE *file)
+{
+    unsigned char isize[4];
+    size_t hint = COMPRESS_BLOCK_SIZE;
+
+    if ((fseek(file, -4, SEEK_END) == 0) && (fread(isize, 1, 4, file) == 4)) {
+        hint = (size_t)isize[0] | ((size_t)isize[1] << 8) | ((size_t)isize[2] << 16) | ((size_t)isize[3] << 24);
+    }
+    rewind(file);
+
+    return (hint) ? hint : COMPRESS_BLOCK_SIZE;
+}
+
+
+bool decompress_grow(unsigned char **out, size_t *cap, size_t len)
+{
+    if (len < *cap) return true;
+
+    size_t next = 2 * (*cap);
+    unsigned char *tmp = realloc(*out, next);
+    if (!tmp) return false;
+
+    *out = tmp;
+    *cap = next;
+    return true;
+}
+
+
+/* the whole decompressed file in one malloc'd block, NULL if it is not valid gzip */
+char *decompress_file(const char *filename, size_t *len)
+{
+    FILE *file = fopen(filename, "rb");
+    if (!file) return NULL;
+
+    z_stream stream = { 0 };
+    if (inflateInit2(&stream, COMPRESS_GZIP_WINDOW) != Z_OK) {
+        fclose(file);
+        return NULL;
+    }
+
+    size_t cap = decompress_size_hint(file) + 1;
+    unsigned char *out = malloc(cap);
+    size_t n = 0;
+    int status = Z_OK;
+
+    struct Feeder feeder = { .file = file };
+    pthread_mutex_init(&feeder.mutex, NULL);
+    pthread_cond_init(&feeder.cond, NULL);
+    feeder.slots[0].data = malloc(COMPRESS_BLOCK_SIZE);
+    feeder.slots[1].data = malloc(COMPRESS_BLOCK_SIZE);
+
+    pthread_t thread;
+    bool threaded = (0 == pthread_create(&thread, NULL, feeder_worker, &feeder));
+    if (!threaded) status = Z_ERRNO;
+
+    for (int i = 0; out && (status != Z_ERRNO) && (status != Z_DATA_ERROR); i ^= 1) {
+        struct Slot *slot = &feeder.slots[i];
+
+        pthread_mutex_lock(&feeder.mutex);
+        while (!slot->full) pthread_cond_wait(&feeder.cond, &feeder.mutex);
+        pthread_mutex_unlock(&feeder.mutex);
+        if (slot->len == 0) break;
+
+        stream.next_in = slot->data;
+        stream.avail_in = (uInt)slot->len;
+
+        while (stream.avail_in && out) {
+            /* concatenated gzip members are read as one stream */
+            if (status == Z_STREAM_END) inflateReset(&stream);
+
+            if (!decompress_grow(&out, &cap, n + 1)) {
+                free(out);
+                out = NULL;
+                break;
+            }
+            stream.next_out = out + n;
+            stream.avail_out = (uInt)(cap - n - 1);
+
+            status = inflate(&stream, Z_NO_FLUSH);
+            n = cap - 1 - stream.avail_out;
+            if ((status != Z_OK) && (status != Z_STREAM_END) && (status != Z_BUF_ERROR)) {
+                status = Z_DATA_ERROR;
+                break;
+            }
+        }
+
+        pthread_mutex_lock(&feeder.mutex);
+        slot->full = false;
+        pthread_cond_broadcast(&feeder.cond);
+        pthread_mutex_unlock(&feeder.mutex);
+    }
+
+    if (threaded) {
+        pthread_mutex_lock(&feeder.mutex);
+        feeder.quit = true;
+        pthread_cond_broadcast(&feeder.cond);
+        pthread_mutex_unlock(&feeder.mutex);
+        pthread_join(thread, NULL);
+    }
+
+    bool ok = out && (status == Z_STREAM_END) && !ferror(file);
+    inflateEnd(&stream);
+    pthread_mutex_destroy(&feeder.mutex);
+    pthread_cond_destroy(&feeder.cond);
+    free(feeder.slots[0].data);
+    free(feeder.slots[1].data);
+    fclose(file);
+
+    if (!ok) {
+        free(out);
+        return NULL;
+    }
+
+    *len = n;
+    return (char *)out;
+}
@@ -142,3 +142,29 @@ struct Coordinate coordinate_nshift(struct Coordinate c, enum DIRECTION d, int n
 {
     return coordinate_add(c, coordinate_scale(coordinate_delta(d), n));
 }
+
+
+/* hex distance between two coordinates at the same level */
+uint32_t coordinate_distance(struct Coordinate c1, struct Coordinate c2)
+{
+    uint32_t dp = abs(c1.p - c2.p), dq = abs(c1.q - c2.q), dr = abs(c1.r - c2.r);
+    return (dp > dq) ? ((dp > dr) ? dp : dr) : ((dq > dr) ? dq : dr);
+}
+
+
+/* the coordinates within radius of c, row by row, into out (unless NULL); returns how
+ * many there are, 3 radius (radius + 1) + 1 */
+size_t coordinate_disk(struct Coordinate c, uint32_t radius, struct Coordinate *out)
+{
+    int32_t n = (int32_t)radius;
+    size_t len = 0;
+
+    for (int32_t dq = -n; dq <= n; dq++) {
+        int32_t lo = (dq > 0) ? -n : -n - dq, hi = (dq > 0) ? n - dq : n;
+        for (int32_t dp = lo; dp <= hi; dp++) {
+            if (out) out[len] = coordinate(c.p + dp, c.q + dq, c.r - dp - dq, c.m);
+            len++;
+        }
+    }
+    return len;
+}
@@ -1,5 +1,7 @@
 #include <ncurses.h>
 #include <math.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "hdr/commandline.h"
 #include "hdr/coordinate.h"
@@ -8,6 +10,7 @@
 #include "hdr/geometry.h"
 #include "hdr/atlas.h"
 #include "hdr/interface.h"
+#include "hdr/parallel.h"
 #include "hdr/state.h"
 #include "hdr/tile.h"
 
@@ -262,31 +265,9 @@ void wdraw_tile_location(WINDOW *win, struct Tile *tile, int r0, int c0)
 }
 
 
-void wdraw_tile_terrain(WINDOW *win, struct Tile *tile, int r0, int c0)
+void wdraw_tile_paths(WINDOW *win, struct Tile *tile, int r0, int c0)
 {
-    int w = geometry_tile_dw(), h = geometry_tile_dh();
-    enum TERRAIN t = tile_terrain(tile);
-    char t_char = 0;
-    enum COLOUR_PAIR t_colour = 0;
-    attr_t t_font = 0;
-
-    if ((MODE_TERRAIN != state_mode()) && (TERRAIN_UNKNOWN == t)) return;
-
-    for (int c = -w; c <= w; c++) {
-        int dh = (c < 0)
-            ? floor((w + c)*geometry_slope())
-            : floor((w - c)*geometry_slope());
-        for (int r = -(h + dh); r <= (h + dh); r++) {
-            t_char = tile_getch(tile, c, r);
-            t_colour = terrain_colour(t, t_char);
-            t_font = terrain_font(t, t_char);
-            wattron(win, COLOR_PAIR(t_colour));
-            wattron(win, t_font);
-            mvwaddch(win, r0 + r, c0 + c, tile_getch(tile, c, r));
-            wattron(win, COLOR_PAIR(t_colour));
-            wattroff(win, t_font);
-        }
-    }
+    if ((MODE_TERRAIN != state_mode()) && (TERRAIN_UNKNOWN == tile_terrain(tile))) return;
 
     wattron(win, COLOR_PAIR(COLOUR_PAIR_ROAD));
     for (int i = 0; i < NUM_DIRECTIONS; i++) {
@@ -306,44 +287,191 @@ void wdraw_tile_terrain(WINDOW *win, struct Tile *tile, int r0, int c0)
 }
 
 
-void wdraw_chart_with(
-    WINDOW *win,
-    struct Chart *chart,
-    struct Coordinate o,
-    void (*wdraw_tile)(WINDOW *, struct Tile *, int, int)
-)
+/*
+*     DRAW 04 - Canvas
+ */
+
+
+/*
+ *  Terrain is rasterised off-screen into a buffer of cells, one band of screen rows
+ *  per job on the worker pool, and then pushed to ncurses in a single pass. Bands
+ *  never share a cell, and inside a band the tiles are drawn in the same order as
+ *  on a single thread, so the picture does not depend on the number of workers.
+ */
+
+
+struct Placement
+{
+    struct Tile *tile;
+    int r, c;
+};
+
+
+struct Canvas
+{
+    int rows, cols;
+    chtype *cells;
+    struct Placement *placements;
+    size_t len, cap;
+    bool unknown;
+};
+
+
+struct Canvas canvas = { 0 };
+
+
+void canvas_resize(int rows, int cols)
+{
+    if ((canvas.rows == rows) && (canvas.cols == cols) && canvas.cells) return;
+
+    chtype *tmp = realloc(canvas.cells, (size_t)rows * cols * sizeof(chtype));
+    if (!tmp) return;
+    canvas.cells = tmp;
+    canvas.rows = rows;
+    canvas.cols = cols;
+}
+
+
+void canvas_place(struct Chart *chart, void *data)
+{
+    struct Coordinate o = *(struct Coordinate *)data;
+    int w = geometry_tile_dw(), h = geometry_tile_dh();
+    int dp = coordinate_p(chart_coordinate(chart)) - coordinate_p(o),
+        dq = coordinate_q(chart_coordinate(chart)) - coordinate_q(o);
+    int r = geometry_rmid() + 3*dq*h, c = geometry_cmid() + (2*dp + dq)*w;
+
+    /* tiles reach 2h rows and 2w columns from their centre, with roads drawn to it */
+    if ((r + 3*h < 0) || (r - 3*h >= canvas.rows)) return;
+    if ((c + 2*w < 0) || (c - 2*w >= canvas.cols)) return;
+
+    if (canvas.len >= canvas.cap) {
+        size_t cap = (canvas.cap) ? 2*canvas.cap : 256;
+        struct Placement *tmp = realloc(canvas.placements, cap * sizeof(struct Placement));
+        if (!tmp) return;
+        canvas.placements = tmp;
+        canvas.cap = cap;
+    }
+
+    canvas.placements[canvas.len++] = (struct Placement) { chart_tile(chart), r, c };
+}
+
+
+/* gather every tile that lands on screen, in the order the atlas holds them */
+void canvas_collect(struct Atlas *atlas)
+{
+    struct Coordinate o = atlas_coordinate(atlas);
+    int32_t dq = geometry_tile_nh() / 2 + 2, dx = geometry_tile_nw() + 4;
+    int32_t q0 = coordinate_q(o) - dq, q1 = coordinate_q(o) + dq;
+    int32_t x0 = 2*coordinate_p(o) + coordinate_q(o) - dx,
+            x1 = 2*coordinate_p(o) + coordinate_q(o) + dx;
+
+    struct Coordinate lo = coordinate((x0 - q1)/2 - 1, q0, 0, 0),
+                      hi = coordinate((x1 - q0)/2 + 1, q1, 0, 0);
+
+    canvas.len = 0;
+    canvas.unknown = (MODE_TERRAIN == state_mode());
+    atlas_region(atlas, lo, hi, canvas_place, &o);
+}
+
+
+void canvas_band(size_t i, void *data)
 {
-    if (!chart || !wdraw_tile) return;
+    size_t n = *(size_t *)data;
+    int b0 = (int)(i * canvas.rows / n), b1 = (int)((i + 1) * canvas.rows / n);
+    int w = geometry_tile_dw(), h = geometry_tile_dh();
+    float slope = geometry_slope();
+
+    memset(canvas.cells + (size_t)b0 * canvas.cols, 0, (size_t)(b1 - b0) * canvas.cols * sizeof(chtype));
+
+    /* how far each column of a tile reaches above and below its centre */
+    int *reach = malloc((2*w + 1) * sizeof(int));
+    char *glyphs = malloc(2*w + 1);
+    if (!reach || !glyphs) {
+        free(reach);
+        free(glyphs);
+        return;
+    }
+    for (int c = -w; c <= w; c++) {
+        reach[c + w] = h + ((c < 0) ? floor((w + c)*slope) : floor((w - c)*slope));
+    }
+
+    for (size_t k = 0; k < canvas.len; k++) {
+        struct Placement *p = &(canvas.placements[k]);
+        enum TERRAIN t = tile_terrain(p->tile);
 
-    /* don't bother if this chart doesn't overlap with the target viewpoint */
-    if (!coordinate_related(chart_coordinate(chart), geometry_viewpoint())) return;
+        if (!canvas.unknown && (TERRAIN_UNKNOWN == t)) continue;
 
-    /* recurse */
-    if (chart_has_children(chart)) {
-        for (int i = 0; i < NUM_CHILDREN; i++) {
-            wdraw_chart_with(win, chart_child(chart, i), o, wdraw_tile);
+        int r_lo = (p->r - 2*h < b0) ? b0 - p->r : -2*h;
+        int r_hi = (p->r + 2*h >= b1) ? b1 - 1 - p->r : 2*h;
+
+        const chtype *attrs = terrain_attrs(t);
+        for (int r = r_lo; r <= r_hi; r++) {
+            chtype *row = canvas.cells + (size_t)(p->r + r) * canvas.cols;
+            tile_getch_row(p->tile, -w, 2*w + 1, r, glyphs);
+
+            for (int c = -w; c <= w; c++) {
+                int col = p->c + c;
+                if ((col < 0) || (col >= canvas.cols)) continue;
+                if ((r < -reach[c + w]) || (r > reach[c + w])) continue;
+
+                unsigned char ch = glyphs[c + w];
+                row[col] = ch | attrs[ch];
+            }
         }
     }
 
-    /* draw own tile */
-    if (chart_tile(chart)) {
-        int r0 = geometry_rmid(), c0 = geometry_cmid();
-        int dp = coordinate_p(chart_coordinate(chart)) - coordinate_p(o),
-            dq = coordinate_q(chart_coordinate(chart)) - coordinate_q(o);
+    free(reach);
+    free(glyphs);
+}
+
 
-        int r = r0 + 3*dq*geometry_tile_dh(), c =
-            c0 + (2*dp + dq)*geometry_tile_dw();
-        wdraw_tile(win, chart_tile(chart), r, c);
+void canvas_rasterise(void)
+{
+    size_t n = 2 * (size_t)parallel_threads();
+    if (n > (size_t)canvas.rows) n = (canvas.rows > 0) ? (size_t)canvas.rows : 1;
+    parallel_for(n, canvas_band, &n);
+}
+
+
+void canvas_flush(WINDOW *win)
+{
+    for (int r = 0; r < canvas.rows; r++) {
+        chtype *row = canvas.cells + (size_t)r * canvas.cols;
+        int c = 0;
+        while (c < canvas.cols) {
+            if (!row[c]) {
+                c++;
+                continue;
+            }
+            int run = 1;
+            while ((c + run < canvas.cols) && row[c + run]) run++;
+            mvwaddchnstr(win, r, c, row + c, run);
+            c += run;
+        }
+    }
+}
+
+
+void wdraw_placements_with(WINDOW *win, void (*wdraw_tile)(WINDOW *, struct Tile *, int, int))
+{
+    for (size_t k = 0; k < canvas.len; k++) {
+        struct Placement *p = &(canvas.placements[k]);
+        wdraw_tile(win, p->tile, p->r, p->c);
     }
 }
 
 
 void wdraw_atlas(WINDOW *win, struct Atlas *atlas)
 {
-    struct Coordinate o = atlas_coordinate(atlas);
+    canvas_resize(geometry_rows(), geometry_cols());
+    if (!canvas.cells) return;
+
+    canvas_collect(atlas);
+    canvas_rasterise();
+    canvas_flush(win);
 
-    wdraw_chart_with(win, atlas_root(atlas), o, wdraw_tile_terrain);
-    wdraw_chart_with(win, atlas_root(atlas), o, wdraw_tile_location);
+    wdraw_placements_with(win, wdraw_tile_paths);
+    wdraw_placements_with(win, wdraw_tile_location);
 }
 
 
@@ -367,11 +495,30 @@ void wdraw_reticule(WINDOW *win)
 }
 
 
+void wdraw_minimap(WINDOW *win, struct Panel *p)
+{
+    int r0 = panel_row(p) + 3, c0 = panel_col(p) + 2;
+
+    for (int r = 0; r < minimap_rows(); r++) {
+        for (int c = 0; c < minimap_cols(); c++) {
+            enum TERRAIN t = minimap_terrain(r, c);
+            char ch = ' ';
+            attr_t font = (minimap_is_outline(r, c)) ? A_REVERSE : A_NORMAL;
+
+            if ((TERRAIN_NONE != t) && (TERRAIN_UNKNOWN != t)) ch = terrain_chopts(t)[0];
+
+            mvwaddch(win, r0 + r, c0 + c, (unsigned char)ch | terrain_attrs(t)[(unsigned char)ch] | font);
+        }
+    }
+}
+
+
 void wdraw_ui(WINDOW *win)
 {
     for (int p = 0; p < NUM_UI_PANELS; p++) {
         if (ui_is_show(p)) {
             wdraw_panel(win, ui_panel(p));
+            if (PANEL_MINIMAP == p) wdraw_minimap(win, ui_panel(p));
         }
     }
 }
@@ -403,6 +550,10 @@ void wdraw_statusline(WINDOW *win)
     waddstr(win, mode_name(state_mode()));
     wattroff(win, COLOR_PAIR(mode_colour(state_mode())));
 
+    if (state_brush() && ((MODE_TERRAIN == state_mode()) || (MODE_AWAIT_TERRAIN == state_mode()))) {
+        wprintw(win, " brush %u", state_brush());
+    }
+
     if (MODE_COMMAND == state_mode()) {
         addch(' ');
         addch(':');
@@ -55,6 +55,17 @@ void colour_initialise(void)
  *  DIRECTION
  */
 
+/*  DIRECTION : Constants */
+
+const char *direction_names[NUM_DIRECTIONS] = {
+    [DIRECTION_EE] = "E",
+    [DIRECTION_NE] = "NE",
+    [DIRECTION_NW] = "NW",
+    [DIRECTION_WW] = "W",
+    [DIRECTION_SW] = "SW",
+    [DIRECTION_SE] = "SE",
+};
+
 /*  DIRECTION : Functions */
 
 enum DIRECTION direction_opposite(enum DIRECTION d)
@@ -72,6 +83,11 @@ enum DIRECTION direction_prev(enum DIRECTION d)
     return (d + NUM_DIRECTIONS - 1) % NUM_DIRECTIONS;
 }
 
+const char *direction_name(enum DIRECTION d)
+{
+    return (d < NUM_DIRECTIONS) ? direction_names[d] : "";
+}
+
 /*======================================================================================
  *  TERRAIN
  */
@@ -100,8 +116,47 @@ const char *terrain_chopts_jungle       = "tttt TTTT 4444 YYYY PPPP FFFF #### $$
 const char *terrain_chopts_swamp        = "iiii jjjj % % % ~~~~~~~~~~~~~~~~                     ";
 const char *terrain_chopts_tundra       = "........ ooo === ______ -----------                  ";
 
+const char **terrain_chopts_table[NUM_TERRAIN_TABLE] = {
+    [TERRAIN_NONE] = &terrain_chopts_unknown,
+    [TERRAIN_UNKNOWN] = &terrain_chopts_unknown,
+    [TERRAIN_WATER] = &terrain_chopts_water,
+    [TERRAIN_MOUNTAINS] = &terrain_chopts_mountains,
+    [TERRAIN_PLAINS] = &terrain_chopts_plains,
+    [TERRAIN_HILLS] = &terrain_chopts_hills,
+    [TERRAIN_FOREST] = &terrain_chopts_forest,
+    [TERRAIN_DESERT] = &terrain_chopts_desert,
+    [TERRAIN_JUNGLE] = &terrain_chopts_jungle,
+    [TERRAIN_SWAMP] = &terrain_chopts_swamp,
+    [TERRAIN_TUNDRA] = &terrain_chopts_tundra,
+};
+
+/* colour pair and font of every character for every terrain, see terrain_initialise */
+chtype terrain_attrs_table[NUM_TERRAIN_TABLE][256] = { 0 };
+
 /*  TERRAIN : Functions */
 
+void terrain_initialise(void)
+{
+    for (enum TERRAIN t = 0; t < NUM_TERRAIN_TABLE; t++) {
+        for (int c = 0; c < 256; c++) {
+            terrain_attrs_table[t][c] = COLOR_PAIR(terrain_colour(t, (char)c))
+                | terrain_font(t, (char)c);
+        }
+    }
+}
+
+const chtype *terrain_attrs(enum TERRAIN t)
+{
+    if (t >= NUM_TERRAIN_TABLE) t = TERRAIN_UNKNOWN;
+    return terrain_attrs_table[t];
+}
+
+const char *terrain_chopts(enum TERRAIN t)
+{
+    if (t >= NUM_TERRAIN_TABLE) t = TERRAIN_UNKNOWN;
+    return *terrain_chopts_table[t];
+}
+
 const char *terrain_name(enum TERRAIN t)
 {
     switch (t) {
@@ -129,32 +184,6 @@ const char *terrain_name(enum TERRAIN t)
     return terrain_unknown;
 }
 
-const char *terrain_chopts(enum TERRAIN t)
-{
-    switch (t) {
-        case TERRAIN_WATER:
-            return terrain_chopts_water;
-        case TERRAIN_MOUNTAINS:
-            return terrain_chopts_mountains;
-        case TERRAIN_PLAINS:
-            return terrain_chopts_plains;
-        case TERRAIN_HILLS:
-            return terrain_chopts_hills;
-        case TERRAIN_FOREST:
-            return terrain_chopts_forest;
-        case TERRAIN_DESERT:
-            return terrain_chopts_desert;
-        case TERRAIN_JUNGLE:
-            return terrain_chopts_jungle;
-        case TERRAIN_SWAMP:
-            return terrain_chopts_swamp;
-        case TERRAIN_TUNDRA:
-            return terrain_chopts_tundra;
-        default:
-            return terrain_chopts_unknown;
-    }
-}
-
 int terrain_colour(enum TERRAIN t, char c)
 {
     if (c == ' ') return COLOR_WHITE;
@@ -240,6 +269,35 @@ attr_t terrain_font(enum TERRAIN t, char c)
 }
 
 
+/* flat 0xRRGGBB colour for image exports */
+uint32_t terrain_rgb(enum TERRAIN t)
+{
+    switch (t) {
+        case TERRAIN_WATER:
+            return 0x2a5caa;
+        case TERRAIN_MOUNTAINS:
+            return 0x8c8c8c;
+        case TERRAIN_PLAINS:
+            return 0x9bc45a;
+        case TERRAIN_HILLS:
+            return 0xb59a4a;
+        case TERRAIN_FOREST:
+            return 0x2f7a32;
+        case TERRAIN_DESERT:
+            return 0xe3cc7a;
+        case TERRAIN_JUNGLE:
+            return 0x1f5e2a;
+        case TERRAIN_SWAMP:
+            return 0x4f7a6a;
+        case TERRAIN_TUNDRA:
+            return 0xdde6ec;
+        default:
+            break;
+    }
+    return 0x000000;
+}
+
+
 bool terrain_impassable(enum TERRAIN t)
 {
     switch (t) {
@@ -252,6 +310,34 @@ bool terrain_impassable(enum TERRAIN t)
     return false;
 }
 
+/*======================================================================================
+ *  LOCATION
+ */
+
+/*  LOCATION : Constants */
+
+const char *location_none = "None";
+const char *location_settlement = "Settlement";
+const char *location_feature = "Feature";
+const char *location_dungeon = "Dungeon";
+
+/*  LOCATION : Functions */
+
+const char *location_name(enum LOCATION l)
+{
+    switch (l) {
+        case LOCATION_SETTLEMENT:
+            return location_settlement;
+        case LOCATION_FEATURE:
+            return location_feature;
+        case LOCATION_DUNGEON:
+            return location_dungeon;
+        default:
+            break;
+    }
+    return location_none;
+}
+
 /*======================================================================================
  *  MODE
  */
@@ -377,6 +463,11 @@ const char *statusstr_success_edit_new = "New file ";
 const char *statusstr_success_edit_old = "Opened file ";
 const char *statusstr_fail_write = "ERROR: failed to write file ";
 const char *statusstr_fail_edit = "ERROR: failed to read file ";
+const char *statusstr_success_export = "Exported file ";
+const char *statusstr_fail_export = "ERROR: failed to export file ";
+const char *statusstr_fail_autosave = "ERROR: failed to autosave to ";
+const char *statusstr_success_merge = "Merged file ";
+const char *statusstr_fail_merge = "ERROR: failed to merge file ";
 
 
 /*  STATUS : Functions */
@@ -394,6 +485,16 @@ const char *status_string(enum STATUS s)
             return statusstr_fail_write;
         case STATUS_ERROR_EDIT:
             return statusstr_fail_edit;
+        case STATUS_SUCCESS_EXPORT:
+            return statusstr_success_export;
+        case STATUS_ERROR_EXPORT:
+            return statusstr_fail_export;
+        case STATUS_ERROR_AUTOSAVE:
+            return statusstr_fail_autosave;
+        case STATUS_SUCCESS_MERGE:
+            return statusstr_success_merge;
+        case STATUS_ERROR_MERGE:
+            return statusstr_fail_merge;
         case STATUS_OK:
         default:
             return NULL;
@@ -410,6 +511,8 @@ const char *status_string(enum STATUS s)
 const char *COMMAND_WORD_QUIT = "quit";
 const char *COMMAND_WORD_WRITE = "write";
 const char *COMMAND_WORD_EDIT = "edit";
+const char *COMMAND_WORD_EXPORT = "export";
+const char *COMMAND_WORD_MERGE = "merge";
 const char *COMMAND_WORD_NONE = "";
 
 
@@ -424,9 +527,39 @@ const char *command_str(enum COMMAND c)
             return COMMAND_WORD_WRITE;
         case COMMAND_EDIT:
             return COMMAND_WORD_EDIT;
+        case COMMAND_EXPORT:
+            return COMMAND_WORD_EXPORT;
+        case COMMAND_MERGE:
+            return COMMAND_WORD_MERGE;
         default:
             break;
     }
 
     return COMMAND_WORD_NONE;
 }
+
+
+/*======================================================================================
+ *  MERGE
+ */
+
+/*  MERGE : Constants */
+
+const char *MERGE_WORD_OURS = "ours";
+const char *MERGE_WORD_THEIRS = "theirs";
+
+
+/*  MERGE : Functions */
+
+const char *merge_str(enum MERGE m)
+{
+    switch (m) {
+        case MERGE_THEIRS:
+            return MERGE_WORD_THEIRS;
+        case MERGE_OURS:
+        default:
+            break;
+    }
+
+    return MERGE_WORD_OURS;
+}
@@ -0,0 +1,469 @@
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hdr/atlas.h"
+#include "hdr/coordinate.h"
+#include "hdr/enum.h"
+#include "hdr/export.h"
+#include "hdr/geometry.h"
+#include "hdr/parallel.h"
+#include "hdr/tile.h"
+
+#define EXPORT_PPM_HEX_SIZE 4
+#define EXPORT_PPM_BAND_ROWS 64
+#define EXPORT_SVG_HEX_SIZE 10
+#define EXPORT_SVG_BAND_ROWS 16
+
+/*
+ *  Images are laid out the same way as the screen: a tile at (p, q) is centred at
+ *  x = (2p + q) half-widths across and y = 1.5q hex sizes down. Every band of the
+ *  image is rendered independently from a region query, so bands can be handed out
+ *  to the worker pool and streamed to the file in order as they complete. Workers only
+ *  peek at the atlas; the blocks a batch of bands needs are read in before it starts.
+ */
+
+struct Extent
+{
+    bool empty;
+    int32_t q0, q1;     /* rows */
+    int64_t x0, x1;     /* half-width columns, 2p + q */
+};
+
+
+struct Band
+{
+    int32_t lo, hi;
+    char *buf;
+    size_t len, cap;
+    bool ok;                    /* nothing was left out for want of memory or a block */
+};
+
+
+struct Export
+{
+    const struct Atlas *atlas;
+    struct Extent extent;
+    double size, half;
+    int64_t width, height;
+    void (*rows)(const struct Export *, const struct Band *, struct Coordinate *, struct Coordinate *);
+    void (*render)(struct Export *, struct Band *);
+    struct Band *bands;
+};
+
+
+bool export_is_drawn(const struct Tile *tile)
+{
+    enum TERRAIN t = tile_terrain(tile);
+    return (TERRAIN_NONE != t) && (TERRAIN_UNKNOWN != t);
+}
+
+
+void band_reserve(struct Band *band, size_t len)
+{
+    if (band->len + len <= band->cap) return;
+
+    size_t cap = (band->cap) ? band->cap : 4096;
+    while (cap < band->len + len) cap *= 2;
+
+    char *tmp = realloc(band->buf, cap);
+    if (!tmp) {
+        band->ok = false;
+        return;
+    }
+    band->buf = tmp;
+    band->cap = cap;
+}
+
+
+void band_append(struct Band *band, const char *str, size_t len)
+{
+    band_reserve(band, len);
+    if (band->len + len > band->cap) return;
+    memcpy(band->buf + band->len, str, len);
+    band->len += len;
+}
+
+
+/*==========================================================
+ *  EXTENT
+ *========================================================*/
+
+void extent_visit(struct Chart *chart, void *data)
+{
+    struct Extent *extent = data;
+    if (!export_is_drawn(chart_tile(chart))) return;
+
+    struct Coordinate c = chart_coordinate(chart);
+    int32_t q = coordinate_q(c);
+    int64_t x = 2*(int64_t)coordinate_p(c) + q;
+
+    if (extent->empty) {
+        extent->q0 = extent->q1 = q;
+        extent->x0 = extent->x1 = x;
+        extent->empty = false;
+        return;
+    }
+
+    if (q < extent->q0) extent->q0 = q;
+    if (q > extent->q1) extent->q1 = q;
+    if (x < extent->x0) extent->x0 = x;
+    if (x > extent->x1) extent->x1 = x;
+}
+
+
+/* blocks read in along the way are dropped again once walked, if over budget */
+void extent_chart(const struct Atlas *atlas, struct Chart *chart, bool trim, struct Extent *extent)
+{
+    if (!chart) return;
+    if (chart_has_tile(chart)) {
+        if (chart_tile(chart)) extent_visit(chart, extent);
+        return;
+    }
+
+    bool read = chart_is_stub(chart);
+    if (!atlas_fault(atlas, chart)) return;
+
+    for (int i = 0; i < NUM_CHILDREN; i++) extent_chart(atlas, chart_child(chart, i), trim && !read, extent);
+    if (trim && read) atlas_trim(atlas);
+}
+
+
+struct Extent extent_of(const struct Atlas *atlas)
+{
+    struct Extent extent = { .empty = true };
+    extent_chart(atlas, atlas_root(atlas), true, &extent);
+    return extent;
+}
+
+
+/* corners of the region query covering rows qa..qb of the extent */
+void extent_rows(
+    const struct Extent *extent,
+    int32_t qa,
+    int32_t qb,
+    struct Coordinate *lo,
+    struct Coordinate *hi
+)
+{
+    int64_t p0 = (extent->x0 - qb) / 2 - 1, p1 = (extent->x1 - qa) / 2 + 1;
+    *lo = coordinate((int32_t)p0, qa, 0, 0);
+    *hi = coordinate((int32_t)p1, qb, 0, 0);
+}
+
+
+/*==========================================================
+ *  PPM
+ *========================================================*/
+
+struct Raster
+{
+    int32_t p0, q0;
+    int64_t np, nq;
+    uint8_t *cells;
+};
+
+
+void raster_visit(struct Chart *chart, void *data)
+{
+    struct Raster *raster = data;
+    struct Coordinate c = chart_coordinate(chart);
+    int64_t i = coordinate_q(c) - raster->q0, j = coordinate_p(c) - raster->p0;
+
+    if ((i < 0) || (i >= raster->nq) || (j < 0) || (j >= raster->np)) return;
+    raster->cells[i*raster->np + j] = (uint8_t)tile_terrain(chart_tile(chart));
+}
+
+
+/* nearest hex centre to a point, in the usual cube rounding way */
+void export_hex_round(double pf, double qf, int64_t *p, int64_t *q)
+{
+    double rf = -pf - qf;
+    double pr = round(pf), qr = round(qf), rr = round(rf);
+    double dp = fabs(pr - pf), dq = fabs(qr - qf), dr = fabs(rr - rf);
+
+    if ((dp > dq) && (dp > dr)) pr = -qr - rr;
+    else if (dq > dr) qr = -pr - rr;
+
+    *p = (int64_t)pr;
+    *q = (int64_t)qr;
+}
+
+
+/* rows of tiles that can reach into the band's rows of pixels */
+void export_ppm_rows(const struct Export *export, const struct Band *band, struct Coordinate *lo, struct Coordinate *hi)
+{
+    double y0 = 1.5*export->size*export->extent.q0 - export->size;
+    int32_t qa = (int32_t)floor((y0 + band->lo) / (1.5*export->size)) - 1,
+            qb = (int32_t)ceil((y0 + band->hi) / (1.5*export->size)) + 1;
+
+    extent_rows(&(export->extent), qa, qb, lo, hi);
+}
+
+
+void export_ppm_render(struct Export *export, struct Band *band)
+{
+    const struct Extent *extent = &(export->extent);
+    double size = export->size, half = export->half;
+    double x0 = half*(double)extent->x0 - half, y0 = 1.5*size*extent->q0 - size;
+
+    struct Coordinate lo, hi;
+    export_ppm_rows(export, band, &lo, &hi);
+    band->len = 0;
+    band->ok = true;
+
+    struct Raster raster = {
+        .p0 = coordinate_p(lo),
+        .q0 = coordinate_q(lo),
+        .np = (int64_t)coordinate_p(hi) - coordinate_p(lo) + 1,
+        .nq = (int64_t)coordinate_q(hi) - coordinate_q(lo) + 1,
+    };
+    raster.cells = calloc(raster.np * raster.nq, sizeof(uint8_t));
+    if (!raster.cells) {
+        band->ok = false;
+        return;
+    }
+    if (!atlas_peek_region(export->atlas, lo, hi, raster_visit, &raster)) band->ok = false;
+
+    size_t len = 3 * (size_t)export->width * (size_t)(band->hi - band->lo);
+    band_reserve(band, len);
+    if (band->cap < len) {
+        free(raster.cells);
+        return;
+    }
+
+    uint8_t *px = (uint8_t *)band->buf;
+    for (int32_t y = band->lo; y < band->hi; y++) {
+        double qf = (y0 + y + 0.5) / (1.5*size);
+        for (int64_t x = 0; x < export->width; x++) {
+            double pf = ((x0 + x + 0.5) / half - qf) / 2;
+            int64_t p = 0, q = 0;
+            export_hex_round(pf, qf, &p, &q);
+
+            int64_t i = q - raster.q0, j = p - raster.p0;
+            enum TERRAIN t = TERRAIN_NONE;
+            if ((i >= 0) && (i < raster.nq) && (j >= 0) && (j < raster.np)) {
+                t = raster.cells[i*raster.np + j];
+            }
+
+            uint32_t rgb = terrain_rgb(t);
+            *(px++) = (rgb >> 16) & 0xff;
+            *(px++) = (rgb >> 8) & 0xff;
+            *(px++) = rgb & 0xff;
+        }
+    }
+    band->len = len;
+
+    free(raster.cells);
+}
+
+
+/*==========================================================
+ *  SVG
+ *========================================================*/
+
+struct Vector
+{
+    const struct Export *export;
+    struct Band *band;
+};
+
+
+void vector_visit(struct Chart *chart, void *data)
+{
+    struct Vector *vector = data;
+    const struct Export *export = vector->export;
+    struct Coordinate c = chart_coordinate(chart);
+    enum TERRAIN t = tile_terrain(chart_tile(chart));
+    int32_t q = coordinate_q(c);
+    int64_t x = 2*(int64_t)coordinate_p(c) + q;
+
+    if ((q < vector->band->lo) || (q >= vector->band->hi)) return;
+    if (!export_is_drawn(chart_tile(chart))) return;
+
+    char buf[96];
+    int len = snprintf(
+        buf, sizeof(buf), "<use href=\"#h\" class=\"t%d\" x=\"%.1f\" y=\"%.1f\"/>\n",
+        t,
+        export->half * (double)(x - export->extent.x0 + 1),
+        1.5 * export->size * (q - export->extent.q0) + export->size
+    );
+    if (len > 0) band_append(vector->band, buf, (size_t)len);
+}
+
+
+void export_svg_rows(const struct Export *export, const struct Band *band, struct Coordinate *lo, struct Coordinate *hi)
+{
+    extent_rows(&(export->extent), band->lo, band->hi - 1, lo, hi);
+}
+
+
+void export_svg_render(struct Export *export, struct Band *band)
+{
+    struct Coordinate lo, hi;
+    struct Vector vector = { .export = export, .band = band };
+
+    band->len = 0;
+    band->ok = true;
+    export_svg_rows(export, band, &lo, &hi);
+    if (!atlas_peek_region(export->atlas, lo, hi, vector_visit, &vector)) band->ok = false;
+}
+
+
+bool export_svg_header(FILE *file, const struct Export *export)
+{
+    double s = export->size, w = export->half;
+
+    fprintf(
+        file,
+        "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%" PRId64 "\" height=\"%" PRId64 "\">\n",
+        export->width, export->height
+    );
+    fprintf(file, "<style>\n");
+    for (enum TERRAIN t = TERRAIN_WATER; t <= TERRAIN_TUNDRA; t++) {
+        fprintf(file, ".t%d{fill:#%06x}\n", t, terrain_rgb(t));
+    }
+    fprintf(file, "</style>\n");
+    fprintf(
+        file,
+        "<defs><polygon id=\"h\" points=\"0,%.2f %.2f,%.2f %.2f,%.2f 0,%.2f %.2f,%.2f %.2f,%.2f\"/></defs>\n",
+        -s, w, -s/2, w, s/2, s, -w, s/2, -w, -s/2
+    );
+    return !ferror(file);
+}
+
+
+/*==========================================================
+ *  STREAM
+ *========================================================*/
+
+void export_read(struct Chart *chart, void *data)
+{
+    (void)chart;
+    (void)data;
+}
+
+
+void export_job(size_t i, void *data)
+{
+    struct Export *export = data;
+    export->render(export, &(export->bands[i]));
+}
+
+
+/* render rows [0, n) in bands of the given height, a batch at a time, in order */
+bool export_stream(FILE *file, struct Export *export, int64_t n, int32_t rows, int32_t r0)
+{
+    size_t batch = 2 * (size_t)parallel_threads();
+    export->bands = calloc(batch, sizeof(struct Band));
+    if (!export->bands) return false;
+
+    bool ok = true;
+    for (int64_t r = 0; ok && (r < n); r += batch * rows) {
+        size_t k = 0;
+        for (; (k < batch) && (r + (int64_t)k*rows < n); k++) {
+            int64_t lo = r + (int64_t)k*rows;
+            export->bands[k].lo = r0 + (int32_t)lo;
+            export->bands[k].hi = r0 + (int32_t)((lo + rows < n) ? lo + rows : n);
+        }
+
+        /* reading blocks in and keeping count of their use is left to this thread */
+        for (size_t i = 0; atlas_paged(export->atlas) && (i < k); i++) {
+            struct Coordinate lo, hi;
+            export->rows(export, &(export->bands[i]), &lo, &hi);
+            atlas_region(export->atlas, lo, hi, export_read, NULL);
+        }
+
+        parallel_for(k, export_job, export);
+        atlas_trim(export->atlas);
+
+        /* a band short of what it should hold fails the export rather than leave a gap */
+        for (size_t i = 0; ok && (i < k); i++) {
+            struct Band *band = &(export->bands[i]);
+            if (!band->ok || (fwrite(band->buf, 1, band->len, file) != band->len)) ok = false;
+        }
+    }
+
+    for (size_t i = 0; i < batch; i++) free(export->bands[i].buf);
+    free(export->bands);
+    export->bands = NULL;
+    return ok;
+}
+
+
+bool export_ppm(FILE *file, const struct Atlas *atlas)
+{
+    if (!file || !atlas) return false;
+
+    struct Export export = {
+        .atlas = atlas,
+        .extent = extent_of(atlas),
+        .size = EXPORT_PPM_HEX_SIZE,
+        .half = EXPORT_PPM_HEX_SIZE * ROOT3 / 2,
+        .rows = export_ppm_rows,
+        .render = export_ppm_render,
+    };
+
+    if (export.extent.empty) {
+        export.width = export.height = 1;
+    } else {
+        struct Extent *e = &(export.extent);
+        export.width = (int64_t)ceil(export.half * (double)(e->x1 - e->x0 + 2));
+        export.height = (int64_t)ceil(export.size * (1.5*(e->q1 - e->q0) + 2));
+    }
+
+    fprintf(file, "P6\n%" PRId64 " %" PRId64 "\n255\n", export.width, export.height);
+    return export_stream(file, &export, export.height, EXPORT_PPM_BAND_ROWS, 0);
+}
+
+
+bool export_svg(FILE *file, const struct Atlas *atlas)
+{
+    if (!file || !atlas) return false;
+
+    struct Export export = {
+        .atlas = atlas,
+        .extent = extent_of(atlas),
+        .size = EXPORT_SVG_HEX_SIZE,
+        .half = EXPORT_SVG_HEX_SIZE * ROOT3 / 2,
+        .rows = export_svg_rows,
+        .render = export_svg_render,
+    };
+
+    int64_t n = 0;
+    if (!export.extent.empty) {
+        struct Extent *e = &(export.extent);
+        n = (int64_t)e->q1 - e->q0 + 1;
+        export.width = (int64_t)ceil(export.half * (double)(e->x1 - e->x0 + 2));
+        export.height = (int64_t)ceil(export.size * (1.5*(e->q1 - e->q0) + 2));
+    }
+
+    if (!export_svg_header(file, &export)) return false;
+    bool ok = export_stream(file, &export, n, EXPORT_SVG_BAND_ROWS, export.extent.q0);
+    fprintf(file, "</svg>\n");
+    return ok && !ferror(file);
+}
+
+
+bool export_file(const char *filename, const struct Atlas *atlas)
+{
+    if (!filename || !atlas) return false;
+
+    const char *ext = strrchr(filename, '.');
+    bool (*exporter)(FILE *, const struct Atlas *) = NULL;
+
+    if (ext && (0 == strcmp(ext, ".ppm"))) exporter = export_ppm;
+    else if (ext && (0 == strcmp(ext, ".svg"))) exporter = export_svg;
+    else return false;
+
+    FILE *file = fopen(filename, "w");
+    if (!file) return false;
+
+    bool ok = exporter(file, atlas);
+    if (fclose(file)) ok = false;
+    return ok;
+}
@@ -1,112 +1,515 @@
+#define _GNU_SOURCE
+
 #include <ctype.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "hdr/atlas.h"
+#include "hdr/checksum.h"
+#include "hdr/compress.h"
 #include "hdr/coordinate.h"
 #include "hdr/file.h"
+#include "hdr/parallel.h"
 #include "hdr/tile.h"
 
 #define FILE_MARKER_ROOT "===ROOT==="
 #define FILE_MARKER_CURR "===CURR==="
 #define FILE_MARKER_LOCN "===LOCN==="
 #define FILE_MARKER_NULL "===NULL==="
+#define FILE_MARKER_JRNL "===JRNL==="
+#define FILE_MARKER_SUMS "===SUMS==="
 
 #define FILE_SEP_MAJ ':'
 #define FILE_SEP_MED ';'
 #define FILE_SEP_MIN ','
 
+#define FILE_EXT_BINARY ".hexb"
+#define FILE_EXT_BINARY_GZIP ".hexz"
+#define FILE_EXT_TILED ".hext"
+#define FILE_EXT_JSONL ".jsonl"
+#define FILE_EXT_CSV ".csv"
+#define FILE_EXT_GZIP ".gz"
+#define FILE_EXT_JOURNAL ".journal"
+#define FILE_EXT_TEMP ".tmp"
+
+#define FILE_JOURNAL_RATIO 4
+#define FILE_JOURNAL_MIN (64 << 10)
+#define FILE_JOURNAL_RECORD 48
+
+#define FILE_BINARY_MAGIC "HEXB"
+#define FILE_BINARY_VERSION 2
+#define FILE_BINARY_HEADER 8
+#define FILE_BINARY_TRAILER 16
+#define FILE_BINARY_END 0xFF
+
+/* chart tag byte [s3s2s1 t c4c3c2c1]:
+ *  c - offset from the parent, 3*(dp + 1) + (dq + 1)
+ *  t - a tile word follows
+ *  s - level step from the previous chart plus one, or 7 if a varint level follows
+ */
+#define FILE_TAG_TILE 0x10
+#define FILE_TAG_STEP_SHIFT 5
+#define FILE_TAG_STEP_LEVEL 7
+
+#define FILE_TILED_MAGIC "HEXT"
+#define FILE_TILED_VERSION 3
+#define FILE_TILED_LEVEL 4      /* blocks of up to 9^4 tiles, a few screens' worth */
+#define FILE_TILED_TRAILER 8
+
+#define FILE_VERSION_SUMS 2     /* the first binary and tiled version to carry checksums */
+#define FILE_VERSION_HASHES 3   /* the first tiled version to carry block hashes */
+
+#define FILE_CSV_HEADER "kind,p,q,terrain,seed,roads,rivers,location"
+#define FILE_CSV_COLUMNS 16
+#define FILE_CSV_NAME 16
+#define FILE_RECORD_SPLIT " ,\"\t"   /* between the directions of a road or river list */
+
+#define FILE_BUFFER_SIZE (1 << 20)
+#define FILE_ERROR_SIZE 128
+#define FILE_PARALLEL_THRESHOLD (8 << 20)
+#define FILE_SPLIT_LEVEL 4      /* subtrees of up to 9^4 tiles are written whole by one thread */
+#define FILE_SPLIT_WAVE 4       /* subtrees in memory at once, per thread */
+
 /*==========================================================
- *  WRITE
+ *  BUFFER
  *========================================================*/
 
-void write_coordinate(FILE *file, struct Coordinate c)
+struct Buffer
 {
-    if (!file) return;
+    FILE *file;
+    struct Compressor *compressor;
+    unsigned char *memory;
+    size_t memory_len, memory_cap;
+    uint64_t flushed;
+    size_t len;
+    uint32_t crc;               /* of the bytes flushed since the last sum */
+    size_t summed;              /* bytes at the front of data already in the last sum */
+    bool ok;
+    unsigned char data[FILE_BUFFER_SIZE];
+};
 
-    int32_t p = coordinate_p(c),
-            q = coordinate_q(c),
-            r = coordinate_r(c);
-    uint32_t m = coordinate_m(c);
 
-    fprintf(
-        file,
-        "%d%c%d%c%d%c%u%c",
-        p, FILE_SEP_MIN,
-        q, FILE_SEP_MIN,
-        r, FILE_SEP_MIN,
-        m, FILE_SEP_MIN
-    );
+/* a buffer flushing to the file, through the compressor if there is one, or else to memory */
+struct Buffer *buffer_create(FILE *file, struct Compressor *compressor)
+{
+    struct Buffer *buffer = malloc(sizeof(struct Buffer));
+
+    buffer->file = file;
+    buffer->compressor = compressor;
+    buffer->memory = NULL;
+    buffer->memory_len = 0;
+    buffer->memory_cap = 0;
+    buffer->flushed = 0;
+    buffer->len = 0;
+    buffer->crc = 0;
+    buffer->summed = 0;
+    buffer->ok = true;
+    return buffer;
+}
+
+
+void buffer_sink(struct Buffer *buffer, const unsigned char *data, size_t len)
+{
+    if (buffer->compressor) {
+        compressor_write(buffer->compressor, data, len);
+    } else if (buffer->file) {
+        if (len && (fwrite(data, 1, len, buffer->file) != len)) buffer->ok = false;
+    } else if (len) {
+        if (buffer->memory_len + len > buffer->memory_cap) {
+            size_t cap = (buffer->memory_cap) ? 2*buffer->memory_cap : FILE_BUFFER_SIZE;
+            while (cap < buffer->memory_len + len) cap *= 2;
+            buffer->memory = realloc(buffer->memory, cap);
+            buffer->memory_cap = cap;
+        }
+        memcpy(buffer->memory + buffer->memory_len, data, len);
+        buffer->memory_len += len;
+    }
+    buffer->flushed += len;
+}
+
+
+/* the checksum is taken as the bytes go out, while they are still in cache */
+void buffer_flush(struct Buffer *buffer)
+{
+    buffer->crc = checksum_update(buffer->crc, buffer->data + buffer->summed, buffer->len - buffer->summed);
+    buffer_sink(buffer, buffer->data, buffer->len);
+    buffer->len = 0;
+    buffer->summed = 0;
+}
+
+
+/* move everything a memory buffer holds onto the end of another, emptying it for reuse;
+ * its checksum is joined on rather than taken again */
+void buffer_append(struct Buffer *buffer, struct Buffer *from)
+{
+    buffer_flush(from);
+    buffer_flush(buffer);
+    buffer_sink(buffer, from->memory, from->memory_len);
+    buffer->crc = checksum_combine(buffer->crc, from->crc, from->memory_len);
+    from->memory_len = 0;
+    from->flushed = 0;
+    from->crc = 0;
+}
+
+
+/* the checksum of everything written since the last call, starting the next section */
+uint32_t buffer_sum(struct Buffer *buffer)
+{
+    uint32_t crc = checksum_update(buffer->crc, buffer->data + buffer->summed, buffer->len - buffer->summed);
+    buffer->crc = 0;
+    buffer->summed = buffer->len;
+    return crc;
+}
+
+
+/* bytes written so far, before any compression */
+uint64_t buffer_tell(const struct Buffer *buffer)
+{
+    return buffer->flushed + buffer->len;
+}
+
+
+/* flush, free and report whether everything reached the file */
+bool buffer_destroy(struct Buffer *buffer)
+{
+    buffer_flush(buffer);
+    bool ok = buffer->ok;
+    if (buffer->compressor) ok = compressor_finish(buffer->compressor) && ok;
+    free(buffer->memory);
+    free(buffer);
+    return ok;
+}
+
+
+static inline void buffer_reserve(struct Buffer *buffer, size_t n)
+{
+    if (buffer->len + n > FILE_BUFFER_SIZE) buffer_flush(buffer);
+}
+
+
+static inline void buffer_putc(struct Buffer *buffer, unsigned char c)
+{
+    buffer_reserve(buffer, 1);
+    buffer->data[buffer->len++] = c;
+}
+
+
+static inline void buffer_puts(struct Buffer *buffer, const char *str, size_t n)
+{
+    buffer_reserve(buffer, n);
+    memcpy(buffer->data + buffer->len, str, n);
+    buffer->len += n;
+}
+
+
+/* decimal digits written back to front, as printf's %u would */
+static inline void buffer_put_uint(struct Buffer *buffer, uint64_t v)
+{
+    char digits[20];
+    int n = 0;
+
+    do {
+        digits[sizeof(digits) - (++n)] = '0' + (char)(v % 10);
+        v /= 10;
+    } while (v);
+
+    buffer_puts(buffer, digits + sizeof(digits) - n, n);
+}
+
+
+static inline void buffer_put_int(struct Buffer *buffer, int64_t v)
+{
+    if (v < 0) {
+        buffer_putc(buffer, '-');
+        buffer_put_uint(buffer, -(uint64_t)v);
+    } else {
+        buffer_put_uint(buffer, (uint64_t)v);
+    }
+}
+
+
+static inline void buffer_put_varint(struct Buffer *buffer, uint64_t v)
+{
+    buffer_reserve(buffer, 10);
+    while (v >= 0x80) {
+        buffer->data[buffer->len++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    buffer->data[buffer->len++] = (unsigned char)v;
+}
+
+
+static inline void buffer_put_zigzag(struct Buffer *buffer, int64_t v)
+{
+    buffer_put_varint(buffer, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+}
+
+
+static inline void buffer_put_u16(struct Buffer *buffer, uint16_t v)
+{
+    buffer_reserve(buffer, 2);
+    buffer->data[buffer->len++] = (unsigned char)v;
+    buffer->data[buffer->len++] = (unsigned char)(v >> 8);
+}
+
+
+static inline void buffer_put_u32(struct Buffer *buffer, uint32_t v)
+{
+    buffer_put_u16(buffer, (uint16_t)v);
+    buffer_put_u16(buffer, (uint16_t)(v >> 16));
+}
+
+/*==========================================================
+ *  SPLIT
+ *========================================================*/
+
+/*
+ *  The depth first chart order cut into pieces that can be written on separate threads:
+ *  the charts above FILE_SPLIT_LEVEL one record at a time, and everything below whole.
+ *  Each piece fills its own memory buffer, and the buffers are appended in order, so the
+ *  output is the same as writing the tree in one go.
+ */
+struct Segment
+{
+    const struct Chart *chart;
+    const struct Chart *parent;
+    uint32_t level;             /* of the chart written before, which binary tags count from */
+    bool subtree;
+};
+
+
+struct Split
+{
+    struct Segment *segments;
+    size_t len, cap, base;
+    uint32_t level;
+    struct Buffer **buffers;
+    void (*write)(struct Buffer *, const struct Segment *);
+};
+
+
+/* the level of the last chart a subtree writes, depth first */
+uint32_t split_last_level(const struct Chart *chart)
+{
+    while (chart_has_children(chart)) {
+        const struct Chart *last = NULL;
+        for (int i = NUM_CHILDREN - 1; (i >= 0) && !last; i--) last = chart_child(chart, i);
+        if (!last) break;
+        chart = last;
+    }
+    return coordinate_m(chart_coordinate(chart));
+}
+
+
+void split_charts(struct Split *split, const struct Chart *chart, const struct Chart *parent)
+{
+    if (!chart) return;
+
+    uint32_t m = coordinate_m(chart_coordinate(chart));
+    bool subtree = (m <= FILE_SPLIT_LEVEL) || !chart_has_children(chart);
+
+    if (split->len == split->cap) {
+        split->cap = (split->cap) ? 2*split->cap : 256;
+        split->segments = realloc(split->segments, split->cap * sizeof(struct Segment));
+    }
+    split->segments[split->len++] = (struct Segment){ chart, parent, split->level, subtree };
+    split->level = (subtree) ? split_last_level(chart) : m;
+
+    if (subtree) return;
+    for (int i = 0; i < NUM_CHILDREN; i++) split_charts(split, chart_child(chart, i), chart);
+}
+
+
+void split_job(size_t i, void *data)
+{
+    struct Split *split = data;
+    split->write(split->buffers[i], &split->segments[split->base + i]);
+}
+
+
+/* write the tree below root with write, spread over the thread pool when it is worth it */
+void write_split(struct Buffer *buffer, const struct Chart *root, void (*write)(struct Buffer *, const struct Segment *))
+{
+    struct Segment whole = { root, NULL, 0, true };
+    unsigned int threads = parallel_threads();
+
+    if (!root || (threads < 2) || (coordinate_m(chart_coordinate(root)) <= FILE_SPLIT_LEVEL)) {
+        write(buffer, &whole);
+        return;
+    }
+
+    struct Split split = { .write = write };
+    split_charts(&split, root, NULL);
+
+    size_t wave = threads * FILE_SPLIT_WAVE;
+    split.buffers = malloc(wave * sizeof(struct Buffer *));
+    for (size_t i = 0; i < wave; i++) split.buffers[i] = buffer_create(NULL, NULL);
+
+    for (split.base = 0; split.base < split.len; split.base += wave) {
+        size_t n = (split.len - split.base < wave) ? split.len - split.base : wave;
+        parallel_for(n, split_job, &split);
+        for (size_t i = 0; i < n; i++) buffer_append(buffer, split.buffers[i]);
+    }
+
+    for (size_t i = 0; i < wave; i++) buffer_destroy(split.buffers[i]);
+    free(split.buffers);
+    free(split.segments);
 }
 
-void write_location(FILE *file, const struct Location *location)
+/*==========================================================
+ *  WRITE
+ *========================================================*/
+
+void write_coordinate(struct Buffer *buffer, struct Coordinate c)
 {
-    if (!file || !location) return;
+    buffer_put_int(buffer, coordinate_p(c));
+    buffer_putc(buffer, FILE_SEP_MIN);
+    buffer_put_int(buffer, coordinate_q(c));
+    buffer_putc(buffer, FILE_SEP_MIN);
+    buffer_put_int(buffer, coordinate_r(c));
+    buffer_putc(buffer, FILE_SEP_MIN);
+    buffer_put_uint(buffer, coordinate_m(c));
+    buffer_putc(buffer, FILE_SEP_MIN);
+}
 
-    write_coordinate(file, location_coordinate(location));
-    fputc(FILE_SEP_MAJ, file);
-    fprintf(file, "%d", location_type(location));
+void write_location_fields(struct Buffer *buffer, struct Coordinate c, enum LOCATION t)
+{
+    write_coordinate(buffer, c);
+    buffer_putc(buffer, FILE_SEP_MAJ);
+    buffer_put_int(buffer, t);
 }
 
-void write_tile(FILE *file, const struct Tile *tile)
+void write_location(struct Buffer *buffer, const struct Location *location)
 {
-    if (!file || !tile) return;
+    if (!location) return;
+
+    write_location_fields(buffer, location_coordinate(location), location_type(location));
+}
 
-    fprintf(file, "%u", tile_seed(tile));
-    fputc(FILE_SEP_MED, file);
-    fprintf(file, "%d", tile_terrain(tile));
-    fputc(FILE_SEP_MED, file);
+void write_tile_fields(struct Buffer *buffer, uint32_t seed, int terrain, uint8_t roads, uint8_t rivers)
+{
+    buffer_put_uint(buffer, seed);
+    buffer_putc(buffer, FILE_SEP_MED);
+    buffer_put_int(buffer, terrain);
+    buffer_putc(buffer, FILE_SEP_MED);
 
     /* road byte [..r6r5r4r3r2r1] */
-    fprintf(file, "%d", tile_roads(tile));
-    fputc(FILE_SEP_MED, file);
+    buffer_put_uint(buffer, roads);
+    buffer_putc(buffer, FILE_SEP_MED);
 
     /* river byte [..r6r5r4r3r2r1] */
-    fprintf(file, "%d", tile_rivers(tile));
-    fputc(FILE_SEP_MED, file);
+    buffer_put_uint(buffer, rivers);
+    buffer_putc(buffer, FILE_SEP_MED);
+}
+
+void write_tile(struct Buffer *buffer, const struct Tile *tile)
+{
+    if (!tile) return;
+
+    write_tile_fields(buffer, tile_seed(tile), tile_terrain(tile), tile_roads(tile), tile_rivers(tile));
 }
 
-void write_chart(FILE *file, const struct Chart *chart)
+void write_chart_record(struct Buffer *buffer, const struct Chart *chart)
 {
-    if (!file || !chart) return;
-    write_coordinate(file, chart_coordinate(chart));
+    write_coordinate(buffer, chart_coordinate(chart));
 
     if (chart_tile(chart)) {
-        fputc(FILE_SEP_MAJ, file);
-        write_tile(file, chart_tile(chart));
+        buffer_putc(buffer, FILE_SEP_MAJ);
+        write_tile(buffer, chart_tile(chart));
     }
-    fputc('\n', file);
+    buffer_putc(buffer, '\n');
+}
+
+void write_chart(struct Buffer *buffer, const struct Chart *chart)
+{
+    if (!chart) return;
+    write_chart_record(buffer, chart);
 
     if (!chart_has_children(chart)) return;
-    for (int i = 0; i < NUM_CHILDREN; i++) write_chart(file, chart_child(chart, i));
+    for (int i = 0; i < NUM_CHILDREN; i++) write_chart(buffer, chart_child(chart, i));
+}
+
+void write_chart_segment(struct Buffer *buffer, const struct Segment *segment)
+{
+    if (segment->subtree) write_chart(buffer, segment->chart);
+    else write_chart_record(buffer, segment->chart);
 }
 
-void write_directory(FILE *file, struct Directory *directory)
+void write_directory(struct Buffer *buffer, struct Directory *directory)
 {
     struct Directory *curr = directory;
 
     while (curr) {
-        write_location(file, directory_location(curr));
-        fputc('\n', file);
+        write_location(buffer, directory_location(curr));
+        buffer_putc(buffer, '\n');
         curr = directory_next(curr);
     }
 }
 
-void write_atlas(FILE *file, const struct Atlas *atlas)
+/* the sums marker up front says the file ends in checksums, so one cut short is caught */
+void write_text_head(struct Buffer *buffer)
+{
+    buffer_puts(buffer, FILE_MARKER_SUMS "\n", sizeof(FILE_MARKER_SUMS));
+    buffer_puts(buffer, FILE_MARKER_ROOT "\n", sizeof(FILE_MARKER_ROOT));
+    buffer_sum(buffer);
+}
+
+
+/* ends the chart section, returning its checksum, and starts the location section */
+uint32_t write_text_curr(struct Buffer *buffer, struct Coordinate c)
+{
+    uint32_t charts = buffer_sum(buffer);
+
+    buffer_puts(buffer, FILE_MARKER_CURR "\n", sizeof(FILE_MARKER_CURR));
+    buffer_sum(buffer);
+    write_coordinate(buffer, c);
+    buffer_putc(buffer, '\n');
+    buffer_puts(buffer, FILE_MARKER_LOCN "\n", sizeof(FILE_MARKER_LOCN));
+    return charts;
+}
+
+
+/* expected format, after the null marker:
+ *  [CHARTS];[LOCATIONS];
+ */
+void write_text_sums(struct Buffer *buffer, uint32_t charts)
+{
+    uint32_t locations = buffer_sum(buffer);
+
+    buffer_puts(buffer, FILE_MARKER_NULL "\n", sizeof(FILE_MARKER_NULL));
+    buffer_put_uint(buffer, charts);
+    buffer_putc(buffer, FILE_SEP_MED);
+    buffer_put_uint(buffer, locations);
+    buffer_putc(buffer, FILE_SEP_MED);
+    buffer_putc(buffer, '\n');
+}
+
+
+void write_text(struct Buffer *buffer, const struct Atlas *atlas)
+{
+    write_text_head(buffer);
+    write_split(buffer, atlas_root(atlas), write_chart_segment);
+    uint32_t charts = write_text_curr(buffer, atlas_coordinate(atlas));
+    write_directory(buffer, atlas_directory(atlas));
+    write_text_sums(buffer, charts);
+}
+
+bool write_atlas(FILE *file, const struct Atlas *atlas)
 {
-    if (!file || !atlas) return;
+    if (!file || !atlas || !atlas_load_all(atlas)) return false;
 
-    fprintf(file, FILE_MARKER_ROOT "\n");
-    write_chart(file, atlas_root(atlas));
-    fprintf(file, FILE_MARKER_CURR "\n");
-    write_coordinate(file, atlas_coordinate(atlas));
-    fputc('\n', file);
-    fprintf(file, FILE_MARKER_LOCN "\n");
-    write_directory(file, atlas_directory(atlas));
+    struct Buffer *buffer = buffer_create(file, NULL);
+    write_text(buffer, atlas);
+    return buffer_destroy(buffer);
 }
 
 void write_state(FILE *file)
@@ -120,138 +523,3056 @@ void write_state(FILE *file)
  *  READ
  *========================================================*/
 
-struct Coordinate read_coordinate(char *str)
+char file_error_message[FILE_ERROR_SIZE] = { 0 };
+
+
+/* what went wrong with the last load, or NULL */
+const char *file_error(void)
+{
+    return (file_error_message[0]) ? file_error_message : NULL;
+}
+
+
+struct Scanner
 {
-    if (!str) return (struct Coordinate) { 0 };
+    const char *at;
+    const char *end;
+    size_t line;
+    const char *error;
+};
 
-    char *str_p = str;
-    char *str_q = strchrnul(str_p, FILE_SEP_MIN);
-    *(str_q++) = '\0';
-    char *str_r = strchrnul(str_q, FILE_SEP_MIN);
-    *(str_r++) = '\0';
-    char *str_m = strchrnul(str_r, FILE_SEP_MIN);
-    *(str_m++) = '\0';
-    char *str_end = strchrnul(str_m, FILE_SEP_MIN);
-    *str_end = '\0';
 
-    int32_t p = strtol(str_p, NULL, 10),
-        q = strtol(str_q, NULL, 10), r = strtol(str_r, NULL, 10);
-    uint32_t m = (uint32_t)strtol(str_m, NULL, 10);
+bool file_fail(const char *what)
+{
+    snprintf(file_error_message, FILE_ERROR_SIZE, "%s", what);
+    return false;
+}
 
-    return coordinate(p, q, r, m);
+
+/* failures are kept on the scanner so chunks can be scanned on any thread */
+bool scan_fail(struct Scanner *scanner, const char *what)
+{
+    if (!scanner->error) scanner->error = what;
+    return false;
 }
 
-/* expected format:
- *  [SEED];[TERRAIN];[ROADS];[RIVERS]
- */
-struct Tile *read_tile(char *str)
+
+bool scan_report(const struct Scanner *scanner, size_t line)
 {
-    if (!str || strlen(str) == 0) return NULL;
+    snprintf(file_error_message, FILE_ERROR_SIZE, "line %zu: %s", line, scanner->error);
+    return false;
+}
 
-    char *str_seed = str;
-    char *str_terrain = strchrnul(str_seed, FILE_SEP_MED);
-    *(str_terrain++) = '\0';
-    char *str_roads = strchrnul(str_terrain, FILE_SEP_MED);
-    *(str_roads++) = '\0';
-    char *str_rivers = strchrnul(str_roads, FILE_SEP_MED);
-    *(str_rivers++) = '\0';
-    char *str_end = strchrnul(str_rivers, FILE_SEP_MED);
-    *str_end = '\0';
 
-    struct Tile *tile = tile_create();
+/* a save's section checksums, as stored in it or as taken over what it holds */
+struct Sums
+{
+    uint32_t charts;
+    uint32_t locations;
+};
 
-    tile_set_seed(tile, strtol(str_seed, NULL, 10));
-    tile_set_terrain(tile, (enum TERRAIN)strtol(str_terrain, NULL, 10));
 
-    uint8_t roads = strtol(str_roads, NULL, 10);
-    uint8_t rivers = strtol(str_rivers, NULL, 10);
+struct Piece
+{
+    const unsigned char *data;
+    size_t len;
+    uint32_t crc;
+};
 
-    tile_set_roads(tile, roads);
-    tile_set_rivers(tile, rivers);
 
-    return tile;
+void sum_piece(size_t i, void *data)
+{
+    struct Piece *piece = (struct Piece *)data + i;
+    piece->crc = checksum_update(0, piece->data, piece->len);
 }
 
-struct Chart *read_chart(char *line)
+
+/* the checksum of a section, taken in pieces on the worker pool when it is large */
+uint32_t sum_section(const void *data, size_t len)
 {
-    if (!line) return NULL;
+    size_t n = (len >= FILE_PARALLEL_THRESHOLD) ? parallel_threads() : 1;
+    if (n <= 1) return checksum_update(0, data, len);
 
-    char *str_coordinate = line;
-    char *str_tile = strchrnul(str_coordinate, FILE_SEP_MAJ);
-    *(str_tile++) = '\0';
+    struct Piece *pieces = malloc(n * sizeof(struct Piece));
+    size_t step = len / n;
+    for (size_t i = 0; i < n; i++) {
+        pieces[i].data = (const unsigned char *)data + i*step;
+        pieces[i].len = (i + 1 < n) ? step : len - i*step;
+    }
+    parallel_for(n, sum_piece, pieces);
 
-    struct Coordinate c = read_coordinate(str_coordinate);
-    struct Chart *chart = chart_create(c);
-    chart_clear_tile(chart);
-    chart_set_tile(chart, read_tile(str_tile));
-    return chart;
+    uint32_t crc = 0;
+    for (size_t i = 0; i < n; i++) crc = checksum_combine(crc, pieces[i].crc, pieces[i].len);
+    free(pieces);
+    return crc;
+}
+
+
+bool sums_check(struct Sums want, struct Sums got)
+{
+    if (want.charts != got.charts) return file_fail("chart section checksum mismatch");
+    if (want.locations != got.locations) return file_fail("location section checksum mismatch");
+    return true;
+}
+
+
+static inline bool scan_char(struct Scanner *scanner, char c)
+{
+    if ((scanner->at >= scanner->end) || (*scanner->at != c)) return false;
+    scanner->at++;
+    return true;
 }
 
 
-struct Location *read_location(char *line)
+static inline bool scan_int(struct Scanner *scanner, int64_t lo, int64_t hi, int64_t *out)
 {
-    char *str_coordinate = line;
-    char *str_location = strchrnul(str_coordinate, FILE_SEP_MAJ);
-    *(str_location++) = '\0';
+    bool negative = scan_char(scanner, '-');
+    const char *start = scanner->at;
+    uint64_t v = 0;
+
+    while ((scanner->at < scanner->end) && ((unsigned char)(*scanner->at - '0') < 10)) {
+        v = 10*v + (uint64_t)(*(scanner->at++) - '0');
+        if (v > ((uint64_t)1 << 40)) return false;
+    }
+    if (scanner->at == start) return false;
 
-    struct Coordinate c = read_coordinate(str_coordinate);
-    enum LOCATION t = (enum LOCATION) strtol(str_location, NULL, 10);
-    struct Location *location = location_create(c, t);
-    return location;
+    int64_t x = (negative) ? -(int64_t)v : (int64_t)v;
+    if ((x < lo) || (x > hi)) return false;
+
+    *out = x;
+    return true;
 }
 
 
-struct Atlas *read_atlas(FILE *file)
+bool scan_line_end(struct Scanner *scanner)
 {
-    struct Atlas *atlas = atlas_create();
+    scan_char(scanner, '\r');
+    if (scanner->at < scanner->end && !scan_char(scanner, '\n')) return false;
+    scanner->line++;
+    return true;
+}
 
-    char *buf = malloc(LINE_MAX);
-    memset(buf, 0, LINE_MAX);
 
-    char *line = NULL;
-    size_t len = 0;
-    ssize_t nread = 0;
+void scan_skip_line(struct Scanner *scanner)
+{
+    const char *eol = memchr(scanner->at, '\n', scanner->end - scanner->at);
+    scanner->at = (eol) ? eol + 1 : scanner->end;
+    scanner->line++;
+}
+
+
+bool scan_blank(struct Scanner *scanner)
+{
+    if ((scanner->at < scanner->end) && (*scanner->at != '\n') && (*scanner->at != '\r')) return false;
+    return scan_line_end(scanner);
+}
+
+
+/* consume the line if it is exactly the marker */
+bool scan_marker(struct Scanner *scanner, const char *marker)
+{
+    size_t n = strlen(marker);
+    if (((size_t)(scanner->end - scanner->at) < n) || memcmp(scanner->at, marker, n)) return false;
+
+    struct Scanner after = { scanner->at + n, scanner->end, scanner->line, NULL };
+    if (!scan_line_end(&after)) return false;
+
+    *scanner = after;
+    return true;
+}
+
+
+/* scan_marker, noting where the line starts, which is where the section before it ends */
+bool scan_section_end(struct Scanner *scanner, const char *marker, const char **end)
+{
+    const char *at = scanner->at;
+    if (!scan_marker(scanner, marker)) return false;
+
+    *end = at;
+    return true;
+}
+
+
+/* expected format:
+ *  [P],[Q],[R],[M],
+ */
+bool read_coordinate(struct Scanner *scanner, struct Coordinate *c)
+{
+    int64_t p, q, r, m;
 
-    /* read in charts */
-    while ((nread = getline(&line, &len, file)) > 0) {
-        if (line[nread - 1] == '\n') line[nread - 1] = '\0';
-        if (strcmp(line, FILE_MARKER_CURR) == 0) break;
-        atlas_insert(atlas, read_chart(line));
+    if (!scan_int(scanner, INT32_MIN, INT32_MAX, &p) || !scan_char(scanner, FILE_SEP_MIN)
+        || !scan_int(scanner, INT32_MIN, INT32_MAX, &q) || !scan_char(scanner, FILE_SEP_MIN)
+        || !scan_int(scanner, INT32_MIN, INT32_MAX, &r) || !scan_char(scanner, FILE_SEP_MIN)
+        || !scan_int(scanner, 0, ATLAS_MAX_LEVEL - 2, &m)) {
+        return scan_fail(scanner, "malformed coordinate");
     }
+    scan_char(scanner, FILE_SEP_MIN);
 
-    /* set the current coordinate */
-    while (fgets(buf, LINE_MAX, file)) {
-        if (strcmp(buf, FILE_MARKER_LOCN "\n") == 0) break;
-        atlas_goto(atlas, read_coordinate(buf));
+    if (p + q + r != 0) return scan_fail(scanner, "coordinate does not satisfy p + q + r = 0");
+
+    *c = coordinate((int32_t)p, (int32_t)q, (int32_t)r, (uint32_t)m);
+    return true;
+}
+
+
+/* a chart line as parsed, before any chart is made for it */
+struct Record
+{
+    struct Coordinate coordinate;
+    uint32_t seed;
+    uint8_t terrain;
+    uint8_t roads;
+    uint8_t rivers;
+    bool tile;
+};
+
+
+/* expected format:
+ *  [SEED];[TERRAIN];[ROADS];[RIVERS];
+ */
+bool read_tile(struct Scanner *scanner, struct Record *record)
+{
+    int64_t seed, terrain, roads, rivers;
+
+    if (!scan_int(scanner, 0, UINT32_MAX, &seed) || !scan_char(scanner, FILE_SEP_MED)
+        || !scan_int(scanner, 0, TERRAIN_TUNDRA, &terrain) || !scan_char(scanner, FILE_SEP_MED)
+        || !scan_int(scanner, 0, UINT8_MAX, &roads) || !scan_char(scanner, FILE_SEP_MED)
+        || !scan_int(scanner, 0, UINT8_MAX, &rivers)) {
+        return scan_fail(scanner, "malformed tile");
     }
+    scan_char(scanner, FILE_SEP_MED);
 
-    /* read in locations */
-    while (fgets(buf, LINE_MAX, file)) {
-        if (strcmp(buf, FILE_MARKER_NULL "\n") == 0) break;
-        atlas_add_location(atlas, read_location(buf));
+    record->seed = (uint32_t)seed;
+    record->terrain = (uint8_t)terrain;
+    record->roads = (uint8_t)roads;
+    record->rivers = (uint8_t)rivers;
+    record->tile = true;
+    return true;
+}
+
+
+bool read_record(struct Scanner *scanner, struct Record *record)
+{
+    if (!read_coordinate(scanner, &record->coordinate)) return false;
+    record->tile = false;
+
+    if (scan_char(scanner, FILE_SEP_MAJ)) {
+        if (coordinate_m(record->coordinate) != 0) {
+            return scan_fail(scanner, "tile given for a chart above level 0");
+        }
+        if (!read_tile(scanner, record)) return false;
     }
 
-    free(buf);
-    free(line);
-    return atlas;
+    if (!scan_line_end(scanner)) return scan_fail(scanner, "unexpected text at end of line");
+    return true;
 }
 
 
-void read_state(FILE *file)
+struct Chart *record_chart(const struct Record *record)
 {
-    if (!file) return;
+    struct Chart *chart = chart_create(record->coordinate);
+    struct Tile *tile = chart_tile(chart);
+
+    if (!record->tile) {
+        chart_clear_tile(chart);
+    } else {
+        tile_set_seed(tile, record->seed);
+        tile_set_terrain(tile, (enum TERRAIN)record->terrain);
+        tile_set_roads(tile, record->roads);
+        tile_set_rivers(tile, record->rivers);
+    }
 
-    char *buf = malloc(LINE_MAX);
-    memset(buf, 0, LINE_MAX);
+    return chart;
+}
 
-    /* advance to 'chart' marker */
-    while (fgets(buf, LINE_MAX, file)) {
-        if (strcmp(buf, FILE_MARKER_ROOT "\n") == 0) break;
+
+struct Location *read_location(struct Scanner *scanner)
+{
+    struct Coordinate c;
+    int64_t t;
+
+    if (!read_coordinate(scanner, &c)) return NULL;
+    if (!scan_char(scanner, FILE_SEP_MAJ) || !scan_int(scanner, LOCATION_NONE, LOCATION_DUNGEON, &t)
+        || !scan_line_end(scanner)) {
+        scan_fail(scanner, "malformed location");
+        return NULL;
     }
-    struct Atlas *atlas = read_atlas(file);
 
-    state_clear_atlas();
-    state_set_atlas(atlas);
+    return location_create(c, (enum LOCATION)t);
+}
+
+
+/* expected format, after the null marker:
+ *  [CHARTS];[LOCATIONS];
+ */
+bool read_text_sums(struct Scanner *scanner, struct Sums *sums)
+{
+    int64_t charts, locations;
+
+    if (!scan_int(scanner, 0, UINT32_MAX, &charts) || !scan_char(scanner, FILE_SEP_MED)
+        || !scan_int(scanner, 0, UINT32_MAX, &locations) || !scan_char(scanner, FILE_SEP_MED)) {
+        return false;
+    }
+
+    sums->charts = (uint32_t)charts;
+    sums->locations = (uint32_t)locations;
+    return true;
+}
+
+
+/*
+ *  A text save starting with the sums marker must end with the sums, after the null
+ *  marker at tail. The location section runs from middle, the line after the current
+ *  marker, up to tail.
+ */
+bool read_text_check(struct Scanner *scanner, const char *middle, const char *tail, struct Sums sums)
+{
+    struct Sums want;
+    if (!tail || !read_text_sums(scanner, &want)) return file_fail("missing checksums, the file may be cut short");
+
+    sums.locations = sum_section(middle, (size_t)(tail - middle));
+    return sums_check(want, sums);
+}
+
+
+/* locations are gathered as they are read and attached to the atlas all at once */
+void locations_push(struct Location ***locations, size_t *len, size_t *cap, struct Location *location)
+{
+    if (*len == *cap) {
+        *cap = (*cap) ? 2*(*cap) : 64;
+        *locations = realloc(*locations, (*cap) * sizeof(struct Location *));
+    }
+    (*locations)[(*len)++] = location;
+}
+
+
+/* a newline aligned slice of the chart section and the charts made from it, in order */
+struct Chunk
+{
+    const char *start;
+    const char *end;
+    struct Chart **charts;
+    size_t len;
+    size_t cap;
+    size_t lines;
+    uint32_t crc;
+    struct Scanner failure;
+};
+
+
+void read_chunk(size_t i, void *data)
+{
+    struct Chunk *chunk = (struct Chunk *)data + i;
+    struct Scanner scanner = { chunk->start, chunk->end, 0, NULL };
+    struct Record record;
+
+    while (scanner.at < scanner.end) {
+        if (scan_blank(&scanner)) continue;
+        if (!read_record(&scanner, &record)) {
+            chunk->failure = scanner;
+            return;
+        }
+
+        if (chunk->len == chunk->cap) {
+            chunk->cap = (chunk->cap) ? 2*chunk->cap : 1024;
+            chunk->charts = realloc(chunk->charts, chunk->cap * sizeof(struct Chart *));
+        }
+        chunk->charts[chunk->len++] = record_chart(&record);
+    }
+
+    chunk->lines = scanner.line;
+    chunk->crc = checksum_update(0, chunk->start, (size_t)(chunk->end - chunk->start));
+}
+
+
+/* split [start, end) into about n pieces, each ending just after a newline */
+size_t read_split(const char *start, const char *end, size_t n, struct Chunk *chunks)
+{
+    size_t len = 0;
+    size_t step = (size_t)(end - start) / n + 1;
+
+    while (start < end) {
+        const char *cut = (step < (size_t)(end - start)) ? start + step : end;
+        const char *eol = (cut < end) ? memchr(cut, '\n', end - cut) : NULL;
+        cut = (eol) ? eol + 1 : end;
+
+        chunks[len++] = (struct Chunk) { .start = start, .end = cut };
+        start = cut;
+    }
+
+    return len;
+}
+
+
+/* charts are linked by the pre-order builder until one arrives out of save order (a hand
+ * edited file), after which the rest of the tiles are inserted one by one */
+struct Assembly
+{
+    struct Builder *builder;
+    struct Atlas *atlas;
+};
+
+
+void assembly_add(struct Assembly *assembly, struct Chart *chart)
+{
+    if (assembly->builder && builder_add(assembly->builder, chart)) return;
+    if (assembly->builder) {
+        assembly->atlas = builder_finish(assembly->builder);
+        assembly->builder = NULL;
+    }
+
+    /* the charts above each tile are recreated as it is inserted */
+    if (chart_has_children(chart) || atlas_find(assembly->atlas, chart_coordinate(chart))) chart_destroy(chart);
+    else atlas_insert(assembly->atlas, chart);
+}
+
+
+/* parse the chart section on the worker pool when it is large enough to be worth it, then
+ * link the charts together in file order; each chunk's checksum is taken by the thread that
+ * parsed it and joined onto the section's */
+bool read_charts(struct Scanner *scanner, struct Atlas **atlas, uint32_t *crc)
+{
+    const char *start = scanner->at, *end = scanner->end;
+    /* the root marker's newline is just before start, so an empty section is found too */
+    const char *curr = memmem(start - 1, end - start + 1, "\n" FILE_MARKER_CURR, sizeof(FILE_MARKER_CURR));
+    if (curr) end = curr + 1;
+
+    size_t n = 1;
+    if ((size_t)(end - start) >= FILE_PARALLEL_THRESHOLD) n = 4 * parallel_threads();
+
+    struct Chunk *chunks = calloc(n, sizeof(struct Chunk));
+    n = read_split(start, end, n, chunks);
+    parallel_for(n, read_chunk, chunks);
+
+    struct Assembly assembly = { builder_create(), NULL };
+    size_t line = scanner->line;
+    bool ok = true;
+    *crc = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        *crc = checksum_combine(*crc, chunks[i].crc, (uint64_t)(chunks[i].end - chunks[i].start));
+        for (size_t k = 0; k < chunks[i].len; k++) {
+            if (ok) assembly_add(&assembly, chunks[i].charts[k]);
+            else chart_destroy(chunks[i].charts[k]);
+        }
+        if (ok && chunks[i].failure.error) ok = scan_report(&chunks[i].failure, line + chunks[i].failure.line);
+        line += chunks[i].lines;
+        free(chunks[i].charts);
+    }
+    free(chunks);
+
+    if (assembly.builder) assembly.atlas = builder_finish(assembly.builder);
+    if (ok && !atlas_root(assembly.atlas)) ok = file_fail("no charts before " FILE_MARKER_CURR);
+    if (!ok) {
+        atlas_destroy(assembly.atlas);
+        return false;
+    }
+
+    scanner->at = end;
+    scanner->line = line;
+    scan_marker(scanner, FILE_MARKER_CURR);
+
+    *atlas = assembly.atlas;
+    return true;
+}
+
+
+struct Atlas *read_text(const char *data, size_t len)
+{
+    struct Scanner scanner = { data, data + len, 1, NULL };
+    struct Atlas *atlas = NULL;
+    file_error_message[0] = '\0';
+    bool summed = scan_marker(&scanner, FILE_MARKER_SUMS);
+
+    /* advance to 'chart' marker */
+    while (!scan_marker(&scanner, FILE_MARKER_ROOT)) {
+        if (scanner.at >= scanner.end) {
+            file_fail("missing " FILE_MARKER_ROOT);
+            return NULL;
+        }
+        scan_skip_line(&scanner);
+    }
+
+    struct Sums sums = { 0, 0 };
+    if (!read_charts(&scanner, &atlas, &sums.charts)) return NULL;
+    const char *middle = scanner.at, *tail = NULL;
+
+    /* set the current coordinate */
+    while ((scanner.at < scanner.end) && !scan_marker(&scanner, FILE_MARKER_LOCN)) {
+        if (scan_blank(&scanner)) continue;
+
+        struct Coordinate c;
+        bool ok = read_coordinate(&scanner, &c);
+        if (ok && !scan_line_end(&scanner)) ok = scan_fail(&scanner, "unexpected text at end of line");
+        if (!ok) {
+            scan_report(&scanner, scanner.line);
+            atlas_destroy(atlas);
+            return NULL;
+        }
+        atlas_goto(atlas, c);
+    }
+
+    /* read in locations */
+    struct Location **locations = NULL;
+    size_t count = 0, cap = 0;
+    bool ok = true;
+    while (ok && (scanner.at < scanner.end) && !scan_section_end(&scanner, FILE_MARKER_NULL, &tail)) {
+        if (scan_blank(&scanner)) continue;
+
+        struct Location *location = read_location(&scanner);
+        if (location) locations_push(&locations, &count, &cap, location);
+        else ok = scan_report(&scanner, scanner.line);
+    }
+
+    if (ok && summed) ok = read_text_check(&scanner, middle, tail, sums);
+    if (!ok) {
+        for (size_t i = 0; i < count; i++) location_destroy(locations[i]);
+        free(locations);
+        atlas_destroy(atlas);
+        return NULL;
+    }
+
+    atlas_add_locations(atlas, locations, count);
+    free(locations);
+    return atlas;
+}
+
+
+void read_state(FILE *file)
+{
+    if (!file) return;
+
+    char *data = NULL;
+    size_t len = 0, cap = 0, n = 0;
+
+    do {
+        if (len == cap) {
+            cap = (cap) ? 2*cap : FILE_BUFFER_SIZE;
+            data = realloc(data, cap);
+        }
+        len += (n = fread(data + len, 1, cap - len, file));
+    } while (n > 0);
+
+    struct Atlas *atlas = read_text(data, len);
+    free(data);
+    if (!atlas) return;
+
+    state_clear_atlas();
+    state_set_atlas(atlas);
+}
+
+/*==========================================================
+ *  BINARY WRITE
+ *========================================================*/
+
+void write_binary_coordinate(struct Buffer *buffer, struct Coordinate c)
+{
+    buffer_put_varint(buffer, coordinate_m(c));
+    buffer_put_zigzag(buffer, coordinate_p(c));
+    buffer_put_zigzag(buffer, coordinate_q(c));
+}
+
+
+/* tile word [r6..r1 o6..o1 t4..t1] then the seed */
+void write_binary_tile_fields(struct Buffer *buffer, uint32_t seed, int terrain, uint8_t roads, uint8_t rivers)
+{
+    uint16_t word = (terrain & 0x0F) | ((roads & 0x3F) << 4) | ((rivers & 0x3F) << 10);
+
+    buffer_put_u16(buffer, word);
+    buffer_put_u32(buffer, seed);
+}
+
+
+void write_binary_tile(struct Buffer *buffer, const struct Tile *tile)
+{
+    write_binary_tile_fields(buffer, tile_seed(tile), tile_terrain(tile), tile_roads(tile), tile_rivers(tile));
+}
+
+
+/* a chart's tag and whatever placing it needs, without the parent for the root */
+void write_binary_tag(
+    struct Buffer *buffer,
+    struct Coordinate c,
+    const struct Coordinate *parent,
+    bool tile,
+    uint32_t *level
+)
+{
+    uint32_t m = coordinate_m(c);
+    unsigned char tag = (tile) ? FILE_TAG_TILE : 0;
+    uint32_t step = (parent && (m + 1 >= *level)) ? m + 1 - *level : FILE_TAG_STEP_LEVEL;
+    if (step > FILE_TAG_STEP_LEVEL) step = FILE_TAG_STEP_LEVEL;
+
+    if (parent) {
+        tag |= 3*(coordinate_p(c) - 3*coordinate_p(*parent) + 1) + (coordinate_q(c) - 3*coordinate_q(*parent) + 1);
+    }
+    tag |= step << FILE_TAG_STEP_SHIFT;
+
+    buffer_putc(buffer, tag);
+    if (!parent) write_binary_coordinate(buffer, c);
+    else if (step == FILE_TAG_STEP_LEVEL) buffer_put_varint(buffer, m);
+    *level = m;
+}
+
+
+void write_binary_record(
+    struct Buffer *buffer,
+    const struct Chart *chart,
+    const struct Chart *parent,
+    uint32_t *level
+)
+{
+    struct Coordinate up = (parent) ? chart_coordinate(parent) : coordinate_origin();
+
+    write_binary_tag(buffer, chart_coordinate(chart), (parent) ? &up : NULL, chart_tile(chart) != NULL, level);
+    if (chart_tile(chart)) write_binary_tile(buffer, chart_tile(chart));
+}
+
+
+void write_binary_chart(
+    struct Buffer *buffer,
+    const struct Chart *chart,
+    const struct Chart *parent,
+    uint32_t *level
+)
+{
+    if (!chart) return;
+    write_binary_record(buffer, chart, parent, level);
+
+    if (!chart_has_children(chart)) return;
+    for (int i = 0; i < NUM_CHILDREN; i++) {
+        write_binary_chart(buffer, chart_child(chart, i), chart, level);
+    }
+}
+
+
+void write_binary_segment(struct Buffer *buffer, const struct Segment *segment)
+{
+    uint32_t level = segment->level;
+    if (segment->subtree) write_binary_chart(buffer, segment->chart, segment->parent, &level);
+    else write_binary_record(buffer, segment->chart, segment->parent, &level);
+}
+
+
+/* locations are delta coded against the one before */
+void write_binary_location(struct Buffer *buffer, struct Coordinate *last, struct Coordinate c, enum LOCATION t)
+{
+    buffer_put_varint(buffer, coordinate_m(c));
+    buffer_put_zigzag(buffer, (int64_t)coordinate_p(c) - coordinate_p(*last));
+    buffer_put_zigzag(buffer, (int64_t)coordinate_q(c) - coordinate_q(*last));
+    buffer_putc(buffer, t);
+    *last = c;
+}
+
+
+void write_binary_locations(struct Buffer *buffer, const struct Atlas *atlas)
+{
+    uint64_t n = 0;
+    for (struct Directory *d = atlas_directory(atlas); d; d = directory_next(d)) n++;
+    buffer_put_varint(buffer, n);
+
+    struct Coordinate last = coordinate_origin();
+    for (struct Directory *d = atlas_directory(atlas); d; d = directory_next(d)) {
+        struct Location *location = directory_location(d);
+        write_binary_location(buffer, &last, location_coordinate(location), location_type(location));
+    }
+}
+
+
+void write_binary_header(struct Buffer *buffer, const char *magic, unsigned char version)
+{
+    buffer_puts(buffer, magic, 4);
+    buffer_putc(buffer, version);
+    for (int i = 5; i < FILE_BINARY_HEADER; i++) buffer_putc(buffer, 0);
+    buffer_sum(buffer);
+}
+
+
+/* ends the chart section at the end marker, returning its checksum and where the
+ * location section starts */
+uint32_t write_binary_end(struct Buffer *buffer, uint64_t *offset)
+{
+    buffer_putc(buffer, FILE_BINARY_END);
+    uint32_t charts = buffer_sum(buffer);
+    *offset = buffer_tell(buffer);
+    return charts;
+}
+
+
+/* trailer [OFFSET u64][CHARTS u32][LOCATIONS u32], the sections either side of offset */
+void write_binary_sums(struct Buffer *buffer, uint64_t offset, uint32_t charts)
+{
+    uint32_t locations = buffer_sum(buffer);
+
+    buffer_put_u32(buffer, (uint32_t)offset);
+    buffer_put_u32(buffer, (uint32_t)(offset >> 32));
+    buffer_put_u32(buffer, charts);
+    buffer_put_u32(buffer, locations);
+}
+
+
+void write_binary(struct Buffer *buffer, const struct Atlas *atlas)
+{
+    write_binary_header(buffer, FILE_BINARY_MAGIC, FILE_BINARY_VERSION);
+    write_split(buffer, atlas_root(atlas), write_binary_segment);
+
+    uint64_t offset;
+    uint32_t charts = write_binary_end(buffer, &offset);
+    write_binary_coordinate(buffer, atlas_coordinate(atlas));
+    write_binary_locations(buffer, atlas);
+    write_binary_sums(buffer, offset, charts);
+}
+
+
+/*==========================================================
+ *  BINARY READ
+ *========================================================*/
+
+struct Reader
+{
+    const unsigned char *at;
+    const unsigned char *end;
+    bool ok;
+};
+
+
+static inline unsigned char reader_byte(struct Reader *reader)
+{
+    if (reader->at >= reader->end) {
+        reader->ok = false;
+        return 0;
+    }
+    return *(reader->at++);
+}
+
+
+static inline uint64_t reader_varint(struct Reader *reader)
+{
+    uint64_t v = 0;
+
+    for (int shift = 0; shift < 64; shift += 7) {
+        unsigned char b = reader_byte(reader);
+        v |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) return v;
+    }
+
+    reader->ok = false;
+    return 0;
+}
+
+
+static inline int64_t reader_zigzag(struct Reader *reader)
+{
+    uint64_t v = reader_varint(reader);
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+
+static inline uint16_t reader_u16(struct Reader *reader)
+{
+    uint16_t lo = reader_byte(reader);
+    return lo | (uint16_t)(reader_byte(reader) << 8);
+}
+
+
+static inline uint32_t reader_u32(struct Reader *reader)
+{
+    uint32_t lo = reader_u16(reader);
+    return lo | ((uint32_t)reader_u16(reader) << 16);
+}
+
+
+struct Coordinate read_binary_coordinate(struct Reader *reader)
+{
+    uint32_t m = (uint32_t)reader_varint(reader);
+    int32_t p = (int32_t)reader_zigzag(reader);
+    int32_t q = (int32_t)reader_zigzag(reader);
+    return coordinate(p, q, -(p + q), m);
+}
+
+
+void read_binary_tile(struct Reader *reader, struct Record *record)
+{
+    uint16_t word = reader_u16(reader);
+
+    record->terrain = word & 0x0F;
+    record->roads = (word >> 4) & 0x3F;
+    record->rivers = (word >> 10) & 0x3F;
+    record->seed = reader_u32(reader);
+    record->tile = true;
+}
+
+
+/* the next location, delta coded against last, which moves on to it */
+bool read_binary_location(struct Reader *reader, struct Coordinate *last, enum LOCATION *t)
+{
+    uint32_t m = (uint32_t)reader_varint(reader);
+    int32_t p = coordinate_p(*last) + (int32_t)reader_zigzag(reader);
+    int32_t q = coordinate_q(*last) + (int32_t)reader_zigzag(reader);
+    *t = (enum LOCATION)reader_byte(reader);
+    if (!reader->ok) return false;
+
+    *last = coordinate(p, q, -(p + q), m);
+    return true;
+}
+
+
+bool read_binary_locations(struct Reader *reader, struct Atlas *atlas)
+{
+    uint64_t n = reader_varint(reader);
+    struct Coordinate last = coordinate_origin();
+    struct Location **locations = NULL;
+    size_t len = 0, cap = 0;
+    enum LOCATION t;
+
+    for (uint64_t i = 0; (i < n) && read_binary_location(reader, &last, &t); i++) {
+        locations_push(&locations, &len, &cap, location_create(last, t));
+    }
+
+    atlas_add_locations(atlas, locations, len);
+    free(locations);
+    return reader->ok;
+}
+
+
+/* how far into a binary chart stream: the last chart read at each level */
+struct Trail
+{
+    struct Coordinate path[ATLAS_MAX_LEVEL];
+    uint32_t level;
+    bool root;
+};
+
+
+/*
+ *  Charts come parent first, so each is placed relative to the last one a level up. False
+ *  at the end marker, with the reader still ok, or on bad data, with it not.
+ */
+bool read_binary_record(struct Reader *reader, struct Trail *trail, struct Record *record)
+{
+    unsigned char tag = reader_byte(reader);
+    if (!reader->ok || (tag == FILE_BINARY_END)) return false;
+
+    uint32_t offset = tag & 0x0F;
+    uint32_t step = tag >> FILE_TAG_STEP_SHIFT;
+    struct Coordinate c = { 0 };
+
+    if (trail->root) {
+        c = read_binary_coordinate(reader);
+        trail->root = false;
+    } else {
+        uint64_t m = (step == FILE_TAG_STEP_LEVEL) ? reader_varint(reader) : (uint64_t)trail->level + step - 1;
+        if ((offset >= NUM_CHILDREN) || (m + 1 >= ATLAS_MAX_LEVEL)) return (reader->ok = false);
+
+        struct Coordinate up = trail->path[m + 1];
+        int32_t p = 3*coordinate_p(up) + (int32_t)(offset / 3) - 1;
+        int32_t q = 3*coordinate_q(up) + (int32_t)(offset % 3) - 1;
+        c = coordinate(p, q, -(p + q), (uint32_t)m);
+    }
+    if (!reader->ok || (coordinate_m(c) >= ATLAS_MAX_LEVEL)) return (reader->ok = false);
+
+    record->coordinate = c;
+    record->tile = false;
+    if (tag & FILE_TAG_TILE) {
+        if (coordinate_m(c) != 0) return (reader->ok = false);
+        read_binary_tile(reader, record);
+    }
+
+    trail->path[coordinate_m(c)] = c;
+    trail->level = coordinate_m(c);
+    return reader->ok;
+}
+
+
+bool read_binary_charts(struct Reader *reader, struct Builder *builder)
+{
+    struct Trail trail = { .root = true };
+    struct Record record;
+
+    while (read_binary_record(reader, &trail, &record)) {
+        struct Chart *chart = record_chart(&record);
+        if (!builder_add(builder, chart)) {
+            chart_destroy(chart);
+            return false;
+        }
+    }
+
+    return reader->ok && !trail.root;
+}
+
+
+/* a summed save's trailer, checked against the sections either side of its offset */
+bool read_binary_sums(const unsigned char *data, size_t len, size_t *end)
+{
+    if (len < FILE_BINARY_HEADER + FILE_BINARY_TRAILER) return file_fail("missing checksums, the file may be cut short");
+
+    struct Reader reader = { data + len - FILE_BINARY_TRAILER, data + len, true };
+    uint64_t offset = reader_u32(&reader);
+    offset |= (uint64_t)reader_u32(&reader) << 32;
+
+    struct Sums want;
+    want.charts = reader_u32(&reader);
+    want.locations = reader_u32(&reader);
+
+    *end = len - FILE_BINARY_TRAILER;
+    if ((offset <= FILE_BINARY_HEADER) || (offset > *end)) return file_fail("missing checksums, the file may be cut short");
+
+    struct Sums got;
+    got.charts = sum_section(data + FILE_BINARY_HEADER, offset - FILE_BINARY_HEADER);
+    got.locations = sum_section(data + offset, *end - offset);
+    return sums_check(want, got);
+}
+
+
+/*
+ *  The header checked, and the sums too if the version has them, before anything is
+ *  parsed; they cost a pass at memory speed, a small part of the parse. End is where
+ *  the records stop.
+ */
+bool read_binary_header(const unsigned char *data, size_t len, size_t *end)
+{
+    if (!data || (len < FILE_BINARY_HEADER) || memcmp(data, FILE_BINARY_MAGIC, 4)) return file_fail("not a binary save");
+    if ((data[4] == 0) || (data[4] > FILE_BINARY_VERSION)) return file_fail("unsupported binary save version");
+
+    *end = len;
+    return (data[4] < FILE_VERSION_SUMS) || read_binary_sums(data, len, end);
+}
+
+
+struct Atlas *read_binary(const unsigned char *data, size_t len)
+{
+    size_t end = 0;
+    if (!read_binary_header(data, len, &end)) return NULL;
+
+    struct Reader reader = { data + FILE_BINARY_HEADER, data + end, true };
+    struct Builder *builder = builder_create();
+
+    if (!read_binary_charts(&reader, builder)) {
+        builder_destroy(builder);
+        file_fail("malformed chart data");
+        return NULL;
+    }
+
+    struct Atlas *atlas = builder_finish(builder);
+    atlas_goto(atlas, read_binary_coordinate(&reader));
+
+    if (!read_binary_locations(&reader, atlas)) {
+        atlas_destroy(atlas);
+        file_fail("malformed location data");
+        return NULL;
+    }
+    return atlas;
+}
+
+
+/*==========================================================
+ *  TILED
+ *
+ *  Each level FILE_TILED_LEVEL subtree is a block of binary chart records that can be
+ *  read on its own. An index at the end, found through the trailer, gives each block's
+ *  coordinate, length, checksum, census and subtree hash, so the charts above the blocks
+ *  are rebuilt from it and every block starts out as a stub until something reaches into
+ *  it, or a comparison finds its hash differs. Each block is checked as it is read in,
+ *  and the index, which ends in its own checksum, as the file is opened.
+ *========================================================*/
+
+struct Block
+{
+    struct Coordinate coordinate;
+    uint64_t offset, len;
+    uint32_t crc;
+    uint32_t census[CENSUS_SIZE];
+    uint64_t hash;
+};
+
+
+struct Index
+{
+    struct Block *blocks;
+    size_t len, cap;
+};
+
+
+/* blocks are read in one at a time as they are written, and dropped again if over budget */
+void write_tiled_blocks(
+    struct Buffer *buffer,
+    const struct Atlas *atlas,
+    struct Chart *chart,
+    uint32_t level,
+    struct Index *index
+)
+{
+    if (!chart) return;
+
+    if (coordinate_m(chart_coordinate(chart)) > level) {
+        for (int i = 0; i < NUM_CHILDREN; i++) write_tiled_blocks(buffer, atlas, chart_child(chart, i), level, index);
+        return;
+    }
+    if (!atlas_fault(atlas, chart)) {
+        buffer->ok = false;
+        return;
+    }
+
+    if (index->len == index->cap) {
+        index->cap = (index->cap) ? 2*index->cap : 256;
+        index->blocks = realloc(index->blocks, index->cap * sizeof(struct Block));
+    }
+
+    struct Block *block = &index->blocks[index->len++];
+    block->coordinate = chart_coordinate(chart);
+    block->offset = buffer_tell(buffer);
+    for (int t = 0; t < CENSUS_SIZE; t++) block->census[t] = chart_census(chart, t);
+    block->hash = atlas_chart_hash(atlas, chart);
+
+    uint32_t m = 0;
+    write_binary_chart(buffer, chart, NULL, &m);
+    buffer_putc(buffer, FILE_BINARY_END);
+    block->len = buffer_tell(buffer) - block->offset;
+    block->crc = buffer_sum(buffer);
+    atlas_trim(atlas);
+}
+
+
+void write_tiled(struct Buffer *buffer, const struct Atlas *atlas)
+{
+    write_binary_header(buffer, FILE_TILED_MAGIC, FILE_TILED_VERSION);
+
+    struct Coordinate root = chart_coordinate(atlas_root(atlas));
+    uint32_t level = (coordinate_m(root) < FILE_TILED_LEVEL) ? coordinate_m(root) : FILE_TILED_LEVEL;
+
+    struct Index index = { NULL, 0, 0 };
+    write_tiled_blocks(buffer, atlas, atlas_root(atlas), level, &index);
+
+    /* blocks lie end to end from the header, so the index needs only their lengths */
+    uint64_t start = buffer_tell(buffer);
+    write_binary_coordinate(buffer, root);
+    write_binary_coordinate(buffer, atlas_coordinate(atlas));
+    buffer_put_varint(buffer, index.len);
+
+    struct Coordinate last = coordinate_origin();
+    for (size_t i = 0; i < index.len; i++) {
+        struct Coordinate c = index.blocks[i].coordinate;
+        buffer_put_varint(buffer, coordinate_m(c));
+        buffer_put_zigzag(buffer, (int64_t)coordinate_p(c) - coordinate_p(last));
+        buffer_put_zigzag(buffer, (int64_t)coordinate_q(c) - coordinate_q(last));
+        buffer_put_varint(buffer, index.blocks[i].len);
+        buffer_put_u32(buffer, index.blocks[i].crc);
+        for (int t = 0; t < CENSUS_SIZE; t++) buffer_put_varint(buffer, index.blocks[i].census[t]);
+        buffer_put_u32(buffer, (uint32_t)index.blocks[i].hash);
+        buffer_put_u32(buffer, (uint32_t)(index.blocks[i].hash >> 32));
+        last = c;
+    }
+    write_binary_locations(buffer, atlas);
+    buffer_put_u32(buffer, buffer_sum(buffer));
+
+    buffer_put_u32(buffer, (uint32_t)start);
+    buffer_put_u32(buffer, (uint32_t)(start >> 32));
+    free(index.blocks);
+}
+
+
+struct Extent
+{
+    uint64_t offset, len;
+    uint32_t crc;
+    bool summed;
+};
+
+
+/*
+ *  An open tiled file (or its decompressed bytes) kept for the stubs still to be read.
+ *  Blocks changed in memory and then dropped go to an unnamed page file, numbered on
+ *  from the file's own. The file's blocks never change once the index is read, so they
+ *  can be loaded from any thread; the page file belongs to the thread that stores. A
+ *  forked child shares its offset with the editor, so it never stores and keeps changed
+ *  blocks in memory instead.
+ */
+struct Tiled
+{
+    pid_t owner;
+    int fd;
+    unsigned char *data;
+    uint64_t size;
+    struct Extent *blocks;
+    uint32_t n;
+    bool summed;
+    FILE *page;
+    uint64_t paged;
+    struct Extent *pages;
+    uint32_t npages, cappages;
+};
+
+
+/* takes the descriptor (or, with fd < 0, the malloc'd bytes) of a whole tiled file */
+struct Tiled *tiled_create(int fd, unsigned char *data, uint64_t size)
+{
+    struct Tiled *tiled = malloc(sizeof(struct Tiled));
+
+    tiled->owner = getpid();
+    tiled->fd = fd;
+    tiled->data = data;
+    tiled->size = size;
+    tiled->blocks = NULL;
+    tiled->n = 0;
+    tiled->summed = false;
+    tiled->page = NULL;
+    tiled->paged = 0;
+    tiled->pages = NULL;
+    tiled->npages = 0;
+    tiled->cappages = 0;
+    return tiled;
+}
+
+
+/* len bytes from offset in a malloc'd block, NULL if the file is shorter */
+unsigned char *tiled_read(const struct Tiled *tiled, bool paged, uint64_t offset, uint64_t len)
+{
+    uint64_t size = (paged) ? tiled->paged : tiled->size;
+    if ((offset > size) || (len > size - offset)) return NULL;
+
+    unsigned char *bytes = malloc(len ? len : 1);
+    if (tiled->data && !paged) {
+        memcpy(bytes, tiled->data + offset, len);
+        return bytes;
+    }
+
+    int fd = (paged) ? fileno(tiled->page) : tiled->fd;
+    for (uint64_t done = 0; done < len; ) {
+        ssize_t n = pread(fd, bytes + done, len - done, (off_t)(offset + done));
+        if (n <= 0) {
+            free(bytes);
+            return NULL;
+        }
+        done += (uint64_t)n;
+    }
+    return bytes;
+}
+
+
+void tiled_release(void *data)
+{
+    struct Tiled *tiled = data;
+    if (!tiled) return;
+
+    if (tiled->fd >= 0) close(tiled->fd);
+    if (tiled->page) fclose(tiled->page);
+    free(tiled->data);
+    free(tiled->blocks);
+    free(tiled->pages);
+    free(tiled);
+}
+
+
+/* the loader's callback: one block's subtree as an atlas of its own */
+struct Atlas *tiled_load(void *data, uint32_t block)
+{
+    struct Tiled *tiled = data;
+    bool paged = (block >= tiled->n);
+    if (paged && (block - tiled->n >= tiled->npages)) return NULL;
+
+    struct Extent extent = (paged) ? tiled->pages[block - tiled->n] : tiled->blocks[block];
+    unsigned char *bytes = tiled_read(tiled, paged, extent.offset, extent.len);
+    if (!bytes) return NULL;
+    if (extent.summed && (checksum_update(0, bytes, extent.len) != extent.crc)) {
+        free(bytes);
+        return NULL;
+    }
+
+    struct Reader reader = { bytes, bytes + extent.len, true };
+    struct Builder *builder = builder_create();
+    bool ok = read_binary_charts(&reader, builder);
+    free(bytes);
+
+    if (!ok) {
+        builder_destroy(builder);
+        return NULL;
+    }
+    return builder_finish(builder);
+}
+
+
+/* the loader's other callback: a changed subtree appended to the page file as a new block */
+uint32_t tiled_store(void *data, const struct Chart *chart)
+{
+    struct Tiled *tiled = data;
+
+    if (tiled->owner != getpid()) return 0;
+    if (!tiled->page && !(tiled->page = tmpfile())) return 0;
+    if (tiled->npages == tiled->cappages) {
+        tiled->cappages = (tiled->cappages) ? 2*tiled->cappages : 64;
+        tiled->pages = realloc(tiled->pages, tiled->cappages * sizeof(struct Extent));
+    }
+
+    struct Buffer *buffer = buffer_create(tiled->page, NULL);
+    uint32_t level = 0;
+    write_binary_chart(buffer, chart, NULL, &level);
+    buffer_putc(buffer, FILE_BINARY_END);
+    uint64_t len = buffer_tell(buffer);
+    uint32_t crc = buffer_sum(buffer);
+
+    bool ok = buffer_destroy(buffer) && (fflush(tiled->page) == 0);
+    if (!ok) return 0;
+
+    tiled->pages[tiled->npages++] = (struct Extent) { tiled->paged, len, crc, true };
+    tiled->paged += len;
+    return tiled->n + tiled->npages;
+}
+
+
+/* the charts above the blocks and a stub for each block, from the index alone */
+struct Atlas *read_tiled_index(struct Reader *reader, struct Tiled *tiled, uint8_t version, struct Coordinate *curr)
+{
+    bool summed = (version >= FILE_VERSION_SUMS), hashed = (version >= FILE_VERSION_HASHES);
+    struct Coordinate root = read_binary_coordinate(reader);
+    *curr = read_binary_coordinate(reader);
+    uint64_t n = reader_varint(reader);
+    if (!reader->ok || (coordinate_m(root) + 1 >= ATLAS_MAX_LEVEL) || (n > tiled->size)) return NULL;
+
+    tiled->n = (uint32_t)n;
+    tiled->blocks = malloc((n ? n : 1) * sizeof(struct Extent));
+
+    struct Atlas *atlas = NULL;
+    struct Coordinate last = coordinate_origin();
+    uint64_t offset = FILE_BINARY_HEADER;
+    uint32_t level = 0;
+    for (uint32_t i = 0; (i < tiled->n) && reader->ok; i++) {
+        uint32_t m = (uint32_t)reader_varint(reader);
+        int32_t p = coordinate_p(last) + (int32_t)reader_zigzag(reader);
+        int32_t q = coordinate_q(last) + (int32_t)reader_zigzag(reader);
+        tiled->blocks[i].offset = offset;
+        tiled->blocks[i].len = reader_varint(reader);
+        tiled->blocks[i].crc = (summed) ? reader_u32(reader) : 0;
+        tiled->blocks[i].summed = summed;
+        offset += tiled->blocks[i].len;
+
+        uint32_t census[CENSUS_SIZE];
+        for (int t = 0; t < CENSUS_SIZE; t++) census[t] = (uint32_t)reader_varint(reader);
+        uint64_t hash = 0;
+        if (hashed) {
+            hash = reader_u32(reader);
+            hash |= (uint64_t)reader_u32(reader) << 32;
+        }
+
+        /* blocks all sit on one level, so none can hold another */
+        if (i == 0) level = m;
+        last = coordinate(p, q, -(p + q), m);
+        if (!reader->ok || (m != level) || (m > coordinate_m(root)) || !coordinate_related(root, last)) {
+            reader->ok = false;
+            break;
+        }
+
+        if (m == 0) {
+            /* a world of one tile is too small for a stub, and is read in now */
+            if (atlas || !coordinate_equals(last, root) || !(atlas = tiled_load(tiled, i))) reader->ok = false;
+            continue;
+        }
+
+        if (!atlas) {
+            atlas = atlas_create();
+            if (!coordinate_equals(last, root)) atlas_insert(atlas, chart_create(root));
+        } else if (coordinate_equals(last, root) || atlas_find(atlas, last)) {
+            reader->ok = false;
+            break;
+        }
+        atlas_insert(atlas, chart_create_stub(last, census, (hashed) ? &hash : NULL, i));
+    }
+
+    if (!atlas && reader->ok) {
+        atlas = atlas_create();
+        atlas_insert(atlas, chart_create(root));
+    }
+    if (atlas && reader->ok) read_binary_locations(reader, atlas);
+    if (!reader->ok) {
+        atlas_destroy(atlas);
+        return NULL;
+    }
+    return atlas;
+}
+
+
+/* an atlas of stubs over the tiled file, which stays open until the atlas is destroyed */
+struct Atlas *read_tiled(struct Tiled *tiled)
+{
+    unsigned char header[FILE_BINARY_HEADER];
+    unsigned char *head = tiled_read(tiled, false, 0, FILE_BINARY_HEADER);
+    unsigned char *trailer = (tiled->size >= FILE_BINARY_HEADER + FILE_TILED_TRAILER)
+        ? tiled_read(tiled, false, tiled->size - FILE_TILED_TRAILER, FILE_TILED_TRAILER)
+        : NULL;
+
+    bool ok = head && trailer && !memcmp(head, FILE_TILED_MAGIC, 4);
+    if (head) memcpy(header, head, FILE_BINARY_HEADER);
+    free(head);
+
+    uint64_t start = 0;
+    if (ok) {
+        struct Reader reader = { trailer, trailer + FILE_TILED_TRAILER, true };
+        start = reader_u32(&reader);
+        start |= (uint64_t)reader_u32(&reader) << 32;
+    }
+    free(trailer);
+
+    if (!ok) {
+        tiled_release(tiled);
+        file_fail("not a tiled save");
+        return NULL;
+    }
+    if ((header[4] == 0) || (header[4] > FILE_TILED_VERSION)) {
+        tiled_release(tiled);
+        file_fail("unsupported tiled save version");
+        return NULL;
+    }
+
+    bool summed = tiled->summed = (header[4] >= FILE_VERSION_SUMS);
+    uint64_t end = tiled->size - FILE_TILED_TRAILER;
+    unsigned char *bytes = (start >= FILE_BINARY_HEADER) ? tiled_read(tiled, false, start, end - start) : NULL;
+    uint64_t len = (bytes) ? end - start : 0;
+
+    /* the index's checksum is its last four bytes */
+    if (bytes && summed) {
+        bool intact = (len >= 4);
+        if (intact) {
+            struct Reader sum = { bytes + len - 4, bytes + len, true };
+            len -= 4;
+            intact = (checksum_update(0, bytes, len) == reader_u32(&sum));
+        }
+        if (!intact) {
+            free(bytes);
+            tiled_release(tiled);
+            file_fail("block index checksum mismatch");
+            return NULL;
+        }
+    }
+
+    struct Atlas *atlas = NULL;
+    struct Coordinate curr = coordinate_origin();
+    if (bytes) {
+        struct Reader reader = { bytes, bytes + len, true };
+        atlas = read_tiled_index(&reader, tiled, header[4], &curr);
+        free(bytes);
+    }
+
+    if (!atlas) {
+        tiled_release(tiled);
+        file_fail("malformed block index");
+        return NULL;
+    }
+
+    atlas_set_loader(atlas, (struct Loader) { tiled_load, tiled_store, tiled_release, tiled });
+    atlas_goto(atlas, curr);
+    return atlas;
+}
+
+
+/*==========================================================
+ *  FILES
+ *========================================================*/
+
+/* the whole file mapped read only, NULL if it cannot be (or is empty) */
+const char *file_map(const char *filename, size_t *len)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || (st.st_size <= 0)) {
+        close(fd);
+        return NULL;
+    }
+
+    *len = (size_t)st.st_size;
+    void *data = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return NULL;
+
+    madvise(data, *len, MADV_SEQUENTIAL);
+    return data;
+}
+
+
+void file_unmap(const char *data, size_t len)
+{
+    if (data) munmap((void *)data, len);
+}
+
+
+bool file_has_extension(const char *filename, const char *ext)
+{
+    size_t n = strlen(filename), k = strlen(ext);
+    return (n > k) && (0 == strcmp(filename + n - k, ext));
+}
+
+
+enum FORMAT file_format(const char *filename)
+{
+    if (!filename) return FORMAT_TEXT;
+
+    if (file_has_extension(filename, FILE_EXT_BINARY)) return FORMAT_BINARY;
+    if (file_has_extension(filename, FILE_EXT_BINARY FILE_EXT_GZIP)) return FORMAT_BINARY;
+    if (file_has_extension(filename, FILE_EXT_BINARY_GZIP)) return FORMAT_BINARY;
+    if (file_has_extension(filename, FILE_EXT_TILED)) return FORMAT_TILED;
+    if (file_has_extension(filename, FILE_EXT_TILED FILE_EXT_GZIP)) return FORMAT_TILED;
+    if (file_has_extension(filename, FILE_EXT_JSONL)) return FORMAT_JSONL;
+    if (file_has_extension(filename, FILE_EXT_JSONL FILE_EXT_GZIP)) return FORMAT_JSONL;
+    if (file_has_extension(filename, FILE_EXT_CSV)) return FORMAT_CSV;
+    if (file_has_extension(filename, FILE_EXT_CSV FILE_EXT_GZIP)) return FORMAT_CSV;
+    return FORMAT_TEXT;
+}
+
+
+/* formats holding only tiles and locations, one to a line */
+bool format_records(enum FORMAT format)
+{
+    return (format == FORMAT_JSONL) || (format == FORMAT_CSV);
+}
+
+
+bool file_compressed(const char *filename)
+{
+    if (!filename) return false;
+    return file_has_extension(filename, FILE_EXT_GZIP) || file_has_extension(filename, FILE_EXT_BINARY_GZIP);
+}
+
+
+/*==========================================================
+ *  JOURNAL
+ *========================================================*/
+
+/* the snapshot the atlas was last loaded from or saved to, which its dirty tiles are
+ * relative to and which a journal beside it may extend */
+struct Snapshot
+{
+    char *filename;
+    off_t size;
+    struct timespec mtime;
+};
+
+
+struct Snapshot snapshot = { 0 };
+
+
+bool snapshot_stat(const char *filename, off_t *size, struct timespec *mtime)
+{
+    struct stat st;
+    if (!filename || (stat(filename, &st) != 0)) return false;
+
+    *size = st.st_size;
+    *mtime = st.st_mtim;
+    return true;
+}
+
+
+void snapshot_set(const char *filename)
+{
+    free(snapshot.filename);
+    snapshot.filename = NULL;
+
+    if (filename && snapshot_stat(filename, &snapshot.size, &snapshot.mtime)) {
+        snapshot.filename = strdup(filename);
+    }
+}
+
+
+/* the snapshot is still the one we last read or wrote */
+bool snapshot_current(const char *filename)
+{
+    off_t size;
+    struct timespec mtime;
+
+    if (!snapshot.filename || strcmp(snapshot.filename, filename)) return false;
+    if (!snapshot_stat(filename, &size, &mtime)) return false;
+    return (size == snapshot.size) && (mtime.tv_sec == snapshot.mtime.tv_sec)
+        && (mtime.tv_nsec == snapshot.mtime.tv_nsec);
+}
+
+
+char *journal_filename(const char *filename)
+{
+    char *journal = malloc(strlen(filename) + sizeof(FILE_EXT_JOURNAL));
+    strcpy(journal, filename);
+    strcat(journal, FILE_EXT_JOURNAL);
+    return journal;
+}
+
+
+/* expected format:
+ *  [SIZE],[SECONDS],[NANOSECONDS],
+ */
+void write_journal_header(struct Buffer *buffer)
+{
+    buffer_puts(buffer, FILE_MARKER_JRNL "\n", sizeof(FILE_MARKER_JRNL));
+    buffer_put_int(buffer, snapshot.size);
+    buffer_putc(buffer, FILE_SEP_MIN);
+    buffer_put_int(buffer, snapshot.mtime.tv_sec);
+    buffer_putc(buffer, FILE_SEP_MIN);
+    buffer_put_int(buffer, snapshot.mtime.tv_nsec);
+    buffer_putc(buffer, FILE_SEP_MIN);
+    buffer_putc(buffer, '\n');
+}
+
+
+/* expected format:
+ *  [COORDINATE]:[TILE]:[LOCATION]
+ * where the location is empty if the tile has none
+ */
+void write_journal_record(struct Buffer *buffer, const struct Chart *chart)
+{
+    struct Tile *tile = chart_tile(chart);
+
+    write_coordinate(buffer, chart_coordinate(chart));
+    buffer_putc(buffer, FILE_SEP_MAJ);
+    write_tile(buffer, tile);
+    buffer_putc(buffer, FILE_SEP_MAJ);
+    if (tile_location(tile)) buffer_put_int(buffer, location_type(tile_location(tile)));
+    buffer_putc(buffer, '\n');
+}
+
+
+/* the journal's header names this snapshot, leaving the scanner after it */
+bool scan_journal_header(struct Scanner *scanner, off_t size, struct timespec mtime)
+{
+    int64_t header[3];
+
+    return scan_marker(scanner, FILE_MARKER_JRNL)
+        && scan_int(scanner, 0, INT64_MAX, &header[0]) && scan_char(scanner, FILE_SEP_MIN)
+        && scan_int(scanner, INT64_MIN + 1, INT64_MAX, &header[1]) && scan_char(scanner, FILE_SEP_MIN)
+        && scan_int(scanner, 0, INT64_MAX, &header[2]) && scan_char(scanner, FILE_SEP_MIN)
+        && scan_line_end(scanner)
+        && (header[0] == size) && (header[1] == mtime.tv_sec) && (header[2] == mtime.tv_nsec);
+}
+
+
+bool journal_current(const char *path)
+{
+    size_t len = 0;
+    const char *data = file_map(path, &len);
+    if (!data) return false;
+
+    struct Scanner scanner = { data, data + len, 1, NULL };
+    bool current = scan_journal_header(&scanner, snapshot.size, snapshot.mtime);
+
+    file_unmap(data, len);
+    return current;
+}
+
+
+/* append the dirty tiles to the snapshot's journal; false if a full save is due instead */
+bool journal_append(const char *filename, const struct Atlas *atlas)
+{
+    /* a journal beside a file of records would be missed by anything else reading it */
+    if (format_records(file_format(filename)) || !snapshot_current(filename)) return false;
+
+    char *path = journal_filename(filename);
+    off_t size = 0;
+    struct timespec mtime;
+    if (!snapshot_stat(path, &size, &mtime)) size = 0;
+
+    /* one left from an older copy of the file would be ignored along with what we add */
+    if ((size > 0) && !journal_current(path)) size = 0;
+
+    /* compact once the journal would outgrow a fraction of the snapshot */
+    off_t limit = snapshot.size / FILE_JOURNAL_RATIO;
+    if (limit < FILE_JOURNAL_MIN) limit = FILE_JOURNAL_MIN;
+    if (size + (off_t)(FILE_JOURNAL_RECORD * atlas_dirty_count(atlas)) > limit) {
+        free(path);
+        return false;
+    }
+
+    FILE *file = fopen(path, (size > 0) ? "a+" : "w");
+    free(path);
+    if (!file) return false;
+
+    /* a torn last line (from a crash mid append) is left for compaction to clear */
+    if ((size > 0) && ((fseek(file, -1, SEEK_END) != 0) || (fgetc(file) != '\n'))) {
+        fclose(file);
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+
+    struct Buffer *buffer = buffer_create(file, NULL);
+    if (size == 0) write_journal_header(buffer);
+    for (size_t i = 0; i < atlas_dirty_count(atlas); i++) {
+        struct Chart *chart = atlas_find(atlas, atlas_dirty(atlas, i));
+        if (chart_tile(chart)) write_journal_record(buffer, chart);
+    }
+
+    bool ok = buffer_destroy(buffer);
+    ok = (fflush(file) == 0) && (fsync(fileno(file)) == 0) && ok;
+    return (fclose(file) == 0) && ok;
+}
+
+
+bool read_journal_record(struct Scanner *scanner, struct Atlas *atlas)
+{
+    struct Record record;
+    int64_t t = LOCATION_NONE;
+
+    if (!read_coordinate(scanner, &record.coordinate)) return false;
+    if (coordinate_m(record.coordinate) != 0) return scan_fail(scanner, "journal record above level 0");
+    if (!scan_char(scanner, FILE_SEP_MAJ) || !read_tile(scanner, &record)) return scan_fail(scanner, "malformed tile");
+    if (!scan_char(scanner, FILE_SEP_MAJ)) return scan_fail(scanner, "malformed journal record");
+
+    bool location = (scanner->at < scanner->end) && (*scanner->at != '\n') && (*scanner->at != '\r');
+    if (location && !scan_int(scanner, LOCATION_NONE, LOCATION_DUNGEON, &t)) return scan_fail(scanner, "malformed location");
+    if (!scan_line_end(scanner)) return scan_fail(scanner, "unexpected text at end of line");
+
+    struct Chart *chart = atlas_find(atlas, record.coordinate);
+    if (!chart) {
+        chart = chart_create(record.coordinate);
+        if (!atlas_insert(atlas, chart)) {
+            chart_destroy(chart);
+            return scan_fail(scanner, "journal record in a block that cannot be read");
+        }
+    }
+
+    atlas_set_chart_terrain(atlas, chart, (enum TERRAIN)record.terrain);
+    struct Tile *tile = atlas_touch_chart(atlas, chart);
+    tile_set_seed(tile, record.seed);
+    tile_set_roads(tile, record.roads);
+    tile_set_rivers(tile, record.rivers);
+
+    if (location && tile_location(tile)) location_set_type(tile_location(tile), (enum LOCATION)t);
+    else if (location) atlas_add_location(atlas, location_create(record.coordinate, (enum LOCATION)t));
+    return true;
+}
+
+
+/* replay the journal beside a snapshot, if it was written against this very snapshot; one
+ * that was not is left alone, for journal_append to start again once there is a save */
+bool journal_replay(const char *filename, struct Atlas *atlas)
+{
+    char *path = journal_filename(filename);
+    size_t len = 0;
+    const char *data = file_map(path, &len);
+    free(path);
+    if (!data) return true;
+
+    struct Scanner scanner = { data, data + len, 1, NULL };
+    off_t size;
+    struct timespec mtime;
+    bool ok = true;
+
+    bool current = snapshot_stat(filename, &size, &mtime) && scan_journal_header(&scanner, size, mtime);
+
+    while (current && ok && (scanner.at < scanner.end)) {
+        /* a last line without its newline is an append cut short, and is dropped */
+        if (!memchr(scanner.at, '\n', scanner.end - scanner.at)) break;
+        if (scan_blank(&scanner)) continue;
+        ok = read_journal_record(&scanner, atlas);
+    }
+
+    if (!ok) {
+        snprintf(file_error_message, FILE_ERROR_SIZE, "journal line %zu: %s", scanner.line, scanner.error);
+    }
+
+    file_unmap(data, len);
+    return ok;
+}
+
+
+void journal_remove(const char *filename)
+{
+    char *path = journal_filename(filename);
+    unlink(path);
+    free(path);
+}
+
+
+bool journal_exists(const char *filename)
+{
+    char *path = journal_filename(filename);
+    bool exists = (access(path, F_OK) == 0);
+    free(path);
+    return exists;
+}
+
+/*==========================================================
+ *  RECORDS
+ *
+ *  One line per tile and per location, as JSON Lines or CSV, for tools that should not
+ *  have to know the save formats: axial coordinates, terrain and location types by name,
+ *  and roads and rivers as lists of the directions they leave by. The charts above the
+ *  tiles are left out and rebuilt as the tiles are read back. Files are read a chunk at
+ *  a time, as they are written, so neither side holds more than a buffer of the file.
+ *========================================================*/
+
+static inline void buffer_put_str(struct Buffer *buffer, const char *str)
+{
+    buffer_puts(buffer, str, strlen(str));
+}
+
+
+void chart_record(const struct Chart *chart, struct Record *record)
+{
+    struct Tile *tile = chart_tile(chart);
+
+    record->coordinate = chart_coordinate(chart);
+    record->tile = (tile != NULL);
+    if (!tile) return;
+
+    record->seed = tile_seed(tile);
+    record->terrain = (uint8_t)tile_terrain(tile);
+    record->roads = tile_roads(tile);
+    record->rivers = tile_rivers(tile);
+}
+
+
+/* the directions set in a road or river byte, between separators and quoted if asked */
+void write_record_directions(struct Buffer *buffer, uint8_t bits, char sep, bool quote)
+{
+    bool first = true;
+
+    for (enum DIRECTION d = DIRECTION_EE; d < DIRECTION_XX; d++) {
+        if (!(bits & (1 << d))) continue;
+
+        if (!first) buffer_putc(buffer, sep);
+        if (quote) buffer_putc(buffer, '"');
+        buffer_put_str(buffer, direction_name(d));
+        if (quote) buffer_putc(buffer, '"');
+        first = false;
+    }
+}
+
+
+/* expected format, one object a line:
+ *  {"kind":"tile","p":[P],"q":[Q],"terrain":"[NAME]","seed":[SEED],"roads":["E",...],"rivers":[...]}
+ *  {"kind":"location","p":[P],"q":[Q],"location":"[NAME]"}
+ */
+void write_json_tile(struct Buffer *buffer, const struct Record *record)
+{
+    buffer_put_str(buffer, "{\"kind\":\"tile\",\"p\":");
+    buffer_put_int(buffer, coordinate_p(record->coordinate));
+    buffer_put_str(buffer, ",\"q\":");
+    buffer_put_int(buffer, coordinate_q(record->coordinate));
+    buffer_put_str(buffer, ",\"terrain\":\"");
+    buffer_put_str(buffer, terrain_name((enum TERRAIN)record->terrain));
+    buffer_put_str(buffer, "\",\"seed\":");
+    buffer_put_uint(buffer, record->seed);
+    buffer_put_str(buffer, ",\"roads\":[");
+    write_record_directions(buffer, record->roads, ',', true);
+    buffer_put_str(buffer, "],\"rivers\":[");
+    write_record_directions(buffer, record->rivers, ',', true);
+    buffer_put_str(buffer, "]}\n");
+}
+
+
+void write_json_location(struct Buffer *buffer, struct Coordinate c, enum LOCATION t)
+{
+    buffer_put_str(buffer, "{\"kind\":\"location\",\"p\":");
+    buffer_put_int(buffer, coordinate_p(c));
+    buffer_put_str(buffer, ",\"q\":");
+    buffer_put_int(buffer, coordinate_q(c));
+    buffer_put_str(buffer, ",\"location\":\"");
+    buffer_put_str(buffer, location_name(t));
+    buffer_put_str(buffer, "\"}\n");
+}
+
+
+/* expected format, after the header line:
+ *  tile,[P],[Q],[NAME],[SEED],[E NE ...],[E NE ...],
+ *  location,[P],[Q],,,,,[NAME]
+ */
+void write_csv_tile(struct Buffer *buffer, const struct Record *record)
+{
+    buffer_put_str(buffer, "tile,");
+    buffer_put_int(buffer, coordinate_p(record->coordinate));
+    buffer_putc(buffer, ',');
+    buffer_put_int(buffer, coordinate_q(record->coordinate));
+    buffer_putc(buffer, ',');
+    buffer_put_str(buffer, terrain_name((enum TERRAIN)record->terrain));
+    buffer_putc(buffer, ',');
+    buffer_put_uint(buffer, record->seed);
+    buffer_putc(buffer, ',');
+    write_record_directions(buffer, record->roads, ' ', false);
+    buffer_putc(buffer, ',');
+    write_record_directions(buffer, record->rivers, ' ', false);
+    buffer_put_str(buffer, ",\n");
+}
+
+
+void write_csv_location(struct Buffer *buffer, struct Coordinate c, enum LOCATION t)
+{
+    buffer_put_str(buffer, "location,");
+    buffer_put_int(buffer, coordinate_p(c));
+    buffer_putc(buffer, ',');
+    buffer_put_int(buffer, coordinate_q(c));
+    buffer_put_str(buffer, ",,,,,");
+    buffer_put_str(buffer, location_name(t));
+    buffer_putc(buffer, '\n');
+}
+
+
+void write_records_head(struct Buffer *buffer, enum FORMAT format)
+{
+    if (format == FORMAT_CSV) buffer_put_str(buffer, FILE_CSV_HEADER "\n");
+}
+
+
+void write_records_tile(struct Buffer *buffer, enum FORMAT format, const struct Record *record)
+{
+    if (!record->tile || (coordinate_m(record->coordinate) != 0)) return;
+
+    if (format == FORMAT_CSV) write_csv_tile(buffer, record);
+    else write_json_tile(buffer, record);
+}
+
+
+/* only locations on tiles are written, which is everywhere the editor puts them */
+void write_records_location(struct Buffer *buffer, enum FORMAT format, struct Coordinate c, enum LOCATION t)
+{
+    if (coordinate_m(c) != 0) return;
+
+    if (format == FORMAT_CSV) write_csv_location(buffer, c, t);
+    else write_json_location(buffer, c, t);
+}
+
+
+void write_records_chart(struct Buffer *buffer, enum FORMAT format, const struct Chart *chart)
+{
+    if (!chart) return;
+
+    if (chart_tile(chart)) {
+        struct Record record;
+        chart_record(chart, &record);
+        write_records_tile(buffer, format, &record);
+        return;
+    }
+
+    if (!chart_has_children(chart)) return;
+    for (int i = 0; i < NUM_CHILDREN; i++) write_records_chart(buffer, format, chart_child(chart, i));
+}
+
+
+/* every segment is written whole or not at all, since the charts above the tiles are left out */
+void write_json_segment(struct Buffer *buffer, const struct Segment *segment)
+{
+    if (segment->subtree) write_records_chart(buffer, FORMAT_JSONL, segment->chart);
+}
+
+
+void write_csv_segment(struct Buffer *buffer, const struct Segment *segment)
+{
+    if (segment->subtree) write_records_chart(buffer, FORMAT_CSV, segment->chart);
+}
+
+
+void write_records(struct Buffer *buffer, enum FORMAT format, const struct Atlas *atlas)
+{
+    write_records_head(buffer, format);
+    write_split(buffer, atlas_root(atlas), (format == FORMAT_CSV) ? write_csv_segment : write_json_segment);
+
+    for (struct Directory *d = atlas_directory(atlas); d; d = directory_next(d)) {
+        struct Location *location = directory_location(d);
+        write_records_location(buffer, format, location_coordinate(location), location_type(location));
+    }
+}
+
+
+/* a file read a chunk at a time, inflated on the way in if compressed, and handed out a
+ * line at a time; the buffer only grows for a line longer than all of it */
+struct Lines
+{
+    FILE *file;
+    struct Inflater *inflater;
+    char *data;
+    size_t at, len, cap;
+    size_t line;
+    bool end;
+};
+
+
+/* a scanner over the next line, without its line ending, or false at the end of the file */
+bool lines_next(struct Lines *lines, struct Scanner *scanner)
+{
+    char *eol = NULL;
+
+    while (!(eol = memchr(lines->data + lines->at, '\n', lines->len - lines->at)) && !lines->end) {
+        memmove(lines->data, lines->data + lines->at, lines->len - lines->at);
+        lines->len -= lines->at;
+        lines->at = 0;
+
+        if (lines->len == lines->cap) {
+            lines->cap *= 2;
+            lines->data = realloc(lines->data, lines->cap);
+        }
+
+        size_t want = lines->cap - lines->len;
+        size_t n = (lines->inflater)
+            ? inflater_read(lines->inflater, lines->data + lines->len, want)
+            : fread(lines->data + lines->len, 1, want, lines->file);
+        lines->len += n;
+        if (n == 0) lines->end = true;
+    }
+    if (!eol && (lines->at == lines->len)) return false;
+
+    const char *start = lines->data + lines->at;
+    const char *end = (eol) ? eol : lines->data + lines->len;
+    lines->at = (size_t)(end - lines->data) + ((eol) ? 1 : 0);
+    if ((end > start) && (end[-1] == '\r')) end--;
+
+    *scanner = (struct Scanner){ start, end, ++lines->line, NULL };
+    return true;
+}
+
+
+/* a line as read, before its tile is placed or its location made */
+struct Row
+{
+    struct Record record;
+    int64_t axial[3];           /* p, q and r, of which r may be left out */
+    bool given[3];
+    bool kind;
+    bool place;                 /* a location line rather than a tile */
+    bool seeded;
+    bool located;
+    enum LOCATION location;
+};
+
+
+/* names are matched without regard to case */
+bool record_named(const char *name, const char *text, size_t len)
+{
+    return (strlen(name) == len) && (0 == strncasecmp(name, text, len));
+}
+
+
+/* a list of direction names, split on spaces, commas and the quotes of a JSON array */
+bool record_directions(const char *text, size_t len, uint8_t *bits)
+{
+    const char *at = text, *end = text + len;
+    *bits = 0;
+
+    while (at < end) {
+        if (memchr(FILE_RECORD_SPLIT, *at, sizeof(FILE_RECORD_SPLIT) - 1)) {
+            at++;
+            continue;
+        }
+
+        const char *start = at;
+        while ((at < end) && !memchr(FILE_RECORD_SPLIT, *at, sizeof(FILE_RECORD_SPLIT) - 1)) at++;
+
+        enum DIRECTION d = DIRECTION_EE;
+        while ((d < DIRECTION_XX) && !record_named(direction_name(d), start, (size_t)(at - start))) d++;
+        if (d == DIRECTION_XX) return false;
+        *bits |= (uint8_t)(1 << d);
+    }
+    return true;
+}
+
+
+/* one field of a line, by its JSON key or CSV column; fields nothing reads are passed over */
+bool row_set(struct Scanner *scanner, struct Row *row, const char *key, size_t klen, const char *value, size_t vlen)
+{
+    while (vlen && (*value == ' ')) {
+        value++;
+        vlen--;
+    }
+    while (vlen && (value[vlen - 1] == ' ')) vlen--;
+    if (!vlen || record_named("null", value, vlen)) return true;
+
+    if (record_named("kind", key, klen)) {
+        if (record_named("tile", value, vlen)) row->place = false;
+        else if (record_named("location", value, vlen)) row->place = true;
+        else return scan_fail(scanner, "kind is neither tile nor location");
+        row->kind = true;
+        return true;
+    }
+
+    const char *axes[3] = { "p", "q", "r" };
+    for (int i = 0; i < 3; i++) {
+        if (!record_named(axes[i], key, klen)) continue;
+
+        struct Scanner number = { value, value + vlen, 0, NULL };
+        if (!scan_int(&number, INT32_MIN, INT32_MAX, &row->axial[i]) || (number.at != number.end)) {
+            return scan_fail(scanner, "malformed coordinate");
+        }
+        row->given[i] = true;
+        return true;
+    }
+
+    if (record_named("terrain", key, klen)) {
+        enum TERRAIN t = TERRAIN_UNKNOWN;
+        while ((t <= TERRAIN_TUNDRA) && !record_named(terrain_name(t), value, vlen)) t++;
+        if (t > TERRAIN_TUNDRA) return scan_fail(scanner, "unknown terrain");
+        row->record.terrain = (uint8_t)t;
+        return true;
+    }
+
+    if (record_named("seed", key, klen)) {
+        struct Scanner number = { value, value + vlen, 0, NULL };
+        int64_t seed;
+        if (!scan_int(&number, 0, UINT32_MAX, &seed) || (number.at != number.end)) return scan_fail(scanner, "malformed seed");
+        row->record.seed = (uint32_t)seed;
+        row->seeded = true;
+        return true;
+    }
+
+    if (record_named("roads", key, klen) && !record_directions(value, vlen, &row->record.roads)) {
+        return scan_fail(scanner, "unknown road direction");
+    }
+    if (record_named("rivers", key, klen) && !record_directions(value, vlen, &row->record.rivers)) {
+        return scan_fail(scanner, "unknown river direction");
+    }
+
+    if (record_named("location", key, klen)) {
+        enum LOCATION t = LOCATION_SETTLEMENT;
+        while ((t <= LOCATION_DUNGEON) && !record_named(location_name(t), value, vlen)) t++;
+        if (t > LOCATION_DUNGEON) return scan_fail(scanner, "unknown location");
+        row->location = t;
+        row->located = true;
+    }
+    return true;
+}
+
+
+/* the row's coordinate, from p and q with r checked if it was given */
+bool row_finish(struct Scanner *scanner, struct Row *row)
+{
+    if (!row->given[0] || !row->given[1]) return scan_fail(scanner, "missing p or q");
+
+    int64_t r = -row->axial[0] - row->axial[1];
+    if ((r < INT32_MIN) || (r > INT32_MAX)) return scan_fail(scanner, "malformed coordinate");
+    if (row->given[2] && (row->axial[2] != r)) return scan_fail(scanner, "coordinate does not satisfy p + q + r = 0");
+
+    if (!row->kind) row->place = row->located;
+    if (row->place && !row->located) return scan_fail(scanner, "location line without a location");
+
+    row->record.coordinate = coordinate((int32_t)row->axial[0], (int32_t)row->axial[1], (int32_t)r, 0);
+    return true;
+}
+
+
+static inline void json_space(struct Scanner *scanner)
+{
+    while ((scanner->at < scanner->end) && ((*scanner->at == ' ') || (*scanner->at == '\t'))) scanner->at++;
+}
+
+
+/* a string's contents, escapes left as they are since no name needs one */
+bool json_string(struct Scanner *scanner, const char **str, size_t *len)
+{
+    if (!scan_char(scanner, '"')) return false;
+
+    const char *start = scanner->at;
+    while ((scanner->at < scanner->end) && (*scanner->at != '"')) scanner->at += (*scanner->at == '\\') ? 2 : 1;
+    if (scanner->at >= scanner->end) return false;
+
+    *str = start;
+    *len = (size_t)(scanner->at - start);
+    scanner->at++;
+    return true;
+}
+
+
+/* a string's contents, an array's or object's insides, or a number or literal as it stands */
+bool json_value(struct Scanner *scanner, const char **value, size_t *len)
+{
+    if ((scanner->at < scanner->end) && (*scanner->at == '"')) return json_string(scanner, value, len);
+
+    const char *start = scanner->at;
+    if ((scanner->at < scanner->end) && ((*scanner->at == '[') || (*scanner->at == '{'))) {
+        /* nested objects and arrays are passed over whole, strings and all */
+        int depth = 0;
+        do {
+            const char *str;
+            size_t n;
+            if ((*scanner->at == '"') && json_string(scanner, &str, &n)) continue;
+            if ((*scanner->at == '[') || (*scanner->at == '{')) depth++;
+            if ((*scanner->at == ']') || (*scanner->at == '}')) depth--;
+            scanner->at++;
+        } while (depth && (scanner->at < scanner->end));
+        if (depth) return false;
+
+        *value = start + 1;
+        *len = (size_t)(scanner->at - start - 2);
+        return true;
+    }
+
+    while ((scanner->at < scanner->end) && !memchr(",} \t", *scanner->at, 4)) scanner->at++;
+    *value = start;
+    *len = (size_t)(scanner->at - start);
+    return (*len > 0);
+}
+
+
+/* expected format:
+ *  {"[KEY]":[VALUE],...}
+ */
+bool read_json_row(struct Scanner *scanner, struct Row *row)
+{
+    json_space(scanner);
+    if (!scan_char(scanner, '{')) return scan_fail(scanner, "expected a JSON object");
+    json_space(scanner);
+
+    if (!scan_char(scanner, '}')) {
+        do {
+            const char *key, *value;
+            size_t klen, vlen;
+
+            json_space(scanner);
+            if (!json_string(scanner, &key, &klen)) return scan_fail(scanner, "malformed key");
+            json_space(scanner);
+            if (!scan_char(scanner, ':')) return scan_fail(scanner, "expected ':' after key");
+            json_space(scanner);
+            if (!json_value(scanner, &value, &vlen)) return scan_fail(scanner, "malformed value");
+            if (!row_set(scanner, row, key, klen, value, vlen)) return false;
+            json_space(scanner);
+        } while (scan_char(scanner, ','));
+
+        if (!scan_char(scanner, '}')) return scan_fail(scanner, "expected ',' or '}'");
+    }
+
+    json_space(scanner);
+    if (scanner->at < scanner->end) return scan_fail(scanner, "unexpected text at end of line");
+    return true;
+}
+
+
+/* a field up to the next comma, or between quotes */
+bool csv_field(struct Scanner *scanner, const char **field, size_t *len)
+{
+    const char *start = scanner->at;
+
+    if (scan_char(scanner, '"')) {
+        start = scanner->at;
+        while ((scanner->at < scanner->end) && (*scanner->at != '"')) scanner->at++;
+        *field = start;
+        *len = (size_t)(scanner->at - start);
+        return scan_char(scanner, '"');
+    }
+
+    while ((scanner->at < scanner->end) && (*scanner->at != ',')) scanner->at++;
+    *field = start;
+    *len = (size_t)(scanner->at - start);
+    return true;
+}
+
+
+/* the names of the columns, which may come in any order */
+struct Columns
+{
+    char names[FILE_CSV_COLUMNS][FILE_CSV_NAME];
+    size_t len;
+};
+
+
+bool read_csv_header(struct Scanner *scanner, struct Columns *columns)
+{
+    columns->len = 0;
+
+    do {
+        const char *field;
+        size_t len;
+        if (!csv_field(scanner, &field, &len)) return scan_fail(scanner, "malformed header");
+
+        if (columns->len == FILE_CSV_COLUMNS) continue;
+        while (len && (*field == ' ')) {
+            field++;
+            len--;
+        }
+        while (len && (field[len - 1] == ' ')) len--;
+        if (len >= FILE_CSV_NAME) len = 0;
+        memcpy(columns->names[columns->len], field, len);
+        columns->names[columns->len++][len] = '\0';
+    } while (scan_char(scanner, ','));
+
+    if (scanner->at < scanner->end) return scan_fail(scanner, "malformed header");
+    return true;
+}
+
+
+bool read_csv_row(struct Scanner *scanner, struct Row *row, const struct Columns *columns)
+{
+    size_t i = 0;
+
+    do {
+        const char *field;
+        size_t len;
+        if (!csv_field(scanner, &field, &len)) return scan_fail(scanner, "malformed field");
+
+        const char *name = (i < columns->len) ? columns->names[i] : "";
+        if (!row_set(scanner, row, name, strlen(name), field, len)) return false;
+        i++;
+    } while (scan_char(scanner, ','));
+
+    if (scanner->at < scanner->end) return scan_fail(scanner, "malformed field");
+    return true;
+}
+
+
+/* a tile put in place, or over the one an earlier line gave for the same coordinate */
+bool records_place(struct Atlas *atlas, const struct Row *row)
+{
+    const struct Record *record = &row->record;
+    struct Chart *chart = (atlas_root(atlas)) ? atlas_find(atlas, record->coordinate) : NULL;
+
+    if (!chart) {
+        chart = chart_create(record->coordinate);
+        struct Tile *tile = chart_tile(chart);
+
+        if (row->seeded) tile_set_seed(tile, record->seed);
+        tile_set_terrain(tile, (enum TERRAIN)record->terrain);
+        tile_set_roads(tile, record->roads);
+        tile_set_rivers(tile, record->rivers);
+        if (atlas_insert(atlas, chart)) return true;
+
+        chart_destroy(chart);
+        return false;
+    }
+
+    atlas_set_chart_terrain(atlas, chart, (enum TERRAIN)record->terrain);
+    struct Tile *tile = atlas_touch_chart(atlas, chart);
+    if (row->seeded) tile_set_seed(tile, record->seed);
+    tile_set_roads(tile, record->roads);
+    tile_set_rivers(tile, record->rivers);
+    return true;
+}
+
+
+/*
+ *  Tiles are inserted as they are read, in whatever order they come, and the locations
+ *  attached once every tile is in. A tile line may carry a location of its own. The
+ *  cursor starts on the first tile.
+ */
+struct Atlas *read_records(struct Lines *lines, enum FORMAT format)
+{
+    struct Atlas *atlas = atlas_create();
+    struct Location **locations = NULL;
+    size_t count = 0, cap = 0;
+    struct Columns columns = { .len = 0 };
+    struct Coordinate first = coordinate_origin();
+    struct Scanner scanner;
+    bool header = (format == FORMAT_CSV), ok = true;
+
+    while (ok && lines_next(lines, &scanner)) {
+        if (scanner.at == scanner.end) continue;
+        if (header) {
+            ok = read_csv_header(&scanner, &columns) || scan_report(&scanner, scanner.line);
+            header = false;
+            continue;
+        }
+
+        struct Row row = { .record = { .terrain = TERRAIN_UNKNOWN, .tile = true } };
+        ok = (format == FORMAT_CSV) ? read_csv_row(&scanner, &row, &columns) : read_json_row(&scanner, &row);
+        ok = ok && row_finish(&scanner, &row);
+        if (ok && !row.place) {
+            if (!atlas_root(atlas)) first = row.record.coordinate;
+            ok = records_place(atlas, &row) || scan_fail(&scanner, "tile could not be placed");
+        }
+        if (!ok) {
+            scan_report(&scanner, scanner.line);
+            break;
+        }
+
+        if (row.located) locations_push(&locations, &count, &cap, location_create(row.record.coordinate, row.location));
+    }
+
+    if (ok && !atlas_root(atlas)) ok = file_fail("no tiles");
+    if (!ok) {
+        for (size_t i = 0; i < count; i++) location_destroy(locations[i]);
+        free(locations);
+        atlas_destroy(atlas);
+        return NULL;
+    }
+
+    atlas_add_locations(atlas, locations, count);
+    free(locations);
+    atlas_goto(atlas, first);
+    return atlas;
+}
+
+/*==========================================================
+ *  LOAD AND SAVE
+ *========================================================*/
+
+/* a tiled file is left open for its stubs, or held whole in memory if compressed */
+struct Tiled *tiled_open(const char *filename)
+{
+    if (file_compressed(filename)) {
+        size_t len = 0;
+        char *data = decompress_file(filename, &len);
+        if (!data) return NULL;
+        return tiled_create(-1, (unsigned char *)data, len);
+    }
+
+    struct stat st;
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return NULL;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return NULL;
+    }
+    return tiled_create(fd, NULL, (uint64_t)st.st_size);
+}
+
+
+struct Atlas *file_open_tiled(const char *filename)
+{
+    struct Tiled *tiled = tiled_open(filename);
+    return (tiled) ? read_tiled(tiled) : NULL;
+}
+
+
+struct Atlas *file_open_records(const char *filename, enum FORMAT format)
+{
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        file_fail("cannot open file");
+        return NULL;
+    }
+
+    struct Lines lines = { file, NULL, malloc(FILE_BUFFER_SIZE), 0, 0, FILE_BUFFER_SIZE, 0, false };
+    struct Atlas *atlas = NULL;
+
+    if (file_compressed(filename) && !(lines.inflater = inflater_create(file))) {
+        file_fail("cannot decompress file");
+    } else {
+        atlas = read_records(&lines, format);
+        bool compressed = (lines.inflater != NULL);
+        bool ok = (compressed) ? inflater_finish(lines.inflater) : !ferror(file);
+
+        if (atlas && !ok) {
+            atlas_destroy(atlas);
+            atlas = NULL;
+            file_fail((compressed) ? "cannot decompress file" : "cannot read file");
+        }
+    }
+
+    free(lines.data);
+    fclose(file);
+    return atlas;
+}
+
+
+/* an atlas read from the named file in the format its extension implies, NULL on failure;
+ * the file being edited is not changed, so this is how other files are read */
+struct Atlas *file_read(const char *filename)
+{
+    if (!filename) return NULL;
+
+    size_t len = 0;
+    bool compressed = file_compressed(filename);
+    enum FORMAT format = file_format(filename);
+    file_error_message[0] = '\0';
+
+    struct Atlas *atlas = NULL;
+    if (format == FORMAT_TILED) {
+        atlas = file_open_tiled(filename);
+        if (!atlas && !file_error()) file_fail((compressed) ? "cannot decompress file" : "cannot open file");
+    } else if (format_records(format)) {
+        atlas = file_open_records(filename, format);
+    } else {
+        const char *data = (compressed) ? decompress_file(filename, &len) : file_map(filename, &len);
+        if (!data) {
+            file_fail((compressed) ? "cannot decompress file" : "cannot map an empty or unreadable file");
+            return NULL;
+        }
+
+        if (format == FORMAT_BINARY) atlas = read_binary((const unsigned char *)data, len);
+        else atlas = read_text(data, len);
+
+        if (compressed) free((char *)data);
+        else file_unmap(data, len);
+    }
+
+    if (atlas && !journal_replay(filename, atlas)) {
+        atlas_destroy(atlas);
+        return NULL;
+    }
+    if (atlas) {
+        atlas_clear_dirty(atlas);
+        atlas_trim(atlas);
+    }
+    return atlas;
+}
+
+
+/* the same, for the file to be edited, whose dirty tiles and journal follow on from this */
+struct Atlas *file_load(const char *filename)
+{
+    struct Atlas *atlas = file_read(filename);
+    if (atlas) snapshot_set(filename);
+    return atlas;
+}
+
+
+/* the whole atlas written to an open file in the format the filename implies */
+bool file_put(FILE *file, const char *filename, const struct Atlas *atlas)
+{
+    /* only the tiled writer can go block by block; the others need every stub read in */
+    if ((file_format(filename) != FORMAT_TILED) && !atlas_load_all(atlas)) return false;
+
+    struct Compressor *compressor = NULL;
+    if (file_compressed(filename) && !(compressor = compressor_create(file))) return false;
+
+    struct Buffer *buffer = buffer_create(file, compressor);
+    if (file_format(filename) == FORMAT_BINARY) write_binary(buffer, atlas);
+    else if (file_format(filename) == FORMAT_TILED) write_tiled(buffer, atlas);
+    else if (format_records(file_format(filename))) write_records(buffer, file_format(filename), atlas);
+    else write_text(buffer, atlas);
+
+    bool ok = buffer_destroy(buffer);
+    return !ferror(file) && ok;
+}
+
+
+/*
+ *  Write beside the file and rename over it, so a crash leaves the old copy or the new
+ *  one and never half of each. The journal and snapshot are left alone, which lets a
+ *  forked child call this on its copy of the atlas.
+ */
+bool file_save_atomic(const char *filename, const struct Atlas *atlas)
+{
+    if (!filename || !atlas || !atlas_root(atlas)) return false;
+
+    char *path = malloc(strlen(filename) + sizeof(FILE_EXT_TEMP));
+    strcpy(path, filename);
+    strcat(path, FILE_EXT_TEMP);
+
+    FILE *file = fopen(path, "w");
+    bool ok = (file != NULL);
+
+    if (ok) {
+        ok = file_put(file, filename, atlas);
+        ok = (fflush(file) == 0) && (fsync(fileno(file)) == 0) && ok;
+        ok = (fclose(file) == 0) && ok;
+    }
+    ok = ok && (rename(path, filename) == 0);
+    if (!ok) unlink(path);
+
+    free(path);
+    return ok;
+}
+
+
+bool file_save(const char *filename, const struct Atlas *atlas)
+{
+    if (!filename || !atlas || !atlas_root(atlas)) return false;
+
+    /* stubs still read from the file being replaced, so it has to live on as its own inode */
+    if (atlas_paged(atlas)) {
+        if (!file_save_atomic(filename, atlas)) return false;
+    } else {
+        FILE *file = fopen(filename, "w");
+        if (!file) return false;
+
+        bool ok = file_put(file, filename, atlas);
+        ok = (fclose(file) == 0) && ok;
+        if (!ok) return false;
+    }
+
+    journal_remove(filename);
+    snapshot_set(filename);
+    return true;
+}
+
+
+/* save the atlas's edits, appending them to a journal when the file allows it */
+bool file_write(const char *filename, struct Atlas *atlas)
+{
+    if (!filename || !atlas) return false;
+
+    if (!journal_append(filename, atlas) && !file_save(filename, atlas)) return false;
+
+    atlas_clear_dirty(atlas);
+    return true;
+}
+
+/*==========================================================
+ *  STREAM
+ *
+ *  Text and binary saves read a record at a time straight into a sink, without building
+ *  the tree, so files can be converted and inspected in memory that does not grow with
+ *  the map. Tiled files and files with a journal are read through an atlas instead, and
+ *  tiled files can only be written from one.
+ *========================================================*/
+
+struct Sink
+{
+    void (*chart)(struct Sink *sink, const struct Record *record, const struct Coordinate *parent);
+    void (*curr)(struct Sink *sink, struct Coordinate c);
+    void (*locations)(struct Sink *sink, uint64_t n);
+    void (*location)(struct Sink *sink, struct Coordinate c, enum LOCATION t);
+    void (*finish)(struct Sink *sink);
+    struct Buffer *buffer;
+    struct Stats *stats;
+    struct Coordinate last;
+    uint32_t level;
+    uint32_t charts;            /* the chart section's checksum, for the trailer */
+    uint64_t offset;
+    enum FORMAT format;
+    bool unordered;             /* a chart came before its parent, so the input has to be loaded */
+};
+
+
+void sink_text_chart(struct Sink *sink, const struct Record *record, const struct Coordinate *parent)
+{
+    (void)parent;
+    write_coordinate(sink->buffer, record->coordinate);
+    if (record->tile) {
+        buffer_putc(sink->buffer, FILE_SEP_MAJ);
+        write_tile_fields(sink->buffer, record->seed, record->terrain, record->roads, record->rivers);
+    }
+    buffer_putc(sink->buffer, '\n');
+}
+
+
+void sink_text_curr(struct Sink *sink, struct Coordinate c)
+{
+    sink->charts = write_text_curr(sink->buffer, c);
+}
+
+
+void sink_text_locations(struct Sink *sink, uint64_t n)
+{
+    (void)sink;
+    (void)n;
+}
+
+
+void sink_text_location(struct Sink *sink, struct Coordinate c, enum LOCATION t)
+{
+    write_location_fields(sink->buffer, c, t);
+    buffer_putc(sink->buffer, '\n');
+}
+
+
+void sink_text_finish(struct Sink *sink)
+{
+    write_text_sums(sink->buffer, sink->charts);
+}
+
+
+void sink_binary_chart(struct Sink *sink, const struct Record *record, const struct Coordinate *parent)
+{
+    write_binary_tag(sink->buffer, record->coordinate, parent, record->tile, &sink->level);
+    if (record->tile) write_binary_tile_fields(sink->buffer, record->seed, record->terrain, record->roads, record->rivers);
+}
+
+
+void sink_binary_curr(struct Sink *sink, struct Coordinate c)
+{
+    sink->charts = write_binary_end(sink->buffer, &sink->offset);
+    write_binary_coordinate(sink->buffer, c);
+}
+
+
+void sink_binary_locations(struct Sink *sink, uint64_t n)
+{
+    buffer_put_varint(sink->buffer, n);
+    sink->last = coordinate_origin();
+}
+
+
+void sink_binary_location(struct Sink *sink, struct Coordinate c, enum LOCATION t)
+{
+    write_binary_location(sink->buffer, &sink->last, c, t);
+}
+
+
+void sink_binary_finish(struct Sink *sink)
+{
+    write_binary_sums(sink->buffer, sink->offset, sink->charts);
+}
+
+
+void sink_stats_chart(struct Sink *sink, const struct Record *record, const struct Coordinate *parent)
+{
+    (void)parent;
+    struct Stats *stats = sink->stats;
+    uint32_t m = coordinate_m(record->coordinate);
+
+    stats->charts[m]++;
+    if (m > stats->depth) stats->depth = m;
+    if (record->tile) {
+        stats->tiles++;
+        stats->terrain[(record->terrain < CENSUS_SIZE) ? record->terrain : TERRAIN_UNKNOWN]++;
+    }
+    stats->bytes += atlas_chart_bytes(m, record->tile);
+}
+
+
+void sink_stats_curr(struct Sink *sink, struct Coordinate c)
+{
+    (void)sink;
+    (void)c;
+}
+
+
+void sink_stats_location(struct Sink *sink, struct Coordinate c, enum LOCATION t)
+{
+    (void)c;
+    sink->stats->locations[((unsigned)t < NUM_LOCATION_TABLE) ? t : LOCATION_NONE]++;
+}
+
+
+void sink_stats_finish(struct Sink *sink)
+{
+    (void)sink;
+}
+
+
+void sink_records_chart(struct Sink *sink, const struct Record *record, const struct Coordinate *parent)
+{
+    (void)parent;
+    write_records_tile(sink->buffer, sink->format, record);
+}
+
+
+void sink_records_curr(struct Sink *sink, struct Coordinate c)
+{
+    (void)sink;
+    (void)c;
+}
+
+
+void sink_records_location(struct Sink *sink, struct Coordinate c, enum LOCATION t)
+{
+    write_records_location(sink->buffer, sink->format, c, t);
+}
+
+
+void sink_records_finish(struct Sink *sink)
+{
+    (void)sink;
+}
+
+
+/* a sink writing the format to buffer, which is given the format's header straight away */
+struct Sink sink_writer(enum FORMAT format, struct Buffer *buffer)
+{
+    struct Sink sink = { .buffer = buffer };
+
+    if (format == FORMAT_BINARY) {
+        write_binary_header(buffer, FILE_BINARY_MAGIC, FILE_BINARY_VERSION);
+
+        sink.chart = sink_binary_chart;
+        sink.curr = sink_binary_curr;
+        sink.locations = sink_binary_locations;
+        sink.location = sink_binary_location;
+        sink.finish = sink_binary_finish;
+    } else if (format_records(format)) {
+        write_records_head(buffer, format);
+
+        sink.format = format;
+        sink.chart = sink_records_chart;
+        sink.curr = sink_records_curr;
+        sink.locations = sink_text_locations;
+        sink.location = sink_records_location;
+        sink.finish = sink_records_finish;
+    } else {
+        write_text_head(buffer);
+
+        sink.chart = sink_text_chart;
+        sink.curr = sink_text_curr;
+        sink.locations = sink_text_locations;
+        sink.location = sink_text_location;
+        sink.finish = sink_text_finish;
+    }
+    return sink;
+}
+
+
+struct Sink sink_counter(struct Stats *stats)
+{
+    struct Sink sink = { .stats = stats };
+
+    sink.chart = sink_stats_chart;
+    sink.curr = sink_stats_curr;
+    sink.locations = sink_text_locations;
+    sink.location = sink_stats_location;
+    sink.finish = sink_stats_finish;
+    return sink;
+}
+
+
+bool stream_text(const char *data, size_t len, struct Sink *sink)
+{
+    struct Scanner scanner = { data, data + len, 1, NULL };
+    bool summed = scan_marker(&scanner, FILE_MARKER_SUMS);
+
+    while (!scan_marker(&scanner, FILE_MARKER_ROOT)) {
+        if (scanner.at >= scanner.end) return file_fail("missing " FILE_MARKER_ROOT);
+        scan_skip_line(&scanner);
+    }
+    const char *charts = scanner.at, *charts_end = NULL, *tail = NULL;
+
+    /* the last chart seen at each level, which the next one down must be a child of */
+    struct Coordinate path[ATLAS_MAX_LEVEL];
+    bool seen[ATLAS_MAX_LEVEL] = { false };
+    struct Coordinate curr = coordinate_origin();
+    size_t n = 0;
+
+    while ((scanner.at < scanner.end) && !scan_section_end(&scanner, FILE_MARKER_CURR, &charts_end)) {
+        if (scan_blank(&scanner)) continue;
+
+        struct Record record;
+        if (!read_record(&scanner, &record)) return scan_report(&scanner, scanner.line);
+
+        struct Coordinate c = record.coordinate;
+        uint32_t m = coordinate_m(c);
+        const struct Coordinate *parent = NULL;
+
+        if (n == 0) {
+            curr = c;
+        } else if (seen[m + 1] && coordinate_equals(path[m + 1], coordinate_lift_by(c, 1))) {
+            parent = &path[m + 1];
+        } else {
+            sink->unordered = true;
+            return file_fail("charts are not in tree order");
+        }
+
+        sink->chart(sink, &record, parent);
+        path[m] = c;
+        seen[m] = true;
+        n++;
+    }
+    if (n == 0) return file_fail("no charts before " FILE_MARKER_CURR);
+    const char *middle = scanner.at;
+
+    while ((scanner.at < scanner.end) && !scan_marker(&scanner, FILE_MARKER_LOCN)) {
+        if (scan_blank(&scanner)) continue;
+
+        bool ok = read_coordinate(&scanner, &curr);
+        if (ok && !scan_line_end(&scanner)) ok = scan_fail(&scanner, "unexpected text at end of line");
+        if (!ok) return scan_report(&scanner, scanner.line);
+    }
+    sink->curr(sink, curr);
+
+    /* a first pass counts the locations, which the binary format gives up front */
+    struct Scanner start = scanner;
+    uint64_t count = 0;
+    while ((scanner.at < scanner.end) && !scan_marker(&scanner, FILE_MARKER_NULL)) {
+        if (scan_blank(&scanner)) continue;
+        scan_skip_line(&scanner);
+        count++;
+    }
+    sink->locations(sink, count);
+
+    scanner = start;
+    while ((scanner.at < scanner.end) && !scan_section_end(&scanner, FILE_MARKER_NULL, &tail)) {
+        if (scan_blank(&scanner)) continue;
+
+        struct Location *location = read_location(&scanner);
+        if (!location) return scan_report(&scanner, scanner.line);
+        sink->location(sink, location_coordinate(location), location_type(location));
+        location_destroy(location);
+    }
+
+    if (summed) {
+        struct Sums sums = { 0, 0 };
+        if (charts_end) sums.charts = sum_section(charts, (size_t)(charts_end - charts));
+        if (!read_text_check(&scanner, middle, tail, sums)) return false;
+    }
+    return true;
+}
+
+
+bool stream_binary(const unsigned char *data, size_t len, struct Sink *sink)
+{
+    size_t end = 0;
+    if (!read_binary_header(data, len, &end)) return false;
+
+    struct Reader reader = { data + FILE_BINARY_HEADER, data + end, true };
+    struct Trail trail = { .root = true };
+    struct Record record;
+    uint32_t top = 0;
+
+    while (read_binary_record(&reader, &trail, &record)) {
+        uint32_t m = coordinate_m(record.coordinate);
+
+        /* the root is the only chart at its level or above */
+        if (top == 0) {
+            top = m + 1;
+            sink->chart(sink, &record, NULL);
+        } else if (m + 1 < top) {
+            sink->chart(sink, &record, &trail.path[m + 1]);
+        } else {
+            return file_fail("malformed chart data");
+        }
+    }
+    if (!reader.ok || (top == 0)) return file_fail("malformed chart data");
+
+    sink->curr(sink, read_binary_coordinate(&reader));
+
+    uint64_t n = reader_varint(&reader);
+    struct Coordinate last = coordinate_origin();
+    enum LOCATION t;
+    sink->locations(sink, n);
+
+    for (uint64_t i = 0; (i < n) && read_binary_location(&reader, &last, &t); i++) sink->location(sink, last, t);
+    if (!reader.ok) return file_fail("malformed location data");
+
+    return true;
+}
+
+
+/* stubs are read in on the way down and their blocks let go on the way back up, so a
+ * tiled file is walked in memory bounded by HEX_MEMORY */
+bool stream_chart(const struct Atlas *atlas, struct Chart *chart, const struct Chart *parent, struct Sink *sink)
+{
+    if (!chart) return true;
+    if (!atlas_fault(atlas, chart)) return file_fail("cannot read block");
+
+    struct Record record;
+    struct Coordinate up = (parent) ? chart_coordinate(parent) : coordinate_origin();
+    chart_record(chart, &record);
+    sink->chart(sink, &record, (parent) ? &up : NULL);
+
+    if (chart_has_children(chart)) {
+        for (int i = 0; i < NUM_CHILDREN; i++) {
+            if (!stream_chart(atlas, chart_child(chart, i), chart, sink)) return false;
+        }
+    }
+
+    if (coordinate_m(record.coordinate) == FILE_TILED_LEVEL) atlas_trim(atlas);
+    return true;
+}
+
+
+bool stream_atlas(const struct Atlas *atlas, struct Sink *sink)
+{
+    if (!stream_chart(atlas, atlas_root(atlas), NULL, sink)) return false;
+
+    uint64_t n = 0;
+    for (struct Directory *d = atlas_directory(atlas); d; d = directory_next(d)) n++;
+
+    sink->curr(sink, atlas_coordinate(atlas));
+    sink->locations(sink, n);
+    for (struct Directory *d = atlas_directory(atlas); d; d = directory_next(d)) {
+        struct Location *location = directory_location(d);
+        sink->location(sink, location_coordinate(location), location_type(location));
+    }
+    return true;
+}
+
+
+/* the named file streamed into the sink, loaded as an atlas when it cannot be streamed
+ * record by record or force is set */
+bool stream_file(const char *filename, struct Sink *sink, bool force)
+{
+    enum FORMAT format = file_format(filename);
+    bool compressed = file_compressed(filename);
+    file_error_message[0] = '\0';
+
+    if (force || (format == FORMAT_TILED) || format_records(format) || journal_exists(filename)) {
+        struct Atlas *atlas = file_read(filename);
+        if (!atlas) return (file_error()) ? false : file_fail("cannot read file");
+
+        bool ok = stream_atlas(atlas, sink);
+        atlas_destroy(atlas);
+        if (ok) sink->finish(sink);
+        return ok;
+    }
+
+    size_t len = 0;
+    const char *data = (compressed) ? decompress_file(filename, &len) : file_map(filename, &len);
+    if (!data) return file_fail((compressed) ? "cannot decompress file" : "cannot map an empty or unreadable file");
+
+    bool ok = (format == FORMAT_BINARY)
+        ? stream_binary((const unsigned char *)data, len, sink)
+        : stream_text(data, len, sink);
+
+    if (compressed) free((char *)data);
+    else file_unmap(data, len);
+    if (ok) sink->finish(sink);
+    return ok;
+}
+
+
+bool file_same(const char *a, const char *b)
+{
+    struct stat sa, sb;
+    if ((stat(a, &sa) != 0) || (stat(b, &sb) != 0)) return false;
+    return (sa.st_dev == sb.st_dev) && (sa.st_ino == sb.st_ino);
+}
+
+
+bool convert_stream(const char *from, const char *path, const char *to, bool force)
+{
+    FILE *file = fopen(path, "w");
+    if (!file) return file_fail("cannot create output file");
+
+    struct Compressor *compressor = NULL;
+    if (file_compressed(to) && !(compressor = compressor_create(file))) {
+        fclose(file);
+        return file_fail("cannot compress output file");
+    }
+
+    struct Buffer *buffer = buffer_create(file, compressor);
+    struct Sink sink = sink_writer(file_format(to), buffer);
+    bool ok = stream_file(from, &sink, force);
+
+    bool written = buffer_destroy(buffer);
+    written = !ferror(file) && written;
+    written = (fclose(file) == 0) && written;
+
+    /* charts out of tree order can only be put right by loading them */
+    if (!ok && sink.unordered && !force) return convert_stream(from, path, to, true);
+    if (ok && !written) ok = file_fail("cannot write output file");
+    return ok;
+}
+
+
+/*
+ *  Convert between any two formats, streaming when neither side needs a whole atlas. The
+ *  output is written beside its final name, so a failed conversion leaves any old file be.
+ */
+bool file_convert(const char *from, const char *to)
+{
+    if (!from || !to) return false;
+    file_error_message[0] = '\0';
+    if (file_same(from, to)) return file_fail("input and output are the same file");
+
+    if (file_format(to) == FORMAT_TILED) {
+        struct Atlas *atlas = file_read(from);
+        if (!atlas) return (file_error()) ? false : file_fail("cannot read file");
+
+        bool ok = file_save_atomic(to, atlas);
+        atlas_destroy(atlas);
+        if (!ok) return file_fail("cannot write output file");
+
+        journal_remove(to);
+        return true;
+    }
+
+    char *path = malloc(strlen(to) + sizeof(FILE_EXT_TEMP));
+    strcpy(path, to);
+    strcat(path, FILE_EXT_TEMP);
+
+    bool ok = convert_stream(from, path, to, false);
+    if (ok && (rename(path, to) != 0)) ok = file_fail("cannot write output file");
+    if (!ok) unlink(path);
+    else journal_remove(to);
+
+    free(path);
+    return ok;
+}
+
+
+bool file_stats(const char *filename, struct Stats *stats)
+{
+    if (!filename || !stats) return false;
+
+    memset(stats, 0, sizeof(struct Stats));
+    struct Sink sink = sink_counter(stats);
+    if (stream_file(filename, &sink, false)) return true;
+    if (!sink.unordered) return false;
+
+    memset(stats, 0, sizeof(struct Stats));
+    sink = sink_counter(stats);
+    return stream_file(filename, &sink, true);
+}
+
+/*==========================================================
+ *  VERIFY
+ *
+ *  Every checksum in a save taken and compared, without parsing any records, so backups
+ *  can be checked at the speed they can be read. Gzip's own checksum is checked as a
+ *  compressed file is inflated.
+ *========================================================*/
+
+bool verify_text(const char *data, size_t len)
+{
+    struct Scanner scanner = { data, data + len, 1, NULL };
+    if (!scan_marker(&scanner, FILE_MARKER_SUMS)) return file_fail("file has no checksums");
+
+    while (!scan_marker(&scanner, FILE_MARKER_ROOT)) {
+        if (scanner.at >= scanner.end) return file_fail("missing " FILE_MARKER_ROOT);
+        scan_skip_line(&scanner);
+    }
+
+    /* the markers are found as read_charts finds them, a newline before each */
+    const char *charts = scanner.at, *tail = NULL;
+    const char *curr = memmem(charts - 1, scanner.end - charts + 1, "\n" FILE_MARKER_CURR, sizeof(FILE_MARKER_CURR));
+    if (curr) scanner.at = curr + 1;
+    if (!curr || !scan_marker(&scanner, FILE_MARKER_CURR)) return file_fail("missing checksums, the file may be cut short");
+
+    const char *middle = scanner.at;
+    const char *null = memmem(middle - 1, scanner.end - middle + 1, "\n" FILE_MARKER_NULL, sizeof(FILE_MARKER_NULL));
+    if (null) scanner.at = null + 1;
+    if (null) scan_section_end(&scanner, FILE_MARKER_NULL, &tail);
+
+    struct Sums sums = { sum_section(charts, (size_t)(curr + 1 - charts)), 0 };
+    return read_text_check(&scanner, middle, tail, sums);
+}
+
+
+bool verify_binary(const unsigned char *data, size_t len)
+{
+    size_t end = 0;
+    if (!read_binary_header(data, len, &end)) return false;
+    if (data[4] < FILE_VERSION_SUMS) return file_fail("file has no checksums");
+    return true;
+}
+
+
+struct Audit
+{
+    const struct Tiled *tiled;
+    bool *damaged;
+};
+
+
+void verify_block(size_t i, void *data)
+{
+    struct Audit *audit = data;
+    struct Extent extent = audit->tiled->blocks[i];
+    unsigned char *bytes = tiled_read(audit->tiled, false, extent.offset, extent.len);
+
+    audit->damaged[i] = !bytes || (checksum_update(0, bytes, extent.len) != extent.crc);
+    free(bytes);
+}
+
+
+/* the index is checked as the file is opened, then the blocks, all at once on the pool */
+bool verify_tiled(const char *filename)
+{
+    struct Tiled *tiled = tiled_open(filename);
+    if (!tiled) return file_fail((file_compressed(filename)) ? "cannot decompress file" : "cannot open file");
+
+    struct Atlas *atlas = read_tiled(tiled);
+    if (!atlas) return false;
+
+    bool ok = true;
+    if (!tiled->summed) ok = file_fail("file has no checksums");
+
+    if (ok) {
+        struct Audit audit = { tiled, calloc(tiled->n ? tiled->n : 1, sizeof(bool)) };
+        parallel_for(tiled->n, verify_block, &audit);
+
+        uint32_t damaged = 0;
+        for (uint32_t i = 0; i < tiled->n; i++) damaged += audit.damaged[i];
+        free(audit.damaged);
+
+        if (damaged) {
+            snprintf(file_error_message, FILE_ERROR_SIZE, "%u of %u blocks fail their checksums", damaged, tiled->n);
+            ok = false;
+        }
+    }
+
+    atlas_destroy(atlas);
+    return ok;
+}
+
+
+/* whether every checksum in the named file matches, with file_error saying why not */
+bool file_verify(const char *filename)
+{
+    if (!filename) return false;
+    file_error_message[0] = '\0';
+
+    enum FORMAT format = file_format(filename);
+    if (format == FORMAT_TILED) return verify_tiled(filename);
+    if (format_records(format)) return file_fail("tiles and locations carry no checksums");
+
+    size_t len = 0;
+    bool compressed = file_compressed(filename);
+    const char *data = (compressed) ? decompress_file(filename, &len) : file_map(filename, &len);
+    if (!data) return file_fail((compressed) ? "cannot decompress file" : "cannot map an empty or unreadable file");
+
+    bool ok = (format == FORMAT_BINARY) ? verify_binary((const unsigned char *)data, len) : verify_text(data, len);
 
-    free(buf);
+    if (compressed) free((char *)data);
+    else file_unmap(data, len);
+    return ok;
 }
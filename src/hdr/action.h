@@ -5,8 +5,12 @@
 #include "atlas.h"
 #include "state.h"
 
+void action_autosave(void);
 void action_edit(const char *filename);
+void action_export(const char *filename);
+void action_merge(const char *args);
 void action_hint(void);
+void action_history(key k);
 void action_capture(key k);
 void action_navigate(key k);
 void action_terrain(key k);
@@ -6,37 +6,127 @@
 #include "geometry.h"
 #include "location.h"
 
+#define ATLAS_MAX_LEVEL 32
+#define CENSUS_SIZE (TERRAIN_TUNDRA + 1)
+
 struct Chart;
 struct Chart *chart_create(struct Coordinate c);
+struct Chart *chart_create_stub(struct Coordinate c, const uint32_t *census, const uint64_t *hash, uint32_t block);
+void chart_destroy(struct Chart *chart);
 bool chart_has_children(const struct Chart *chart);
 bool chart_has_tile(const struct Chart *chart);
+bool chart_is_stub(const struct Chart *chart);
 struct Chart *chart_child(const struct Chart *chart, enum CHILDREN c);
 struct Coordinate chart_coordinate(const struct Chart *chart);
 struct Tile *chart_tile(const struct Chart *chart);
 void chart_clear_tile(struct Chart *chart);
 void chart_set_tile(struct Chart *chart, struct Tile *tile);
+uint32_t chart_census(const struct Chart *chart, enum TERRAIN t);
+enum TERRAIN chart_dominant(const struct Chart *chart);
 
 struct Atlas;
+
+/* reads the subtree of a stub's block back in as an atlas of its own (from any thread,
+ * for blocks of the original file), and stores changed subtrees as new blocks
+ * (returning 1 + the block, or 0 on failure) */
+struct Loader
+{
+    struct Atlas *(*load)(void *data, uint32_t block);
+    uint32_t (*store)(void *data, const struct Chart *chart);
+    void (*release)(void *data);
+    void *data;
+};
+
+/* told of each tile about to change, before any of it is changed */
+struct Watcher
+{
+    void (*touch)(void *data, const struct Chart *chart);
+    void *data;
+};
+
+/* block reads that found the block in memory or had to load it, and how many were dropped */
+struct Paging
+{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t writes;
+    size_t resident;
+};
+
 struct Atlas *atlas_create(void);
 void atlas_initialise(struct Atlas *atlas);
 void atlas_destroy(struct Atlas *atlas);
+struct Atlas *atlas_snapshot(struct Atlas *atlas);
 struct Directory *atlas_directory(const struct Atlas *atlas);
 struct Chart *atlas_root(const struct Atlas *atlas);
 struct Chart *atlas_curr(const struct Atlas *atlas);
-void atlas_insert(struct Atlas *atlas, struct Chart *chart);
+unsigned long atlas_revision(const struct Atlas *atlas);
+void atlas_set_loader(struct Atlas *atlas, struct Loader loader);
+void atlas_set_watcher(struct Atlas *atlas, struct Watcher watcher);
+bool atlas_fault(const struct Atlas *atlas, struct Chart *chart);
+bool atlas_load_all(const struct Atlas *atlas);
+bool atlas_paged(const struct Atlas *atlas);
+void atlas_set_budget(struct Atlas *atlas, size_t bytes);
+void atlas_trim(const struct Atlas *atlas);
+struct Paging atlas_paging(const struct Atlas *atlas);
+size_t atlas_chart_bytes(uint32_t m, bool tile);
+bool atlas_prefetch(struct Atlas *atlas);
+bool atlas_prefetching(const struct Atlas *atlas);
+bool atlas_merge(struct Atlas *atlas);
+void atlas_stop_prefetch(struct Atlas *atlas);
+bool atlas_insert(struct Atlas *atlas, struct Chart *chart);
 struct Coordinate atlas_coordinate(const struct Atlas *atlas);
 struct Tile *atlas_tile(const struct Atlas *atlas);
 enum TERRAIN atlas_terrain(const struct Atlas *atlas);
 void atlas_set_terrain(struct Atlas *atlas, enum TERRAIN t);
+void atlas_set_chart_terrain(struct Atlas *atlas, struct Chart *chart, enum TERRAIN t);
+struct Tile *atlas_touch(struct Atlas *atlas, struct Coordinate c);
+struct Tile *atlas_touch_chart(struct Atlas *atlas, struct Chart *chart);
+size_t atlas_dirty_count(const struct Atlas *atlas);
+struct Coordinate atlas_dirty(const struct Atlas *atlas, size_t i);
+void atlas_clear_dirty(struct Atlas *atlas);
 struct Chart *atlas_neighbour(const struct Atlas *atlas, enum DIRECTION d);
 void atlas_step(struct Atlas *atlas, enum DIRECTION d);
 void atlas_goto(struct Atlas *atlas, struct Coordinate c);
 struct Chart *atlas_find(const struct Atlas *atlas, struct Coordinate c);
-void atlas_create_neighbours(struct Atlas *atlas);
+struct Chart *atlas_own(struct Atlas *atlas, struct Coordinate c);
+struct Location *atlas_own_location(struct Atlas *atlas, struct Location *location);
+struct Chart *atlas_peek(const struct Atlas *atlas, struct Coordinate c);
+bool atlas_region(
+    const struct Atlas *atlas,
+    struct Coordinate lo,
+    struct Coordinate hi,
+    void (*visit)(struct Chart *, void *),
+    void *data
+);
+bool atlas_peek_region(
+    const struct Atlas *atlas,
+    struct Coordinate lo,
+    struct Coordinate hi,
+    void (*visit)(struct Chart *, void *),
+    void *data
+);
+uint64_t atlas_chart_hash(const struct Atlas *atlas, struct Chart *chart);
+bool atlas_diff(
+    const struct Atlas *a,
+    const struct Atlas *b,
+    void (*visit)(struct Chart *, struct Chart *, void *),
+    void *data
+);
+bool atlas_import(struct Atlas *atlas, struct Atlas *other, int32_t dp, int32_t dq, enum MERGE policy);
+void atlas_paint(struct Atlas *atlas, struct Coordinate c, uint32_t radius, enum TERRAIN t);
 void atlas_create_location(struct Atlas *atlas, enum LOCATION t);
 void atlas_add_location(struct Atlas *atlas, struct Location *location);
+void atlas_add_locations(struct Atlas *atlas, struct Location **locations, size_t len);
 struct Coordinate atlas_viewpoint(struct Atlas *atlas);
 void atlas_recalculate_viewpoint(struct Atlas *atlas);
 void atlas_recalculate_screen(struct Atlas *atlas);
 
+struct Builder;
+struct Builder *builder_create(void);
+void builder_destroy(struct Builder *builder);
+bool builder_add(struct Builder *builder, struct Chart *chart);
+struct Atlas *builder_finish(struct Builder *builder);
+
 #endif
@@ -0,0 +1,13 @@
+#ifndef AUTOSAVE_H
+#define AUTOSAVE_H
+
+#include <stdbool.h>
+
+#include "atlas.h"
+
+void autosave_initialise(void);
+void autosave_deinitialise(const struct Atlas *atlas);
+bool autosave_update(const struct Atlas *atlas, const char *filename);
+const char *autosave_filename(void);
+
+#endif
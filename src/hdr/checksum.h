@@ -0,0 +1,10 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+uint32_t checksum_update(uint32_t crc, const void *data, size_t len);
+uint32_t checksum_combine(uint32_t crc1, uint32_t crc2, uint64_t len2);
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef CLI_H
+#define CLI_H
+
+#include <stdbool.h>
+
+bool cli_is_command(const char *arg);
+int cli_run(int argc, char *argv[]);
+
+#endif
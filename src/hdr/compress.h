@@ -0,0 +1,19 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+struct Compressor;
+struct Compressor *compressor_create(FILE *file);
+void compressor_write(struct Compressor *compressor, const void *data, size_t len);
+bool compressor_finish(struct Compressor *compressor);
+char *decompress_file(const char *filename, size_t *len);
+
+struct Inflater;
+struct Inflater *inflater_create(FILE *file);
+size_t inflater_read(struct Inflater *inflater, void *data, size_t len);
+bool inflater_finish(struct Inflater *inflater);
+
+#endif
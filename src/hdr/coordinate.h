@@ -2,6 +2,7 @@
 #define COORDINATE_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include "enum.h"
@@ -27,6 +28,8 @@ struct Coordinate coordinate_add(struct Coordinate c1, struct Coordinate c2);
 struct Coordinate coordinate_scale(struct Coordinate c, int s);
 struct Coordinate coordinate_shift(struct Coordinate c, enum DIRECTION d);
 struct Coordinate coordinate_nshift(struct Coordinate c, enum DIRECTION d, int n);
+uint32_t coordinate_distance(struct Coordinate c1, struct Coordinate c2);
+size_t coordinate_disk(struct Coordinate c, uint32_t radius, struct Coordinate *out);
 uint32_t coordinate_m(struct Coordinate c);
 int32_t coordinate_p(struct Coordinate c);
 int32_t coordinate_q(struct Coordinate c);
@@ -2,6 +2,7 @@
 #define ENUM_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <ncurses.h>
 
 
@@ -42,11 +43,12 @@ enum COLOUR_PAIR
 void colour_initialise(void);
 
 
-#define NUM_UI_PANELS 9
+#define NUM_UI_PANELS 10
 enum UI_PANEL
 {
     PANEL_SPLASH,
     PANEL_DETAIL,
+    PANEL_MINIMAP,
     PANEL_HINT,
     PANEL_NAVIGATE,
     PANEL_TERRAIN,
@@ -97,10 +99,15 @@ enum TERRAIN
     TERRAIN_TUNDRA
 };
 
+#define NUM_TERRAIN_TABLE (TERRAIN_TUNDRA + 1)
+
+void terrain_initialise(void);
+const chtype *terrain_attrs(enum TERRAIN t);
 const char *terrain_name(enum TERRAIN t);
 const char *terrain_chopts(enum TERRAIN t);
 int terrain_colour(enum TERRAIN t, char c);
 attr_t terrain_font(enum TERRAIN t, char c);
+uint32_t terrain_rgb(enum TERRAIN t);
 bool terrain_impassable(enum TERRAIN t);
 const char *terrain_statusline(void);
 
@@ -113,6 +120,10 @@ enum LOCATION
     LOCATION_DUNGEON
 };
 
+#define NUM_LOCATION_TABLE (LOCATION_DUNGEON + 1)
+
+const char *location_name(enum LOCATION l);
+
 
 #define NUM_DIRECTIONS 6
 enum DIRECTION
@@ -129,6 +140,7 @@ enum DIRECTION
 enum DIRECTION direction_opposite(enum DIRECTION d);
 enum DIRECTION direction_next(enum DIRECTION d);
 enum DIRECTION direction_prev(enum DIRECTION d);
+const char *direction_name(enum DIRECTION d);
 
 
 #define NUM_CHILDREN 9
@@ -153,6 +165,8 @@ enum COMMAND
     COMMAND_QUIT,
     COMMAND_WRITE,
     COMMAND_EDIT,
+    COMMAND_EXPORT,
+    COMMAND_MERGE,
 };
 
 const char *command_str(enum COMMAND c);
@@ -166,8 +180,35 @@ enum STATUS
     STATUS_SUCCESS_EDIT_OLD,
     STATUS_ERROR_WRITE,
     STATUS_ERROR_EDIT,
+    STATUS_SUCCESS_EXPORT,
+    STATUS_ERROR_EXPORT,
+    STATUS_ERROR_AUTOSAVE,
+    STATUS_SUCCESS_MERGE,
+    STATUS_ERROR_MERGE,
 };
 
 const char *status_string(enum STATUS s);
 
+
+/* which tile a merge keeps where both worlds have one of known terrain */
+enum MERGE
+{
+    MERGE_OURS,
+    MERGE_THEIRS
+};
+
+#define NUM_MERGE_TABLE (MERGE_THEIRS + 1)
+
+const char *merge_str(enum MERGE m);
+
+
+enum FORMAT
+{
+    FORMAT_TEXT,
+    FORMAT_BINARY,
+    FORMAT_TILED,
+    FORMAT_JSONL,
+    FORMAT_CSV,
+};
+
 #endif
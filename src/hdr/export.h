@@ -0,0 +1,13 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "atlas.h"
+
+bool export_ppm(FILE *file, const struct Atlas *atlas);
+bool export_svg(FILE *file, const struct Atlas *atlas);
+bool export_file(const char *filename, const struct Atlas *atlas);
+
+#endif
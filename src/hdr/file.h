@@ -1,9 +1,34 @@
 #ifndef WRITE_H
 #define WRITE_H
 
+#include <stdint.h>
+
+#include "atlas.h"
 #include "state.h"
 
+/* what a save holds, counted as it is read */
+struct Stats
+{
+    size_t charts[ATLAS_MAX_LEVEL];
+    size_t terrain[CENSUS_SIZE];
+    size_t locations[NUM_LOCATION_TABLE];
+    size_t tiles;
+    size_t bytes;               /* the atlas it would load into, before paging */
+    uint32_t depth;
+};
+
 void write_state(FILE *file);
 void read_state(FILE *file);
+enum FORMAT file_format(const char *filename);
+bool file_compressed(const char *filename);
+struct Atlas *file_read(const char *filename);
+struct Atlas *file_load(const char *filename);
+bool file_save(const char *filename, const struct Atlas *atlas);
+bool file_save_atomic(const char *filename, const struct Atlas *atlas);
+bool file_write(const char *filename, struct Atlas *atlas);
+bool file_convert(const char *from, const char *to);
+bool file_stats(const char *filename, struct Stats *stats);
+bool file_verify(const char *filename);
+const char *file_error(void);
 
 #endif
@@ -0,0 +1,18 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdbool.h>
+
+#include "atlas.h"
+
+void history_clear(void);
+void history_checkpoint(struct Atlas *snapshot);
+void history_begin(void);
+bool history_can_undo(void);
+bool history_can_redo(void);
+void history_touch(void *data, const struct Chart *chart);
+struct Watcher history_watcher(void);
+bool history_undo(struct Atlas *atlas);
+bool history_redo(struct Atlas *atlas);
+
+#endif
@@ -6,6 +6,9 @@
 #include "enum.h"
 #include "state.h"
 
+#define MINIMAP_ROWS 15
+#define MINIMAP_COLS 41
+
 struct UserInterface;
 
 void ui_initialise(void);
@@ -21,4 +24,9 @@ unsigned int panel_height(struct Panel *p);
 size_t panel_len(struct Panel *p);
 char *panel_line(struct Panel *p, size_t i);
 
+int minimap_rows(void);
+int minimap_cols(void);
+enum TERRAIN minimap_terrain(int r, int c);
+bool minimap_is_outline(int r, int c);
+
 #endif
@@ -19,10 +19,17 @@
 #define         KEY_TOGGLE_HELP '?'
 #define       KEY_TOGGLE_DETAIL 'j'
 #define     KEY_TOGGLE_RETICULE 'x'
+#define      KEY_TOGGLE_MINIMAP 'o'
 
 #define             KEY_ZOOM_IN '+'
 #define            KEY_ZOOM_OUT '_'
 
+#define        KEY_HISTORY_UNDO '<'
+#define        KEY_HISTORY_REDO '>'
+
+#define       KEY_BRUSH_SMALLER '['
+#define        KEY_BRUSH_LARGER ']'
+
 #define                  KEY_EE 'k'
 #define                  KEY_NE 'i'
 #define                  KEY_NW 'u'
@@ -17,5 +17,7 @@ void directory_destroy(struct Directory *directory);
 void directory_insert(struct Directory **directory, struct Location *location);
 struct Directory *directory_next(const struct Directory *directory);
 struct Location *directory_location(const struct Directory *directory);
+struct Directory *directory_share(struct Directory *directory);
+struct Location *directory_own(struct Directory **directory, struct Location *location);
 
 #endif
@@ -0,0 +1,11 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stddef.h>
+
+void parallel_initialise(unsigned int n);
+void parallel_deinitialise(void);
+unsigned int parallel_threads(void);
+void parallel_for(size_t n, void (*job)(size_t i, void *data), void *data);
+
+#endif
@@ -8,6 +8,8 @@
 struct State;
 
 key state_key_curr(void);
+uint32_t state_brush(void);
+void state_set_brush(uint32_t b);
 bool state_quit(void);
 void state_initialise(WINDOW *win, const char *str_filename);
 void state_update(void);
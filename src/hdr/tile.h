@@ -2,6 +2,7 @@
 #define TILE_H
 
 #include <stdbool.h>
+#include <stddef.h>
 
 #include "coordinate.h"
 #include "enum.h"
@@ -10,7 +11,9 @@
 struct Tile;
 
 struct Tile *tile_create(void);
+struct Tile *tile_copy(const struct Tile *tile);
 void tile_destroy(struct Tile *tile);
+size_t tile_size(void);
 unsigned int tile_seed(const struct Tile *tile);
 uint8_t tile_roads(const struct Tile *tile);
 uint8_t tile_rivers(const struct Tile *tile);
@@ -29,6 +32,12 @@ void tile_toggle_river(struct Tile *tile, enum DIRECTION d);
 void tile_clear_rivers(struct Tile *tile);
 struct Location *tile_location(struct Tile *tile);
 void tile_set_location(struct Tile *tile, struct Location *location);
+bool tile_dirty(const struct Tile *tile);
+void tile_set_dirty(struct Tile *tile, bool dirty);
+uint32_t tile_shares(const struct Tile *tile);
+void tile_set_shares(struct Tile *tile, uint32_t shares);
+uint64_t tile_hash(const struct Tile *tile);
 char tile_getch(struct Tile *tile, int x, int y);
+void tile_getch_row(const struct Tile *tile, int x0, int n, int y, char *out);
 
 #endif
@@ -0,0 +1,343 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "hdr/atlas.h"
+#include "hdr/history.h"
+#include "hdr/location.h"
+#include "hdr/tile.h"
+
+/*
+ *  Undo and redo as a ring of delta records, each holding one tile as it was before an
+ *  edit. The edits made by one keystroke form a transaction. Undoing one swaps each tile
+ *  with its record, last first, so the record then holds the tile as it was after, ready
+ *  to be redone in order. A tile recorded twice in a transaction only costs the space, so
+ *  repeats are looked for among the last few records alone. The ring never grows: once it
+ *  is full, the oldest transactions are dropped whole.
+ *
+ *  Edits too large for the ring, such as merging in another map, leave a checkpoint
+ *  instead: a snapshot of the atlas from before, sharing everything the edit left alone.
+ *  Undoing past the ring's oldest transaction puts back whatever differs from it.
+ */
+
+#define HISTORY_SIZE (1 << 16)          /* records, a power of two */
+#define HISTORY_MASK (HISTORY_SIZE - 1)
+#define HISTORY_LOOKBACK 16             /* records searched for the tile before adding it */
+
+/* flags byte [f . . . h l l l]:
+ *  f - the first record of a transaction
+ *  h - the tile has a location
+ *  l - the location's type
+ */
+#define HISTORY_FIRST 0x80
+#define HISTORY_LOCATED 0x08
+#define HISTORY_LOCATION 0x07
+
+
+/* a tile's terrain, roads, rivers and location, in twelve bytes */
+struct Delta
+{
+    int32_t p;
+    int32_t q;
+    uint8_t terrain;
+    uint8_t roads;
+    uint8_t rivers;
+    uint8_t flags;
+};
+
+
+/* positions count records ever written, so tail <= done <= head <= tail + HISTORY_SIZE */
+struct History
+{
+    struct Delta ring[HISTORY_SIZE];
+    uint64_t tail;              /* the oldest record kept, always the first of a transaction */
+    uint64_t start;             /* the first record of the transaction being written */
+    uint64_t done;              /* the end of what can be undone */
+    uint64_t head;              /* the end of what can be redone */
+    bool started;               /* the transaction being written has a record */
+    bool lost;                  /* the transaction outgrew the ring and is not being kept */
+    bool applying;              /* touches are undo and redo's own */
+    struct Atlas *checkpoint;   /* the atlas as it was before the oldest record, if kept */
+};
+
+
+struct History history = { 0 };
+
+
+static inline struct Delta *history_at(uint64_t position)
+{
+    return &history.ring[position & HISTORY_MASK];
+}
+
+
+void history_drop_checkpoint(void)
+{
+    atlas_destroy(history.checkpoint);
+    history.checkpoint = NULL;
+}
+
+
+void history_clear(void)
+{
+    history.tail = history.start = history.done = history.head = 0;
+    history.started = false;
+    history.lost = false;
+    history_drop_checkpoint();
+}
+
+
+/* start again from a snapshot taken before an edit the ring cannot hold, which history
+ * then owns; with no snapshot, the edit cannot be undone */
+void history_checkpoint(struct Atlas *snapshot)
+{
+    history_clear();
+    history.checkpoint = snapshot;
+}
+
+
+void history_begin(void)
+{
+    history.started = false;
+}
+
+
+bool history_can_undo(void) { return (history.done > history.tail) || history.checkpoint; }
+bool history_can_redo(void) { return history.head > history.done; }
+
+
+struct Delta history_delta(const struct Chart *chart)
+{
+    struct Coordinate c = chart_coordinate(chart);
+    struct Tile *tile = chart_tile(chart);
+    struct Location *location = tile_location(tile);
+
+    struct Delta delta = {
+        .p = coordinate_p(c),
+        .q = coordinate_q(c),
+        .terrain = (uint8_t)tile_terrain(tile),
+        .roads = tile_roads(tile),
+        .rivers = tile_rivers(tile),
+        .flags = (location) ? HISTORY_LOCATED | (location_type(location) & HISTORY_LOCATION) : 0,
+    };
+    return delta;
+}
+
+
+/* make room for one more record, dropping the oldest transactions; false if the one being
+ * written would have to go too */
+bool history_reserve(void)
+{
+    if (history.done - history.tail < HISTORY_SIZE) return true;
+
+    history_drop_checkpoint();
+    do {
+        history.tail++;
+    } while ((history.tail < history.start) && !(history_at(history.tail)->flags & HISTORY_FIRST));
+
+    return history.tail < history.start;
+}
+
+
+/* the watcher on the atlas: the tile is recorded before it changes */
+void history_touch(void *data, const struct Chart *chart)
+{
+    (void)data;
+    if (history.applying || !chart_tile(chart)) return;
+
+    if (!history.started) {
+        history.started = true;
+        history.lost = false;
+        history.start = history.head = history.done;
+    } else if (history.lost) {
+        return;
+    } else {
+        struct Coordinate c = chart_coordinate(chart);
+        uint64_t from = (history.done - history.start > HISTORY_LOOKBACK) ? history.done - HISTORY_LOOKBACK : history.start;
+        for (uint64_t i = history.done; i-- > from; ) {
+            struct Delta *delta = history_at(i);
+            if ((delta->p == coordinate_p(c)) && (delta->q == coordinate_q(c))) return;
+        }
+    }
+
+    if (!history_reserve()) {
+        history_drop_checkpoint();
+        history.lost = true;
+        history.tail = history.start = history.done = history.head;
+        return;
+    }
+
+    struct Delta delta = history_delta(chart);
+    if (history.done == history.start) delta.flags |= HISTORY_FIRST;
+    *history_at(history.done++) = delta;
+    history.head = history.done;
+}
+
+
+struct Watcher history_watcher(void)
+{
+    return (struct Watcher) { history_touch, NULL };
+}
+
+
+/* put the tile back as the record has it, leaving the record holding the tile as it was */
+void history_swap(struct Atlas *atlas, struct Delta *delta)
+{
+    struct Coordinate c = coordinate(delta->p, delta->q, -(delta->p + delta->q), 0);
+    struct Chart *chart = atlas_find(atlas, c);
+    if (!chart_tile(chart)) return;
+
+    struct Delta now = history_delta(chart);
+    now.flags |= delta->flags & HISTORY_FIRST;
+
+    atlas_set_chart_terrain(atlas, chart, (enum TERRAIN)delta->terrain);
+    struct Tile *tile = atlas_touch_chart(atlas, chart);
+    tile_set_roads(tile, delta->roads);
+    tile_set_rivers(tile, delta->rivers);
+
+    /* locations are never taken out of the directory, only set to none */
+    enum LOCATION t = (delta->flags & HISTORY_LOCATED) ? (enum LOCATION)(delta->flags & HISTORY_LOCATION) : LOCATION_NONE;
+    if (tile_location(tile)) location_set_type(tile_location(tile), t);
+    else if (t != LOCATION_NONE) atlas_add_location(atlas, location_create(c, t));
+
+    *delta = now;
+}
+
+
+struct Revert
+{
+    struct Coordinate *coordinates;
+    size_t len, cap;
+};
+
+
+void history_revert_visit(struct Chart *live, struct Chart *before, void *data)
+{
+    struct Revert *revert = data;
+
+    if (revert->len == revert->cap) {
+        revert->cap = (revert->cap) ? 2*revert->cap : 256;
+        revert->coordinates = realloc(revert->coordinates, revert->cap * sizeof(struct Coordinate));
+    }
+    revert->coordinates[revert->len++] = chart_coordinate((live) ? live : before);
+}
+
+
+/* a tile set as the checkpoint has it, or blanked to unknown if it was not there before;
+ * false if there is no putting it back */
+bool history_revert_tile(struct Atlas *atlas, struct Coordinate c)
+{
+    struct Tile *was = chart_tile(atlas_find(history.checkpoint, c));
+    struct Chart *chart = atlas_find(atlas, c);
+    if (!chart) {
+        chart = chart_create(c);
+        if (!atlas_insert(atlas, chart)) {
+            chart_destroy(chart);
+            return false;
+        }
+    }
+
+    atlas_set_chart_terrain(atlas, chart, (was) ? tile_terrain(was) : TERRAIN_UNKNOWN);
+    struct Tile *tile = atlas_touch_chart(atlas, chart);
+    if (was) tile_set_seed(tile, tile_seed(was));
+    tile_set_roads(tile, (was) ? tile_roads(was) : 0);
+    tile_set_rivers(tile, (was) ? tile_rivers(was) : 0);
+    return true;
+}
+
+
+/* locations are not in the tiles' hashes, so each is checked against the checkpoint,
+ * including any no tile holds any more, which a later load could attach instead */
+void history_revert_locations(struct Atlas *atlas)
+{
+    size_t len = 0, i = 0;
+    for (struct Directory *d = atlas_directory(atlas); d; d = directory_next(d)) len++;
+
+    struct Location **locations = malloc((len ? len : 1) * sizeof(struct Location *));
+    for (struct Directory *d = atlas_directory(atlas); d; d = directory_next(d)) locations[i++] = directory_location(d);
+
+    for (i = 0; i < len; i++) {
+        struct Coordinate c = location_coordinate(locations[i]);
+        struct Tile *before = chart_tile(atlas_find(history.checkpoint, c));
+        struct Location *was = (before) ? tile_location(before) : NULL;
+        enum LOCATION t = (was) ? location_type(was) : LOCATION_NONE;
+        if (location_type(locations[i]) == t) continue;
+
+        struct Chart *chart = atlas_find(atlas, c);
+        if (chart_tile(chart) && (tile_location(chart_tile(chart)) == locations[i])) {
+            location_set_type(tile_location(atlas_touch_chart(atlas, chart)), t);
+        } else {
+            location_set_type(atlas_own_location(atlas, locations[i]), t);
+        }
+    }
+    free(locations);
+
+    for (struct Directory *d = atlas_directory(history.checkpoint); d; d = directory_next(d)) {
+        struct Location *location = directory_location(d);
+        struct Coordinate c = location_coordinate(location);
+        struct Tile *tile = chart_tile(atlas_find(atlas, c));
+        if (tile && !tile_location(tile)) atlas_add_location(atlas, location_create(c, location_type(location)));
+    }
+}
+
+
+/* back to the checkpoint, finding what differs from it by the subtrees no longer shared;
+ * the checkpoint is kept if some tile could not be put back */
+bool history_revert(struct Atlas *atlas)
+{
+    struct Revert revert = { NULL, 0, 0 };
+    if (!atlas_diff(atlas, history.checkpoint, history_revert_visit, &revert)) {
+        free(revert.coordinates);
+        return false;
+    }
+
+    bool ok = true;
+    history.applying = true;
+    for (size_t i = 0; i < revert.len; i++) ok = history_revert_tile(atlas, revert.coordinates[i]) && ok;
+    history_revert_locations(atlas);
+    history.applying = false;
+
+    if (revert.len) atlas_goto(atlas, revert.coordinates[0]);
+    free(revert.coordinates);
+    if (ok) history_clear();
+    return ok;
+}
+
+
+/* the last transaction undone, with the cursor put back on the first tile it changed */
+bool history_undo(struct Atlas *atlas)
+{
+    if (!atlas || !history_can_undo()) return false;
+    if (history.done == history.tail) return history_revert(atlas);
+
+    uint64_t end = history.done, start = end - 1;
+    while (!(history_at(start)->flags & HISTORY_FIRST)) start--;
+
+    history.applying = true;
+    for (uint64_t i = end; i-- > start; ) history_swap(atlas, history_at(i));
+    history.applying = false;
+
+    struct Delta *first = history_at(start);
+    atlas_goto(atlas, coordinate(first->p, first->q, -(first->p + first->q), 0));
+    history.done = start;
+    history.started = false;
+    return true;
+}
+
+
+bool history_redo(struct Atlas *atlas)
+{
+    if (!atlas || !history_can_redo()) return false;
+
+    uint64_t start = history.done, end = start + 1;
+    while ((end < history.head) && !(history_at(end)->flags & HISTORY_FIRST)) end++;
+
+    history.applying = true;
+    for (uint64_t i = start; i < end; i++) history_swap(atlas, history_at(i));
+    history.applying = false;
+
+    struct Delta *first = history_at(start);
+    atlas_goto(atlas, coordinate(first->p, first->q, -(first->p + first->q), 0));
+    history.done = end;
+    history.started = false;
+    return true;
+}
@@ -117,6 +117,122 @@ struct Panel *panel[NUM_UI_PANELS] = { 0 };
 bool show[NUM_UI_PANELS] = { 0 };
 
 
+/*
+ *  The minimap draws one cell per chart at the lowest level where the whole root chart
+ *  fits in the panel, coloured by the most common terrain in that chart's census. Only
+ *  the terrain is kept: charts move whenever the atlas changes (a shared chart copied
+ *  on write, a block dropped), so every revision looks them all up again. Lookups
+ *  never read blocks in.
+ */
+struct Minimap
+{
+    const struct Atlas *atlas;
+    const struct Chart *root;
+    unsigned long revision;
+    uint64_t evictions;
+    struct Coordinate centre;
+    enum TERRAIN terrain[MINIMAP_ROWS][MINIMAP_COLS];
+    int r0, c0, r1, c1;
+};
+
+struct Minimap minimap = { 0 };
+
+
+int minimap_rows(void) { return MINIMAP_ROWS; }
+int minimap_cols(void) { return MINIMAP_COLS; }
+
+
+enum TERRAIN minimap_terrain(int r, int c)
+{
+    if ((r < 0) || (r >= MINIMAP_ROWS) || (c < 0) || (c >= MINIMAP_COLS)) return TERRAIN_NONE;
+    return minimap.terrain[r][c];
+}
+
+
+bool minimap_is_outline(int r, int c)
+{
+    if ((r < minimap.r0) || (r > minimap.r1) || (c < minimap.c0) || (c > minimap.c1)) {
+        return false;
+    }
+    return (r == minimap.r0) || (r == minimap.r1) || (c == minimap.c0) || (c == minimap.c1);
+}
+
+
+/* the chart coordinate under a cell of the minimap, two columns to a hex */
+struct Coordinate minimap_cell_coordinate(int r, int c)
+{
+    int32_t dq = r - MINIMAP_ROWS/2;
+    int32_t dx = c - MINIMAP_COLS/2 - dq;
+    int32_t dp = (dx >= 0) ? dx / 2 : -((1 - dx) / 2);
+    int32_t p = coordinate_p(minimap.centre) + dp, q = coordinate_q(minimap.centre) + dq;
+
+    return coordinate(p, q, -(p + q), coordinate_m(minimap.centre));
+}
+
+
+void minimap_cell_of(struct Coordinate tile, int *r, int *c)
+{
+    struct Coordinate cell = coordinate_lift_to(tile, coordinate_m(minimap.centre));
+    int32_t dp = coordinate_p(cell) - coordinate_p(minimap.centre),
+            dq = coordinate_q(cell) - coordinate_q(minimap.centre);
+
+    *r = dq + MINIMAP_ROWS/2;
+    *c = 2*dp + dq + MINIMAP_COLS/2;
+}
+
+
+void minimap_rebuild(const struct Atlas *atlas)
+{
+    minimap.atlas = atlas;
+    minimap.root = atlas_root(atlas);
+    minimap.revision = atlas_revision(atlas);
+    minimap.evictions = atlas_paging(atlas).evictions;
+
+    /* drop down from the root until one more level would not fit */
+    struct Coordinate centre = chart_coordinate(minimap.root);
+    int32_t span = 0;
+    while (coordinate_m(centre) > 0) {
+        int32_t next = 3*span + 1;
+        if ((2*next + 1 > MINIMAP_ROWS) || (6*next + 2 > MINIMAP_COLS)) break;
+        centre = coordinate_drop(centre, CHILD0);
+        span = next;
+    }
+    minimap.centre = centre;
+
+    for (int r = 0; r < MINIMAP_ROWS; r++) {
+        for (int c = 0; c < MINIMAP_COLS; c++) {
+            const struct Chart *chart = atlas_peek(atlas, minimap_cell_coordinate(r, c));
+            minimap.terrain[r][c] = (chart) ? chart_dominant(chart) : TERRAIN_NONE;
+        }
+    }
+}
+
+
+void minimap_refresh(const struct Atlas *atlas)
+{
+    if ((atlas != minimap.atlas) || (atlas_root(atlas) != minimap.root)
+        || (atlas_revision(atlas) != minimap.revision)
+        || (atlas_paging(atlas).evictions != minimap.evictions)) {
+        minimap_rebuild(atlas);
+    }
+
+    /* outline the tiles currently on screen */
+    struct Coordinate o = atlas_coordinate(atlas);
+    int32_t dq = geometry_tile_nh() / 2, dx = geometry_tile_nw();
+    int32_t q0 = coordinate_q(o) - dq, q1 = coordinate_q(o) + dq;
+    int32_t x0 = 2*coordinate_p(o) + coordinate_q(o) - dx,
+            x1 = 2*coordinate_p(o) + coordinate_q(o) + dx;
+
+    int r = 0, c = 0;
+    minimap_cell_of(coordinate((x0 - q0)/2, q0, -((x0 - q0)/2 + q0), 0), &r, &c);
+    minimap.r0 = r;
+    minimap.c0 = c;
+    minimap_cell_of(coordinate((x1 - q1)/2, q1, -((x1 - q1)/2 + q1), 0), &r, &c);
+    minimap.r1 = r;
+    minimap.c1 = c + 1;
+}
+
+
 void ui_initialise(void)
 {
     struct Panel *splash = panel_create(6);
@@ -134,7 +250,13 @@ void ui_initialise(void)
     panel_add_line(detail, 2, "    TERRAIN: NONE");
     panel[PANEL_DETAIL] = detail;
 
-    struct Panel *hint = panel_create(9);
+    struct Panel *overview = panel_create(1);
+    panel_add_line(overview, 0, "MINIMAP");
+    overview->w = MINIMAP_COLS + 4;
+    overview->h = MINIMAP_ROWS + 5;
+    panel[PANEL_MINIMAP] = overview;
+
+    struct Panel *hint = panel_create(10);
     panel_add_line(hint, 0, "MODES AND OPTIONS  ");
     panel_add_line(hint, 1, "                   ");
     panel_add_line(hint, 2, "  T/t   Terrain    ");
@@ -143,10 +265,11 @@ void ui_initialise(void)
     panel_add_line(hint, 5, "  F/f   Locations  ");
     panel_add_line(hint, 6, "                   ");
     panel_add_line(hint, 7, "    :   Command    ");
-    panel_add_line(hint, 8, "    ?   Help       ");
+    panel_add_line(hint, 8, "  < >   Undo/Redo  ");
+    panel_add_line(hint, 9, "    ?   Help       ");
     panel[PANEL_HINT] = hint;
 
-    struct Panel *navigate = panel_create(10);
+    struct Panel *navigate = panel_create(11);
     panel_add_line(navigate, 0, "MODE: NAVIGATION   ");
     panel_add_line(navigate, 1, "                   ");
     panel_add_line(navigate, 2, "      u   i        ");
@@ -157,23 +280,25 @@ void ui_initialise(void)
     panel_add_line(navigate, 7, "                   ");
     panel_add_line(navigate, 8, "  uihknm : 1 step  ");
     panel_add_line(navigate, 9, "  UIHKNM : 3 step  ");
+    panel_add_line(navigate, 10, "       o : minimap ");
     panel[PANEL_NAVIGATE] = navigate;
 
-    struct Panel *terrain = panel_create(14);
+    struct Panel *terrain = panel_create(15);
     panel_add_line(terrain, 0,  "MODE: TERRAIN      ");
     panel_add_line(terrain, 1,  "                   ");
     panel_add_line(terrain, 2,  "  uihknm : move    ");
     panel_add_line(terrain, 3,  "  UIHKNM : drag    ");
-    panel_add_line(terrain, 4,  "                   ");
-    panel_add_line(terrain, 5,  "    q : water      ");
-    panel_add_line(terrain, 6,  "    w : mountain   ");
-    panel_add_line(terrain, 7,  "    e : hills      ");
-    panel_add_line(terrain, 8,  "    a : plains     ");
-    panel_add_line(terrain, 9,  "    s : forest     ");
-    panel_add_line(terrain, 10, "    d : swamp      ");
-    panel_add_line(terrain, 11, "    z : desert     ");
-    panel_add_line(terrain, 12, "    x : jungle     ");
-    panel_add_line(terrain, 13, "    c : tundra     ");
+    panel_add_line(terrain, 4,  "     [ ] : brush   ");
+    panel_add_line(terrain, 5,  "                   ");
+    panel_add_line(terrain, 6,  "    q : water      ");
+    panel_add_line(terrain, 7,  "    w : mountain   ");
+    panel_add_line(terrain, 8,  "    e : hills      ");
+    panel_add_line(terrain, 9,  "    a : plains     ");
+    panel_add_line(terrain, 10, "    s : forest     ");
+    panel_add_line(terrain, 11, "    d : swamp      ");
+    panel_add_line(terrain, 12, "    z : desert     ");
+    panel_add_line(terrain, 13, "    x : jungle     ");
+    panel_add_line(terrain, 14, "    c : tundra     ");
     panel[PANEL_TERRAIN] = terrain;
 
     struct Panel *road = panel_create(12);
@@ -218,16 +343,23 @@ void ui_initialise(void)
     panel_add_line(location, 6,  "    d : dungeon    ");
     panel[PANEL_LOCATION] = location;
 
-    struct Panel *command = panel_create(5);
+    struct Panel *command = panel_create(6);
     panel_add_line(command, 0,  "MODE: COMMAND      ");
     panel_add_line(command, 1,  "                   ");
     panel_add_line(command, 2,  "    q[uit]         ");
     panel_add_line(command, 3,  "    w[rite] <path> ");
     panel_add_line(command, 4,  "    e[dit]  <path> ");
+    panel_add_line(command, 5,  "   ex[port] <path> ");
     panel[PANEL_COMMAND] = command;
 
     panel_centre(panel[PANEL_SPLASH]);
 
+    panel_set_rc(
+        panel[PANEL_MINIMAP],
+        geometry_rows() - panel_height(panel[PANEL_MINIMAP]) - 1,
+        1
+    );
+
     panel_set_rc(
         panel[PANEL_HINT],
         1,
@@ -269,6 +401,11 @@ void ui_update(void)
     snprintf(buf, 32, "  Terrain: %s", terrain_name(atlas_terrain(atlas)));
     panel_add_line(detail, 2, buf);
 
+    /*
+     *  minimap panel
+     */
+    if (show[PANEL_MINIMAP]) minimap_refresh(atlas);
+
     /*
      * help/hint panels
      */
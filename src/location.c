@@ -5,6 +5,7 @@
 struct Location {
     struct Coordinate c;
     enum LOCATION type;
+    uint32_t shares;    /* directory entries holding it besides the first */
 };
 
 struct Location *location_create(struct Coordinate c, enum LOCATION t)
@@ -13,6 +14,7 @@ struct Location *location_create(struct Coordinate c, enum LOCATION t)
 
     location->c = c;
     location->type = t;
+    location->shares = 0;
 
     return location;
 }
@@ -37,9 +39,13 @@ struct Coordinate location_coordinate(const struct Location *location)
     return location->c;
 }
 
+/* a list only ever added to at the front, so a snapshot's directory can be the tail of
+ * the atlas's: entries reached from more than one list keep count, and are copied before
+ * they are changed */
 struct Directory {
     struct Location *location;
     struct Directory *next;
+    uint32_t shares;
 };
 
 struct Directory *directory_create(struct Location *location)
@@ -48,6 +54,7 @@ struct Directory *directory_create(struct Location *location)
 
     directory->location = location;
     directory->next = NULL;
+    directory->shares = 0;
 
     return directory;
 }
@@ -58,15 +65,53 @@ void directory_destroy(struct Directory *directory)
         return;
     }
 
+    if (directory->shares) {
+        directory->shares--;
+        return;
+    }
+
     directory_destroy(directory->next);
     directory->next = NULL;
 
-    location_destroy(directory->location);
+    if (directory->location->shares) directory->location->shares--;
+    else location_destroy(directory->location);
     directory->location = NULL;
 
     free(directory);
 }
 
+struct Directory *directory_share(struct Directory *directory)
+{
+    if (directory) directory->shares++;
+    return directory;
+}
+
+/* the location as one this directory alone holds, copying every shared entry up to it and
+ * then the location itself if another directory still has it */
+struct Location *directory_own(struct Directory **directory, struct Location *location)
+{
+    for (struct Directory **entry = directory; *entry; entry = &(*entry)->next) {
+        struct Directory *d = *entry;
+
+        if (d->shares) {
+            struct Directory *copy = directory_create(d->location);
+            copy->next = directory_share(d->next);
+            d->location->shares++;
+            d->shares--;
+            *entry = d = copy;
+        }
+        if (d->location != location) continue;
+
+        if (location->shares) {
+            location->shares--;
+            d->location = location_create(location->c, location->type);
+        }
+        return d->location;
+    }
+
+    return location;
+}
+
 void directory_insert(struct Directory **directory, struct Location *location)
 {
     struct Directory *new = directory_create(location);
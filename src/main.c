@@ -3,7 +3,9 @@
 #include <stdio.h>
 
 #include "hdr/action.h"
+#include "hdr/cli.h"
 #include "hdr/draw.h"
+#include "hdr/parallel.h"
 #include "hdr/state.h"
 
 
@@ -21,6 +23,7 @@ void initialise(const char *filename)
     ESCDELAY = 10;
 
     colour_initialise();
+    terrain_initialise();
     state_initialise(stdscr, filename);
 }
 
@@ -31,11 +34,14 @@ void terminate(void)
     endwin();
 
     state_deinitialise();
+    parallel_deinitialise();
 }
 
 
 int main(int argc, char *argv[])
 {
+    if ((argc > 1) && cli_is_command(argv[1])) return cli_run(argc, argv);
+
     if (argc > 2) {
         fprintf(stderr, "\nToo many arguments\n");
         return 1;
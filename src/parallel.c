@@ -0,0 +1,165 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "hdr/parallel.h"
+
+#define PARALLEL_MAX_THREADS 64
+#define PARALLEL_ENV_THREADS "HEX_THREADS"
+
+
+struct Pool
+{
+    pthread_t threads[PARALLEL_MAX_THREADS];
+    unsigned int n;
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    void (*job)(size_t, void *);
+    void *data;
+    size_t next, len, finished;
+    unsigned long generation;
+    bool active;
+    bool quit;
+};
+
+
+struct Pool pool = {
+    .n = 0,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+};
+bool pool_running = false;
+
+
+/* take indices from the current batch until it is exhausted, expects the lock held */
+void pool_drain(void)
+{
+    while (pool.next < pool.len) {
+        size_t i = pool.next++;
+        void (*job)(size_t, void *) = pool.job;
+        void *data = pool.data;
+
+        pthread_mutex_unlock(&pool.mutex);
+        job(i, data);
+        pthread_mutex_lock(&pool.mutex);
+
+        if (++pool.finished == pool.len) pthread_cond_broadcast(&pool.done);
+    }
+}
+
+
+void *pool_worker(void *arg)
+{
+    (void)arg;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&pool.mutex);
+    while (1) {
+        while (!pool.quit && (pool.generation == seen)) {
+            pthread_cond_wait(&pool.wake, &pool.mutex);
+        }
+        if (pool.quit) break;
+        seen = pool.generation;
+        pool_drain();
+    }
+    pthread_mutex_unlock(&pool.mutex);
+
+    return NULL;
+}
+
+
+/* a forked child gets none of the workers, only the pool as they left it: run everything in place */
+void pool_forget(void)
+{
+    pthread_mutex_init(&pool.mutex, NULL);
+    pthread_cond_init(&pool.wake, NULL);
+    pthread_cond_init(&pool.done, NULL);
+    pool.n = 0;
+    pool.active = false;
+}
+
+
+void parallel_initialise(unsigned int n)
+{
+    if (pool_running) return;
+
+    static bool registered = false;
+    if (!registered) registered = (0 == pthread_atfork(NULL, NULL, pool_forget));
+
+    /* HEX_THREADS overrides the processor count when no count is asked for */
+    if ((n == 0) && getenv(PARALLEL_ENV_THREADS)) n = (unsigned int)strtoul(getenv(PARALLEL_ENV_THREADS), NULL, 10);
+
+    if (n == 0) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        n = (ncpu > 0) ? (unsigned int)ncpu : 1;
+    }
+    if (n > PARALLEL_MAX_THREADS) n = PARALLEL_MAX_THREADS;
+
+    /* the calling thread always takes part, so spawn one fewer */
+    pool.n = 0;
+    pool.quit = false;
+    for (unsigned int i = 1; i < n; i++) {
+        if (pthread_create(&pool.threads[pool.n], NULL, pool_worker, NULL)) break;
+        pool.n++;
+    }
+    pool_running = true;
+}
+
+
+void parallel_deinitialise(void)
+{
+    if (!pool_running) return;
+
+    pthread_mutex_lock(&pool.mutex);
+    pool.quit = true;
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.mutex);
+
+    for (unsigned int i = 0; i < pool.n; i++) pthread_join(pool.threads[i], NULL);
+
+    pool.n = 0;
+    pool_running = false;
+}
+
+
+unsigned int parallel_threads(void)
+{
+    if (!pool_running) parallel_initialise(0);
+    return pool.n + 1;
+}
+
+
+void parallel_for(size_t n, void (*job)(size_t i, void *data), void *data)
+{
+    if (!job || n == 0) return;
+    if (!pool_running) parallel_initialise(0);
+
+    pthread_mutex_lock(&pool.mutex);
+
+    /* somebody else has the pool, or there is nothing to share: run in place */
+    if (pool.active || (pool.n == 0) || (n == 1)) {
+        pthread_mutex_unlock(&pool.mutex);
+        for (size_t i = 0; i < n; i++) job(i, data);
+        return;
+    }
+
+    pool.active = true;
+    pool.job = job;
+    pool.data = data;
+    pool.next = 0;
+    pool.len = n;
+    pool.finished = 0;
+    pool.generation++;
+    pthread_cond_broadcast(&pool.wake);
+
+    pool_drain();
+    while (pool.finished < pool.len) pthread_cond_wait(&pool.done, &pool.mutex);
+
+    pool.job = NULL;
+    pool.data = NULL;
+    pool.active = false;
+    pthread_mutex_unlock(&pool.mutex);
+}
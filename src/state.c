@@ -8,12 +8,18 @@
 
 #include "hdr/action.h"
 #include "hdr/atlas.h"
+#include "hdr/autosave.h"
 #include "hdr/enum.h"
 #include "hdr/geometry.h"
+#include "hdr/history.h"
 #include "hdr/interface.h"
 #include "hdr/key.h"
 #include "hdr/state.h"
 
+#define STATE_TICK_MS 1000          /* idle wakeups, for the autosave          */
+#define STATE_TICK_LOADING_MS 50    /* while blocks are still arriving         */
+#define STATE_BRUSH_MAX 32          /* radius of the largest terrain brush     */
+
 
 bool quit = false;
 bool reticule = true;
@@ -23,6 +29,7 @@ char *cwd = NULL;
 enum STATUS status = STATUS_OK;
 char *message = NULL;
 key key_curr = 0;
+uint32_t brush = 0;
 enum MODE mode_curr = MODE_NONE;
 enum MODE mode_prev = MODE_NONE;
 WINDOW *window = NULL;
@@ -35,6 +42,7 @@ bool state_modified(void) { return modified; }
 const char *state_filename(void) { return filename; }
 const char *state_cwd(void) { return cwd; }
 key state_key_curr(void) { return key_curr; }
+uint32_t state_brush(void) { return brush; }
 bool state_await(void) { return mode_is_await(mode_curr); }
 WINDOW *state_window(void) { return window; }
 enum MODE state_mode(void) { return mode_curr; }
@@ -47,12 +55,15 @@ char *state_message(void) { return message; }
 void state_initialise(WINDOW *win, const char *str_filename)
 {
     window = win;
+    wtimeout(window, STATE_TICK_MS);
 
     geometry_initialise(win);
     ui_initialise();
+    autosave_initialise();
 
     atlas = atlas_create();
     atlas_initialise(atlas);
+    atlas_set_watcher(atlas, history_watcher());
 
     char cwd[PATH_MAX] = { 0 };
     getcwd(cwd, PATH_MAX);
@@ -72,8 +83,15 @@ void state_initialise(WINDOW *win, const char *str_filename)
 
 void state_update(void)
 {
+    wtimeout(window, (atlas_prefetching(atlas)) ? STATE_TICK_LOADING_MS : STATE_TICK_MS);
     key k = wgetch(state_window());
+
+    /* no key within the tick: nothing to do but merge what has been read and let the autosave catch up */
+    atlas_merge(atlas);
+    action_autosave();
+    if (ERR == k) return;
     key_curr = k;
+    history_begin();
 
     if ((MODE_COMMAND != state_mode()) && (KEY_TOGGLE_HELP == k)) {
         action_hint();
@@ -83,6 +101,8 @@ void state_update(void)
     } else if (STATUS_OK != status) {
         action_capture(k);
         return;
+    } else if ((MODE_COMMAND != state_mode()) && (MODE_CAPTURE != state_mode()) && ((KEY_HISTORY_UNDO == k) || (KEY_HISTORY_REDO == k))) {
+        action_history(k);
     } else {
         switch (state_mode()) {
             case MODE_CAPTURE:
@@ -118,12 +138,14 @@ void state_update(void)
 
     ui_update();
     geometry_calculate_viewpoint(atlas_coordinate(state_atlas()));
+    atlas_trim(state_atlas());
 }
 
 
 void state_set_quit(bool q) { quit = q; }
 void state_set_modified(bool m) { modified = m; }
 void state_set_status(enum STATUS s) { status = s; }
+void state_set_brush(uint32_t b) { brush = (b > STATE_BRUSH_MAX) ? STATE_BRUSH_MAX : b; }
 
 
 void state_set_cwd(const char *str_cwd)
@@ -137,6 +159,8 @@ void state_set_atlas(struct Atlas *a)
 {
     if (atlas) return;
     atlas = a;
+    atlas_set_watcher(atlas, history_watcher());
+    history_clear();
 }
 
 
@@ -150,6 +174,7 @@ void state_set_filename(const char *str)
 void state_clear_atlas(void)
 {
     if (!atlas) return;
+    history_clear();
     atlas_destroy(atlas);
     atlas = NULL;
 }
@@ -181,6 +206,7 @@ void state_deinitialise(void)
     mode_prev = MODE_NONE;
     window = NULL;
 
+    autosave_deinitialise(atlas);
     state_clear_atlas();
     state_clear_filename();
 }
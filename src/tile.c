@@ -1,3 +1,4 @@
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -22,13 +23,16 @@ struct Tile
     enum TERRAIN terrain;
     uint8_t roads;
     uint8_t rivers;
+    bool dirty;
+    uint32_t shares;        /* the chart's, kept here where it costs no space */
 };
 
 
 struct Tile *tile_create(void)
 {
-    static uint32_t global_seed = 0;
-    if (global_seed == 0) global_seed = (uint32_t) time(NULL);
+    /* per thread, so tiles can be made while loading on the worker pool */
+    static _Thread_local uint32_t global_seed = 0;
+    if (global_seed == 0) global_seed = ((uint32_t) time(NULL) ^ (uint32_t)(uintptr_t)&global_seed) | 1;
     global_seed = xorshift(global_seed);
 
     struct Tile *tile = malloc(sizeof(struct Tile));
@@ -38,12 +42,25 @@ struct Tile *tile_create(void)
     tile->location = NULL;
     tile->roads = 0;
     tile->rivers = 0;
+    tile->dirty = false;
+    tile->shares = 0;
 
     return tile;
 }
 
 
+struct Tile *tile_copy(const struct Tile *tile)
+{
+    struct Tile *copy = malloc(sizeof(struct Tile));
+
+    *copy = *tile;
+    copy->shares = 0;
+    return copy;
+}
+
+
 void tile_destroy(struct Tile *tile) { free(tile); }
+size_t tile_size(void) { return sizeof(struct Tile); }
 uint32_t tile_seed(const struct Tile *tile) { return tile->seed; }
 enum TERRAIN tile_terrain(const struct Tile *tile) { return tile->terrain; }
 uint8_t tile_roads(const struct Tile *tile) { return tile->roads; }
@@ -55,6 +72,27 @@ void tile_set_rivers(struct Tile *tile, uint8_t rivers) { tile->rivers = rivers;
 void tile_clear_roads(struct Tile *tile) { tile->roads = 0; }
 struct Location *tile_location(struct Tile *tile) { return tile->location; }
 void tile_clear_rivers(struct Tile *tile) { tile->rivers = 0; }
+bool tile_dirty(const struct Tile *tile) { return tile->dirty; }
+void tile_set_dirty(struct Tile *tile, bool dirty) { tile->dirty = dirty; }
+uint32_t tile_shares(const struct Tile *tile) { return tile->shares; }
+void tile_set_shares(struct Tile *tile, uint32_t shares) { tile->shares = shares; }
+
+
+/* a hash of the tile's seed, terrain, roads and rivers, never 0 as a missing tile's is */
+uint64_t tile_hash(const struct Tile *tile)
+{
+    uint64_t h = ((uint64_t)tile->seed << 24) | ((uint64_t)(uint8_t)tile->terrain << 16)
+        | ((uint64_t)tile->roads << 8) | tile->rivers;
+
+    /* the fields fill 56 bits, and the mix takes only 0 to 0 */
+    h += 1;
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
 
 
 bool tile_road(const struct Tile *tile, enum DIRECTION d)
@@ -111,3 +149,106 @@ char tile_getch(struct Tile *tile, int x, int y)
     uint32_t val = (x + xorshift(y + offset)) ^ (xorshift(x + offset) * y);
     return chopts[xorshift(val) % NUM_TERRAIN_CHOPTS];
 }
+
+
+/*
+ *  A row of tile_getch at once, for x0 <= x < x0 + n. Along a row the y half of the
+ *  hash is fixed, so the x half runs in vector lanes with the same 32 bit wrapping
+ *  arithmetic, and the result is identical to calling tile_getch for every x.
+ */
+
+void tile_getch_row_scalar(const char *chopts, uint32_t offset, int x0, int n, int y, char *out)
+{
+    uint32_t a = xorshift(y + offset);
+    for (int i = 0; i < n; i++) {
+        int x = x0 + i;
+        uint32_t val = (x + a) ^ (xorshift(x + offset) * y);
+        out[i] = chopts[xorshift(val) % NUM_TERRAIN_CHOPTS];
+    }
+}
+
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TILE_GETCH_SIMD
+
+typedef uint32_t tile_u32x4 __attribute__((vector_size(16)));
+typedef uint32_t tile_u32x8 __attribute__((vector_size(32)));
+
+
+__attribute__((target("sse2")))
+void tile_getch_row_sse2(const char *chopts, uint32_t offset, int x0, int n, int y, char *out)
+{
+    const tile_u32x4 ramp = { 0, 1, 2, 3 };
+    uint32_t a = xorshift(y + offset);
+    int i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        tile_u32x4 x = ramp + (uint32_t)(x0 + i);
+        tile_u32x4 b = x + offset;
+        b ^= b << 13;
+        b ^= b >> 17;
+        b ^= b << 5;
+
+        tile_u32x4 val = (x + a) ^ (b * (uint32_t)y);
+        val ^= val << 13;
+        val ^= val >> 17;
+        val ^= val << 5;
+        val %= NUM_TERRAIN_CHOPTS;
+
+        for (int j = 0; j < 4; j++) out[i + j] = chopts[val[j]];
+    }
+
+    tile_getch_row_scalar(chopts, offset, x0 + i, n - i, y, out + i);
+}
+
+
+__attribute__((target("avx2")))
+void tile_getch_row_avx2(const char *chopts, uint32_t offset, int x0, int n, int y, char *out)
+{
+    const tile_u32x8 ramp = { 0, 1, 2, 3, 4, 5, 6, 7 };
+    uint32_t a = xorshift(y + offset);
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        tile_u32x8 x = ramp + (uint32_t)(x0 + i);
+        tile_u32x8 b = x + offset;
+        b ^= b << 13;
+        b ^= b >> 17;
+        b ^= b << 5;
+
+        tile_u32x8 val = (x + a) ^ (b * (uint32_t)y);
+        val ^= val << 13;
+        val ^= val >> 17;
+        val ^= val << 5;
+        val %= NUM_TERRAIN_CHOPTS;
+
+        for (int j = 0; j < 8; j++) out[i + j] = chopts[val[j]];
+    }
+
+    tile_getch_row_sse2(chopts, offset, x0 + i, n - i, y, out + i);
+}
+#endif
+
+
+void (*tile_getch_kernel)(const char *, uint32_t, int, int, int, char *) = NULL;
+pthread_once_t tile_getch_once = PTHREAD_ONCE_INIT;
+
+
+/* the widest kernel the processor runs, picked once for every rendering thread */
+void tile_getch_initialise(void)
+{
+    tile_getch_kernel = tile_getch_row_scalar;
+#ifdef TILE_GETCH_SIMD
+    if (__builtin_cpu_supports("sse2")) tile_getch_kernel = tile_getch_row_sse2;
+    if (__builtin_cpu_supports("avx2")) tile_getch_kernel = tile_getch_row_avx2;
+#endif
+}
+
+
+void tile_getch_row(const struct Tile *tile, int x0, int n, int y, char *out)
+{
+    pthread_once(&tile_getch_once, tile_getch_initialise);
+
+    const char *chopts = terrain_chopts(tile_terrain(tile));
+    tile_getch_kernel(chopts, tile->seed + tile_terrain(tile), x0, n, y, out);
+}